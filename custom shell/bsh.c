@@ -1,7 +1,11 @@
-/* Simple Shell Program */
+/* Simple Shell Program
+**
+**  bsh                 interactive shell (if stdin is a terminal) or read commands from stdin
+**  bsh -c 'cmds' [name [arg ...]]      run the commands in the string
+**  bsh script.sh [arg ...]             run the commands in the file
+*/
 
 #include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,149 +16,208 @@
 #include <termios.h>
 #include <unistd.h>
 
-#define MAX_LINE 128        // maximum length of command
-#define MAX_ARGS 32         // maximum number of args
-#define MAX_CMDS 16         // maximum number of commands
-#define DELIMS " \t\r\n"    // delimiters
+#include "builtin.h"
+#include "exec.h"
+#include "history.h"
+#include "jobs.h"
+#include "lineedit.h"
+#include "parallel.h"
+#include "parse.h"
+#include "pathhash.h"
+#include "script.h"
+
+#define READ_SIZE 65536     // read size for scripts
+#define HISTORY_FILE ".bsh_history"
 
 // Keep track of attributes of the shell.
 pid_t shell_pgid;           // shell process group ID
 struct termios shell_tmodes;// shell terminal modes
 int shell_terminal;
 int shell_is_interactive;
+const char *script_name;    // name used in error messages of scripts
+long script_line;           // line number used in error messages of scripts
 
-/* ============ Redirects cmd (>)(1>)(2>)(>>)(2>>)(&>)(<) file ============================= */
-void redirect (char *cmd[], char *file, int std_ioe, int append, int bg)
-{
-    pid_t pid;                      // processor id
-    int fd, status;                 // file decriptor and status
-    if (std_ioe == 0) {             // stdin selected (cmd < file)
-        fd = open(file, O_RDONLY);
-    } else if (append) {            // append cmd to file
-        fd = open(file, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    } else {                        // truncate
-        fd = open(file, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    }
-    if ((pid = fork()) < 0) {       // fork failed
-        perror ("fork");
-        exit(1);
-    } else if (pid == 0) {          // child process
+// Buffered input for scripts: large reads, lines of any length.
+struct reader {
+    int fd;
+    char *buf;              // read buffer
+    size_t size;            // allocated size of buf
+    size_t start, end;      // unconsumed input is buf[start..end)
+};
 
-        // Restore interactive and job-control signals.
-        signal (SIGINT, SIG_DFL);
-        signal (SIGQUIT, SIG_DFL);
-        signal (SIGTSTP, SIG_DFL);
-        signal (SIGTTIN, SIG_DFL);
-        signal (SIGTTOU, SIG_DFL);
-        signal (SIGCHLD, SIG_DFL);
+// Lines of a command that is not complete yet (an if without its fi, ...).
+struct pending {
+    char *text;
+    size_t len, size;
+    long line;              // line the command starts on
+};
 
-        if (std_ioe == 3) {         // used for cmd &> file
-            dup2 (fd, 1);           // set stdout to output to file
-            dup2 (fd, 2);           // set stderr to output to file
-        } else {
-            dup2 (fd, std_ioe);     // set std(in/out/err) to output to file
-        }
-        close(fd);                  // close file decriptor
-        execvp (cmd[0], cmd);       // exec command
-        perror ("execvp");
-        exit(1);
-    } else {                        // parent process
-        pid_t childPid;
-        childPid = wait(&status);
-    }
+/* ============ Child Processes ============================================================ */
+// run in every forked child before exec
+void child_setup (void)
+{
+    // Join the process group of the job (before SIGTTOU stops us taking the terminal).
+    jobs_child_setup ();
+
+    // Restore interactive and job-control signals.
+    signal (SIGINT, SIG_DFL);
+    signal (SIGQUIT, SIG_DFL);
+    signal (SIGTSTP, SIG_DFL);
+    signal (SIGTTIN, SIG_DFL);
+    signal (SIGTTOU, SIG_DFL);
+    signal (SIGCHLD, SIG_DFL);
 }
 
-/* ============ Multi pipe cmd0 | cmd1 ... | cmdn ================================================= */
-void multi_pipe (char *cmds[][MAX_CMDS][MAX_ARGS], int n, int *bg)
+/* ============ Command Lines ============================================================== */
+// exit [n]: leave the shell
+int shell_exit (char *argv[])
 {
-    pid_t pid;
-    int status, i, j;
+    if (shell_is_interactive) printf("Exiting shell...\n\n");
+    exit(argv[1] ? atoi(argv[1]) : (shell_is_interactive ? 1 : script_status));
+}
 
-    // set up all the pipes
-    int pipes[n*2];
-    for (i = 0; i < n; i++) {
-        if (pipe(pipes + (i*2)) < 0) {      // pipe failed
-            perror("pipe");
-            exit(1);
-        }
-    }
+static const struct builtin shell_builtins[] = {
+    {"exit", shell_exit},
+};
 
-    // fork the child processes
-    for (i = 0; i <= n; i++) {
-        if ((pid = fork()) < 0) {           // fork failed
-            perror ("fork");
-            exit(1);
-        } else if (pid == 0) {              // child process
-
-            // Restore interactive and job-control signals.
-            signal (SIGINT, SIG_DFL);
-            signal (SIGQUIT, SIG_DFL);
-            signal (SIGTSTP, SIG_DFL);
-            signal (SIGTTIN, SIG_DFL);
-            signal (SIGTTOU, SIG_DFL);
-            signal (SIGCHLD, SIG_DFL);
+// ^C while the shell itself runs commands: stops its loops
+void interrupt (int sig)
+{
+    script_interrupted = 1;
+}
 
-            if (i != n) {                   // does not apply to last cmd
-                dup2 (pipes[(i*2)+1], 1);   // set stdout to pipe output
-            }
-            if (i != 0) {                   // does not apply to first cmd
-                dup2 (pipes[(i*2)-2], 0);   // set stdin to previous pipe input
-            }
+// compile and run shell text that starts at line; returns 1 (if more is set) when the text
+// ends inside a command and further lines may complete it, else 0
+int run_text (const char *text, long line, int more)
+{
+    struct script_error err;
+    struct script *s = script_compile (text, line, &err);
+    if (!s) {
+        if (err.incomplete && more) return 1;
+        if (script_name) fprintf (stderr, "bsh: %s: line %ld: %s\n", script_name, err.line,
+                                  err.msg);
+        else fprintf (stderr, "bsh: %s\n", err.msg);
+        script_status = 2;
+        return 0;
+    }
+    script_run (s);                         // the tree stays while functions use it
+    script_release (s);
+    return 0;
+}
 
-            // IMPORTANT! close all pipe ends
-            for (j = 0; j < n*2; j++) {
-                close(pipes[j]);
-            }
-            execvp (cmds[0][i][0], cmds[0][i]);
-            perror ("execvp");
+// add a line to a pending command
+void pending_add (struct pending *c, const char *line)
+{
+    size_t n = strlen(line);
+    if (c->len + n + 2 > c->size) {
+        c->size = 2 * (c->len + n + 2);
+        if (!(c->text = realloc(c->text, c->size))) {
+            perror("bsh");
             exit(1);
         }
     }
+    memcpy(c->text + c->len, line, n);
+    c->len += n;
+    c->text[c->len++] = '\n';
+    c->text[c->len] = '\0';
+}
 
-    // only the parent will reach this part
-    // IMPORTANT! close up the pipes
-    for (i = 0; i < n*2; i++) {
-        close(pipes[i]);
-    }
-    // wait for all child processes to finish
-    for (i = 0; i <= n;  i++) {
-        wait(&status);
+/* ============ Scripts ==================================================================== */
+// return the next line of input without its newline, NULL at end of file
+char *read_line (struct reader *r)
+{
+    char *nl;
+    ssize_t n;
+    while (1) {
+        if ((nl = memchr(r->buf + r->start, '\n', r->end - r->start)) != NULL) {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            r->start = nl - r->buf + 1;
+            return line;
+        }
+        if (r->start > 0) {                 // move the partial line to the front
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->size - r->end < READ_SIZE) { // make room for a full read plus terminator
+            r->size = r->size ? r->size * 2 : 2 * READ_SIZE;
+            if (!(r->buf = realloc(r->buf, r->size))) {
+                perror("bsh");
+                exit(1);
+            }
+        }
+        if ((n = read(r->fd, r->buf + r->end, r->size - r->end - 1)) < 0) {
+            if (errno == EINTR) continue;
+            perror("bsh: read");
+            return NULL;
+        }
+        if (n == 0) {                       // end of file: last line may lack a newline
+            if (r->end == r->start) return NULL;
+            r->buf[r->end] = '\0';
+            r->start = r->end;
+            return r->buf;
+        }
+        r->end += n;
     }
 }
 
-/* ============ Run Individual Commands ==================================================== */
-void runcmd (char *cmd[])
+// run the commands read from fd, each one as soon as its last line arrived
+int run_fd (int fd)
 {
-    pid_t pid;
-    int status;
-    if ((pid = fork()) < 0) {
-        perror ("fork");
-        exit(1);
-    } else if (pid == 0) {          // child fork
-
-        // Restore interactive and job-control signals.
-        signal (SIGINT, SIG_DFL);
-        signal (SIGQUIT, SIG_DFL);
-        signal (SIGTSTP, SIG_DFL);
-        signal (SIGTTIN, SIG_DFL);
-        signal (SIGTTOU, SIG_DFL);
-        signal (SIGCHLD, SIG_DFL);
-
-        execvp(cmd[0], cmd);
-        perror("execvp");
-        exit(1);                    // make sure to exit
-    } else {                        // parent
-        pid_t childPid;
-        childPid = wait(&status);
+    struct reader r = {fd, NULL, 0, 0, 0};
+    struct pending cmd = {NULL, 0, 0, 0};
+    char *line;
+    while ((line = read_line (&r)) != NULL) {
+        if (cmd.len == 0) cmd.line = script_line + 1;
+        script_line++;
+        pending_add (&cmd, line);
+        if (!run_text (cmd.text, cmd.line, 1)) cmd.len = 0;
     }
+    if (cmd.len) run_text (cmd.text, cmd.line, 0);     // input ended inside a command
+    free(r.buf);
+    free(cmd.text);
+    return script_status;
 }
 
 /* ===========  Main Shell Program ========================================================= */
 int main (int argc, char *argv[])
 {
+    // Remember where commands are found in $PATH (falls back to execvp if NULL).
+    path_cache = pathhash_create ();
+
+    // Commands are run through the shared executor.
+    exec_child_hook = child_setup;
+
+    // Children are reaped through a signalfd by the job table.
+    jobs_init ();
+    parallel_init ();
+    builtin_register (shell_builtins, sizeof shell_builtins / sizeof *shell_builtins);
+
+    // Non-interactive modes: bsh -c 'cmds' [name [arg ...]], bsh script [arg ...]
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "bsh: -c: option requires an argument\n");
+            return 2;
+        }
+        script_name = "-c";
+        script_init (argc > 3 ? argv[3] : argv[0], argc > 3 ? argv + 3 : NULL);
+        run_text (argv[2], 1, 0);
+        return script_status;
+    } else if (argc > 1) {
+        script_name = argv[1];
+        script_init (argv[1], argv + 1);
+        return script_source (argv[1], NULL);
+    }
+    script_init (argv[0], NULL);
+
     // See if we are running interactively.
     shell_terminal = STDIN_FILENO;
     shell_is_interactive = isatty (shell_terminal);
+    if (!shell_is_interactive) {            // commands piped into the shell
+        script_name = "stdin";
+        return run_fd (STDIN_FILENO);
+    }
 
     if (shell_is_interactive) {
         // Loop until we are in the foreground.
@@ -162,17 +225,17 @@ int main (int argc, char *argv[])
             kill (- shell_pgid, SIGTTIN);
         }
 
-        // Ignore interactive and job-control signals.
-        signal (SIGINT, SIG_IGN);
+        // Ignore interactive and job-control signals, ^C only stops loops of the shell.
+        signal (SIGINT, interrupt);
         signal (SIGQUIT, SIG_IGN);
         signal (SIGTSTP, SIG_IGN);
         signal (SIGTTIN, SIG_IGN);
         signal (SIGTTOU, SIG_IGN);
-        signal (SIGCHLD, SIG_IGN);
 
-        // Put ourselves in our own process group.
+        // Put ourselves in our own process group (a session leader, e.g. the shell of a
+        // terminal or a server session, already leads one and may not change it).
         shell_pgid = getpid ();
-        if (setpgid (shell_pgid, shell_pgid) < 0) {
+        if (getpgrp () != shell_pgid && setpgid (shell_pgid, shell_pgid) < 0) {
             perror ("Couldn't put the shell in its own process group.");
             exit(1);
         }
@@ -183,108 +246,28 @@ int main (int argc, char *argv[])
         // Save default terminal attributes for shell.
         tcgetattr (shell_terminal, &shell_tmodes);
 
-        // Special tokens.
-        char *special[9] = {"&", ">", "1>", "2>", ">>", "2>>", "&>", "<", "|"};
+        struct pending cmd = {NULL, 0, 0, 1};
+        char *input, history[4096];
+
+        // History shared by all shells of the user.
+        snprintf (history, sizeof history, "%s/%s", getenv ("HOME") ? getenv ("HOME") : ".",
+                  HISTORY_FILE);
+        history_open (history);
 
         // Read the user input and execute jobs.
         while (1) {
-            printf ("bsh$ ");
-            fflush(stdout);
-
-            // reset user input array
-            char input[MAX_LINE] = {0};
+            if (cmd.len == 0) jobs_notify (); // report background jobs that finished
 
-            // read the user input
-            if (!fgets(input, MAX_LINE, stdin)) {
+            // read the user input with the line editor, "> " for the rest of a command
+            if (!(input = lineedit_read (cmd.len ? "> " : "bsh$ "))) {
                 printf ("Error reading input.\n");
                 break;
             }
 
-            // (Re)initialize variables
-            char *stok[(MAX_CMDS)-1] = {0};         // array for redirect tokens
-            char *cmd = {0};                        // holds the input string
-            char *cmds[MAX_CMDS][MAX_ARGS] = {0};   // array of commands
-            int cmdc = 0;                           // reset commands counter
-            int tokc = 0;                           // reset token counter
-            int bg[MAX_CMDS] = {0};                 // array for & tokens
-            int bgflag;                             // bg flag
-            int tokflag;                            // redirect token flag
-            int run = 0;                            // run flag
-
-            // parse the string into seperate tokens and store them into an array
-            if (input != NULL && (input[0] != '\n')) {
-                run = 1;                            // set the valid run flag
-                bg[cmdc] = 0;                       // is it background process?
-                cmd = strtok (input, DELIMS);       // retrieve first token
-                while (cmd != NULL) {               // parse the input string
-                    bgflag = 0;                     // bg flag lowered
-                    tokflag = 0;                    // redirect token flag lowered
-                    int ii;                         // special token detection starts here
-                    for (ii = 0; ii < 9; ii++) {    // IMPORTANT: range should equal length of array
-                        if (strcmp(cmd, special[ii]) == 0) {    // is it a special token?
-                            if (ii == 0) {          // is it an ampersand?
-                                bg[cmdc] = 1;       // this command will execute in the bg
-                                bgflag++;           // raise bg flag
-                                break;
-                            } else {                // if not, then it must be a redirect token
-                                stok[cmdc] = malloc (strlen(special[ii])+1);    // allocate space for token
-                                strcpy (stok[cmdc], special[ii]);   // store token in stok
-                                tokflag++;          // raise the redirect token flag
-                                break;
-                            }
-                        }
-                    }
-                    if (tokflag) {                  // special token detected
-                        cmds[cmdc][tokc] = malloc (1);  // allocate memory for string terminator
-                        cmds[cmdc][tokc] = '\0';    // store string terminator
-                        cmdc++;                     // increase command count
-                        bg[cmdc] = 0;               // set next process as foreground process
-                        tokc = 0;                   // reset the token counter
-                    } else if (bgflag == 0) {       // if bg flag raised, skip this
-                        cmds[cmdc][tokc] = malloc (strlen(cmd)+1);  // allocate mem for token
-                        strcpy (cmds[cmdc][tokc], cmd); // store command
-                        tokc++;                     // increase token count
-                    }
-                    cmd = strtok (NULL, DELIMS);    // retrieve the next token
-                } // parser block
-
-          // Print useful values for debugging
-          // printf("cmds[0]: %s %s %s %s %s\n",cmds[0][0],cmds[0][1],cmds[0][2],cmds[0][3],cmds[0][4]);
-          // printf("cmds[1]: %s %s %s %s %s\n",cmds[1][0],cmds[1][1],cmds[1][2],cmds[1][3],cmds[1][4]);
-          // printf("     bg: %d %d\n",bg[0], bg[1]);
-          // printf("   cmdc: %d\n   tokc: %d\n", cmdc, tokc);
-          // printf("   stok: %s %s %s %s\n\n", stok[0], stok[1], stok[2], stok[3]);
-
-                // run commands based on the parsed command line
-                if (run) {
-                    if (strcmp(cmds[0][0], "exit") == 0) {      // exit command takes priority
-                        printf("Exiting shell...\n\n");
-                        exit(1);
-                    } else if (cmdc) {  // Redirections         // prevents segfault, if # cmds > 1
-                        if (strcmp(stok[0], ">") == 0) {        // redirect stdout of cmd to file
-                            redirect(cmds[0], cmds[1][0], 1, 0, bg[0]);
-                        } else if (strcmp(stok[0], "1>") == 0) {// same as above, 1 is default fd
-                            redirect(cmds[0], cmds[1][0], 1, 0, bg[0]);
-                        } else if (strcmp(stok[0], "2>") == 0) {// redirect stderr of cmd to a file
-                            redirect(cmds[0], cmds[1][0], 2, 0, bg[0]);
-                        } else if (strcmp(stok[0], ">>") == 0) {// append stdout of cmd to a file
-                            redirect(cmds[0], cmds[1][0], 1, 1, bg[0]);
-                        } else if (strcmp(stok[0], "2>>") == 0){// append stderr of cmd to a file
-                            redirect(cmds[0], cmds[1][0], 2, 1, bg[0]);
-                        } else if (strcmp(stok[0], "&>") == 0) {// redirect stdout and stderr of cmd to a file
-                            redirect(cmds[0], cmds[1][0], 3, 0, bg[0]);
-                        } else if (strcmp(stok[0], "<") == 0) { // redirect contents of file to stdin of cmd
-                            redirect(cmds[0], cmds[1][0], 0, 0, bg[0]);
-                        } else if (strcmp(stok[0], "|") == 0) { // set up (multiple) pipes
-                            multi_pipe(&cmds, cmdc, bg);
-                        } else {                                // if unable to detect special token
-                            runcmd(cmds[0]);                    // try to run single command
-                        }
-                    } else {
-                        runcmd(cmds[0]);                        // run single command
-                    }
-                } // run commands block */
-            } // if (input != NULL)
+            // remember the line, run the command once it is complete
+            history_add (input);
+            pending_add (&cmd, input);
+            if (!run_text (cmd.text, 1, 1)) cmd.len = 0;
         } // while (1)
     } // if (shell_is_interactive)
 } // main (int argc, char *argv[])
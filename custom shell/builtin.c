@@ -0,0 +1,504 @@
+/* Shell builtins shared by bsh and the command server */
+
+#define _GNU_SOURCE         // splice(), tee(), F_SETPIPE_SZ
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "pathhash.h"
+
+#define CAT_MAX 65536       // larger files are left to the external cat
+#define BUILTIN_TABLES 8    // tables builtin_register() can hold
+#define FANOUT_MAX 16       // outputs of fanout
+#define COPY_SIZE 65536     // buffer of fanout when it cannot splice
+
+extern char **environ;
+
+/* ============ Builtin Commands =========================================================== */
+// echo [-n] [arg ...]
+static int b_echo (char *argv[])
+{
+    int i = 1, newline = 1;
+    if (argv[1] && strcmp(argv[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    for (; argv[i]; i++) {
+        fputs(argv[i], stdout);
+        if (argv[i+1]) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+// pwd
+static int b_pwd (char *argv[])
+{
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof cwd)) {
+        perror("pwd");
+        return 1;
+    }
+    puts(cwd);
+    return 0;
+}
+
+// cd [dir], defaults to $HOME
+static int b_cd (char *argv[])
+{
+    char *dir = argv[1] ? argv[1] : getenv("HOME");
+    if (!dir) {
+        fprintf(stderr, "cd: HOME not set\n");
+        return 1;
+    }
+    if (chdir(dir) < 0) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// true, false
+static int b_true (char *argv[]) { return 0; }
+static int b_false (char *argv[]) { return 1; }
+
+// integer operand of test, -1 if it is not one
+static int test_number (const char *s, long *n)
+{
+    char *end;
+    *n = strtol(s, &end, 10);
+    if (*s && !*end) return 0;
+    fprintf(stderr, "test: %s: integer expression expected\n", s);
+    return -1;
+}
+
+// test expr, [ expr ]: one unary or binary test on strings, integers or files, maybe
+// negated with !; 2 for an expression it does not understand
+static int b_test (char *argv[])
+{
+    static const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    char **a = argv + 1;
+    struct stat st;
+    int n = 0, t, neg = 0, i;
+    long x, y;
+
+    while (a[n]) n++;
+    if (strcmp(argv[0], "[") == 0 && (n == 0 || strcmp(a[--n], "]") != 0)) {
+        fprintf(stderr, "[: missing `]'\n");
+        return 2;
+    }
+    if (n > 0 && strcmp(a[0], "!") == 0) {
+        neg = 1;
+        a++;
+        n--;
+    }
+    if (n == 0) {
+        t = 0;
+    } else if (n == 1) {
+        t = a[0][0] != '\0';
+    } else if (n == 2 && a[0][0] == '-' && a[0][1] && !a[0][2]) {
+        switch (a[0][1]) {
+            case 'n': t = a[1][0] != '\0'; break;
+            case 'z': t = a[1][0] == '\0'; break;
+            case 'e': t = stat(a[1], &st) == 0; break;
+            case 'f': t = stat(a[1], &st) == 0 && S_ISREG(st.st_mode); break;
+            case 'd': t = stat(a[1], &st) == 0 && S_ISDIR(st.st_mode); break;
+            case 's': t = stat(a[1], &st) == 0 && st.st_size > 0; break;
+            case 'r': t = access(a[1], R_OK) == 0; break;
+            case 'w': t = access(a[1], W_OK) == 0; break;
+            case 'x': t = access(a[1], X_OK) == 0; break;
+            default: t = -1;
+        }
+    } else if (n == 3 && strcmp(a[1], "=") == 0) {
+        t = strcmp(a[0], a[2]) == 0;
+    } else if (n == 3 && strcmp(a[1], "!=") == 0) {
+        t = strcmp(a[0], a[2]) != 0;
+    } else if (n == 3) {
+        for (i = 0; i < 6 && strcmp(a[1], ops[i]) != 0; i++);
+        if (i < 6 && (test_number(a[0], &x) < 0 || test_number(a[2], &y) < 0)) return 2;
+        t = i == 6 ? -1 : i == 0 ? x == y : i == 1 ? x != y : i == 2 ? x < y :
+            i == 3 ? x <= y : i == 4 ? x > y : x >= y;
+    } else {
+        t = -1;
+    }
+    if (t < 0) {
+        fprintf(stderr, "test: unknown expression\n");
+        return 2;
+    }
+    return t == neg;
+}
+
+// cat file ... (only regular files up to CAT_MAX bytes, anything else is exec'd)
+static int b_cat (char *argv[])
+{
+    char buf[CAT_MAX];
+    struct stat st;
+    int i, fd, status = 0;
+    ssize_t n;
+
+    if (!argv[1]) return BUILTIN_EXEC;          // reading stdin may block, use the real cat
+    for (i = 1; argv[i]; i++) {
+        if (argv[i][0] == '-') return BUILTIN_EXEC;
+        if (stat(argv[i], &st) == 0 && (!S_ISREG(st.st_mode) || st.st_size > CAT_MAX))
+            return BUILTIN_EXEC;
+    }
+    for (i = 1; argv[i]; i++) {
+        if ((fd = open(argv[i], O_RDONLY)) < 0) {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        while ((n = read(fd, buf, sizeof buf)) > 0) fwrite(buf, 1, n, stdout);
+        close(fd);
+    }
+    return status;
+}
+
+// date [+format]
+static int b_date (char *argv[])
+{
+    char buf[256];
+    time_t t = time(NULL);
+    const char *fmt = "%a %b %e %H:%M:%S %Z %Y";
+    if (argv[1]) {
+        if (argv[1][0] != '+' || argv[2]) return BUILTIN_EXEC;
+        fmt = argv[1] + 1;
+    }
+    strftime(buf, sizeof buf, fmt, localtime(&t));
+    puts(buf);
+    return 0;
+}
+
+// env (without arguments: print the environment)
+static int b_env (char *argv[])
+{
+    char **e;
+    if (argv[1]) return BUILTIN_EXEC;
+    for (e = environ; *e; e++) puts(*e);
+    return 0;
+}
+
+// hash [-r] [name ...]
+static int b_hash (char *argv[])
+{
+    char path[1024];
+    int i, status = 0;
+    if (!path_cache) {
+        fprintf(stderr, "hash: hashing disabled\n");
+        return 1;
+    }
+    if (!argv[1]) {
+        pathhash_print(path_cache, stdout);
+        return 0;
+    }
+    for (i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            pathhash_forget(path_cache, NULL);
+        } else if (pathhash_lookup(path_cache, argv[i], path, sizeof path) < 0) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// kill [-signal] pid ...
+static int b_kill (char *argv[])
+{
+    static const struct { const char *name; int sig; } sigs[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+        {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}
+    };
+    int i = 1, j, sig = SIGTERM, status = 0;
+    char *end;
+
+    if (argv[1] && argv[1][0] == '-') {
+        char *name = argv[1] + 1;
+        if (strncmp(name, "SIG", 3) == 0) name += 3;
+        sig = strtol(name, &end, 10);
+        if (*end || end == name) {              // not a number, try a signal name
+            for (j = 0; j < sizeof sigs / sizeof sigs[0]; j++) {
+                if (strcmp(name, sigs[j].name) == 0) break;
+            }
+            if (j == sizeof sigs / sizeof sigs[0]) return BUILTIN_EXEC;
+            sig = sigs[j].sig;
+        }
+        i++;
+    }
+    if (!argv[i]) {
+        fprintf(stderr, "kill: usage: kill [-signal] pid ...\n");
+        return 1;
+    }
+    for (; argv[i]; i++) {
+        pid_t pid = strtol(argv[i], &end, 10);
+        if (argv[i][0] == '%' && builtin_job_pid) {     // %n names a job of the shell
+            if (!(pid = builtin_job_pid(argv[i]))) {
+                fprintf(stderr, "kill: %s: no such job\n", argv[i]);
+                status = 1;
+                continue;
+            }
+        } else if (*end || end == argv[i]) {
+            fprintf(stderr, "kill: %s: arguments must be process IDs\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (kill(pid, sig) < 0) {
+            fprintf(stderr, "kill: (%d) - %s\n", pid, strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// sleep seconds (fractions allowed)
+static int b_sleep (char *argv[])
+{
+    struct timespec ts;
+    double sec;
+    char *end;
+    if (!argv[1] || argv[2]) return BUILTIN_EXEC;
+    if (builtin_job_control && *builtin_job_control) return BUILTIN_EXEC;   // ^Z stops it
+    sec = strtod(argv[1], &end);
+    // suffixes like 1m, and inf, nan or more seconds than time_t holds (at least a long) are
+    // left to sleep(1)
+    if (*end || !(sec >= 0 && sec < (double)LONG_MAX)) return BUILTIN_EXEC;
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)((sec - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    return 0;
+}
+
+/* ============ Builtin Table ============================================================== */
+// pipesize [bytes]: buffer size of the pipes between pipeline stages, 0 for the default
+static int b_pipesize (char *argv[])
+{
+    int p[2], size;
+    char *end;
+    long n;
+    if (!argv[1]) {
+        if (exec_pipe_size > 0) printf("%d\n", exec_pipe_size);
+        else printf("default\n");
+        return 0;
+    }
+    errno = 0;
+    n = strtol(argv[1], &end, 10);
+    if (errno || end == argv[1] || *end || n < 0 || n > INT_MAX) {
+        fprintf(stderr, "pipesize: %s: invalid size\n", argv[1]);
+        return 1;
+    }
+    if ((size = n) == 0) {
+        exec_pipe_size = 0;
+        return 0;
+    }
+    // try it on a pipe: the kernel rounds up, and unprivileged users are limited by
+    // /proc/sys/fs/pipe-max-size
+    if (pipe(p) < 0) {
+        perror("pipesize");
+        return 1;
+    }
+    if ((size = fcntl(p[1], F_SETPIPE_SZ, size)) < 0) {
+        fprintf(stderr, "pipesize: %s: %s\n", argv[1], strerror(errno));
+    } else {
+        exec_pipe_size = size;
+    }
+    close(p[0]);
+    close(p[1]);
+    return size < 0;
+}
+
+static int write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// pass n bytes from the head of the pipe in to fd: spliced, or copied once fd turned out not
+// to take splices (*copy is set then, e.g. for a terminal)
+static int pass_on (int in, int fd, size_t n, int *copy)
+{
+    char buf[COPY_SIZE];
+    ssize_t r;
+    while (n > 0) {
+        if (!*copy) {
+            r = splice(in, NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (r < 0 && errno == EINVAL) {
+                *copy = 1;
+                continue;
+            }
+        } else if ((r = read(in, buf, n < sizeof buf ? n : sizeof buf)) > 0) {
+            if (write_all(fd, buf, r) < 0) return -1;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        n -= r;
+    }
+    return 0;
+}
+
+// fanout [-a] file ...: copy stdin to stdout and to every file, like tee. If stdin is a pipe,
+// the data does not pass through this process: tee(2) duplicates the pages of stdin into a
+// scratch pipe, which is spliced into each output but the last, and the last output gets the
+// pages of stdin itself. Outputs that cannot take a splice are written from a buffer.
+static int b_fanout (char *argv[])
+{
+    int fd[FANOUT_MAX + 1], copy[FANOUT_MAX + 1] = {0}, scratch[2] = {-1, -1};
+    int n = 0, i, flags = O_WRONLY | O_CREAT | O_TRUNC, status = 0;
+    char buf[COPY_SIZE];
+    struct stat st;
+    ssize_t len = 1;            // stays 1 if nothing is spliced: copy below
+
+    for (i = 1; argv[i] && strcmp(argv[i], "-a") == 0; i++) {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+    for (; argv[i]; i++) {
+        if (n == FANOUT_MAX) {
+            fprintf(stderr, "fanout: more than %d files\n", FANOUT_MAX);
+            status = 1;
+            break;
+        }
+        if ((fd[n] = open(argv[i], flags | O_CLOEXEC, 0644)) < 0) {
+            fprintf(stderr, "fanout: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        n++;
+    }
+    fd[n++] = STDOUT_FILENO;
+
+    // splicing needs stdin to be a pipe, and a scratch pipe that holds as much as stdin
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        if (n > 1 && pipe2(scratch, O_CLOEXEC) == 0)
+            fcntl(scratch[1], F_SETPIPE_SZ, fcntl(STDIN_FILENO, F_GETPIPE_SZ));
+        while (n == 1 || scratch[0] >= 0) {
+            // wait for data; what the first tee gets is what every output receives
+            if (n == 1) len = splice(STDIN_FILENO, NULL, fd[0], NULL, INT_MAX, SPLICE_F_MOVE);
+            else len = tee(STDIN_FILENO, scratch[1], INT_MAX, 0);
+            if (len < 0 && errno == EINTR) continue;
+            if (len <= 0) break;
+            if (n == 1) continue;
+            for (i = 0; i < n - 1; i++) {
+                if (i > 0 && tee(STDIN_FILENO, scratch[1], len, 0) != len) break;
+                if (pass_on(scratch[0], fd[i], len, &copy[i]) < 0) break;
+            }
+            if (i < n - 1 || pass_on(STDIN_FILENO, fd[n - 1], len, &copy[n - 1]) < 0) {
+                perror("fanout");
+                status = 1;
+                break;
+            }
+        }
+        if (len < 0 && errno == EINVAL) len = 1;    // no splice at all: copy below
+    }
+    while (len > 0 && (len = read(STDIN_FILENO, buf, sizeof buf)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) {
+                len = 1;
+                continue;
+            }
+            perror("fanout");
+            status = 1;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (write_all(fd[i], buf, len) < 0) {
+                perror("fanout");
+                status = 1;
+            }
+        }
+    }
+    for (i = 0; i < n - 1; i++) close(fd[i]);
+    if (scratch[0] >= 0) {
+        close(scratch[0]);
+        close(scratch[1]);
+    }
+    return status;
+}
+
+// IMPORTANT: keep sorted by name, the table is binary searched
+static const struct builtin builtins[] = {
+    {":", b_true},
+    {"[", b_test},
+    {"cat", b_cat},
+    {"cd", b_cd},
+    {"date", b_date},
+    {"echo", b_echo},
+    {"env", b_env},
+    {"false", b_false},
+    {"fanout", b_fanout},
+    {"hash", b_hash},
+    {"kill", b_kill},
+    {"pipesize", b_pipesize},
+    {"pwd", b_pwd},
+    {"sleep", b_sleep},
+    {"test", b_test},
+    {"true", b_true},
+};
+
+pid_t (*builtin_job_pid) (const char *spec);
+const struct builtin *(*builtin_function) (const char *name);
+int *builtin_job_control;
+
+static struct {                         // builtins registered by the program
+    const struct builtin *table;
+    int n;
+} extra[BUILTIN_TABLES];
+static int nextra;
+
+static int builtin_cmp (const void *key, const void *b)
+{
+    return strcmp(key, ((const struct builtin *)b)->name);
+}
+
+void builtin_register (const struct builtin *table, int n)
+{
+    if (nextra == BUILTIN_TABLES) {
+        fprintf(stderr, "builtin_register: too many tables\n");
+        return;
+    }
+    extra[nextra].table = table;
+    extra[nextra++].n = n;
+}
+
+const struct builtin *builtin_find (const char *name)
+{
+    const struct builtin *b;
+    int i, j;
+    if (builtin_function && (b = builtin_function(name)) != NULL) return b;
+    for (i = 0; i < nextra; i++) {
+        for (j = 0; j < extra[i].n; j++) {
+            if (strcmp(name, extra[i].table[j].name) == 0) return &extra[i].table[j];
+        }
+    }
+    return bsearch(name, builtins, sizeof builtins / sizeof builtins[0], sizeof builtins[0],
+                   builtin_cmp);
+}
+
+int builtin_run (const struct builtin *b, char *argv[])
+{
+    int status = b->fn(argv);
+    if (fflush(stdout) == EOF) {            // e.g. echo >&-
+        fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+        clearerr(stdout);
+        if (status == 0) status = 1;
+    }
+    fflush(stderr);
+    return status;
+}
@@ -0,0 +1,34 @@
+/* Shell builtins: short commands executed in-process instead of with fork and exec */
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <sys/types.h>
+
+#define BUILTIN_EXEC -1     // returned by a builtin that cannot handle its arguments
+
+struct builtin {
+    const char *name;       // command name
+    int (*fn)(char *argv[]);// returns the exit status or BUILTIN_EXEC
+};
+
+// process (group) that kill signals for a %job argument, 0 if none (NULL: no jobs)
+extern pid_t (*builtin_job_pid) (const char *spec);
+
+// shell function called name, found before any builtin; NULL if none (NULL: no functions)
+extern const struct builtin *(*builtin_function) (const char *name);
+
+// nonzero while the shell has job control: builtins that only wait, like sleep, are left to
+// the external command, a process of its own that ^C and ^Z can stop (NULL: never)
+extern int *builtin_job_control;
+
+// add builtins of the program (e.g. job control in bsh), searched before the shared ones
+void builtin_register (const struct builtin *table, int n);
+
+// look up a builtin by command name, NULL if the command is external
+const struct builtin *builtin_find (const char *name);
+
+// run a builtin with stdout flushed afterwards; returns the exit status or BUILTIN_EXEC
+int builtin_run (const struct builtin *b, char *argv[]);
+
+#endif // BUILTIN_H
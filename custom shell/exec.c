@@ -0,0 +1,253 @@
+/* Pipeline execution shared by bsh and the command server */
+
+#define _GNU_SOURCE         // pipe2(), F_SETPIPE_SZ, memfd_create()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "pathhash.h"
+
+#define FILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define SAVED_FD 10         // descriptors of the shell saved around a builtin start here
+
+void (*exec_child_hook) (void) = NULL;
+void (*exec_fork_hook) (pid_t pid) = NULL;
+pid_t (*exec_wait_hook) (pid_t pid, int *status) = NULL;
+int exec_pipe_size = 0;
+
+/* ============ Redirects n< n> n>> &> n>&m n>&- n<<< word n<< delim ==================== */
+// descriptor reading the text of a here-document or here-string, held in memory
+static int open_here (struct redir *r)
+{
+    size_t len = strlen(r->file);
+    int fd;
+    if ((fd = memfd_create("here-document", MFD_CLOEXEC)) < 0) {
+        perror("here-document");
+        return -1;
+    }
+    if (write(fd, r->file, len) != (ssize_t)len ||
+        (r->type == R_HERE_STR && write(fd, "\n", 1) != 1) || lseek(fd, 0, SEEK_SET) < 0) {
+        perror("here-document");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// open the file of a redirection; close-on-exec until it is moved to its descriptor
+static int open_redir (struct redir *r)
+{
+    int fd;
+    if (r->type == R_HERE_STR || r->type == R_HERE_DOC) return open_here(r);
+    if (r->type == R_IN) {
+        fd = open(r->file, O_RDONLY | O_CLOEXEC);
+    } else if (r->type == R_APPEND) {
+        fd = open(r->file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, FILE_MODE);
+    } else {
+        fd = open(r->file, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, FILE_MODE);
+    }
+    if (fd < 0) perror(r->file);
+    return fd;
+}
+
+// n>&m: make r->fd a copy of m, or close it for n>&-
+static int dup_redir (struct redir *r)
+{
+    char *end;
+    long m;
+    if (strcmp(r->file, "-") == 0) {
+        close(r->fd);
+        return 0;
+    }
+    m = strtol(r->file, &end, 10);
+    if (end == r->file || *end || m < 0 || m > INT_MAX) {
+        fprintf(stderr, "%s: bad file descriptor\n", r->file);
+        return -1;
+    }
+    if (m == r->fd) return fcntl(r->fd, F_GETFD) < 0 ? -1 : 0;   // n>&n: only if n is open
+    if (dup2(m, r->fd) < 0) {
+        fprintf(stderr, "%s: %s\n", r->file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// do the descriptor actions of a command in order; -1 if one of them failed
+static int apply_redirs (struct redir *r)
+{
+    int fd;
+    for (; r; r = r->next) {
+        if (r->type == R_DUP) {
+            if (dup_redir(r) < 0) return -1;
+            continue;
+        }
+        if ((fd = open_redir(r)) < 0) return -1;
+        if (r->type == R_OUT_ERR) {     // used for cmd &> file
+            dup2 (fd, 1);
+            dup2 (fd, 2);
+        } else if (fd != r->fd) {
+            dup2 (fd, r->fd);           // the copy is inherited, fd itself is not
+        } else {
+            fcntl(fd, F_SETFD, 0);      // opened right where it belongs
+            continue;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/* ============ Builtins =================================================================== */
+// run a single builtin command (or bare redirections) in this process, restoring the
+// descriptors it redirected; returns BUILTIN_EXEC if the command must be forked instead
+static int run_in_shell (struct command *cmd, const struct builtin *b)
+{
+    struct redir *r;
+    int n = 0, i, status;
+    int *saved, *target;                // descriptors to restore
+
+    for (r = cmd->redirs; r; r = r->next) n++;
+    if (!(saved = malloc(4 * n * sizeof *saved + 1))) return BUILTIN_EXEC;
+    target = saved + 2 * n;
+    for (n = 0, r = cmd->redirs; r; r = r->next) {
+        target[n++] = r->type == R_OUT_ERR ? 1 : r->fd;
+        if (r->type == R_OUT_ERR) target[n++] = 2;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    // the saved copies stay out of the way of low descriptors and of every child
+    for (i = 0; i < n; i++) saved[i] = fcntl(target[i], F_DUPFD_CLOEXEC, SAVED_FD);
+    if (apply_redirs(cmd->redirs) < 0) status = 1;
+    else status = b ? builtin_run(b, cmd->argv) : 0;
+    for (i = n - 1; i >= 0; i--) {      // restore in reverse, the first save is the original
+        if (saved[i] >= 0) {
+            dup2 (saved[i], target[i]);
+            close(saved[i]);
+        } else {
+            close(target[i]);           // was not open before
+        }
+    }
+    free(saved);
+    return status;
+}
+
+/* ============ Pipelines cmd0 | cmd1 ... | cmdn =========================================== */
+// wait for one child using the hook of the program
+static pid_t wait_child (pid_t pid, int *status)
+{
+    if (exec_wait_hook) return exec_wait_hook(pid, status);
+    return waitpid(pid, status, 0);
+}
+
+// child side of a pipeline stage: connect stdin/stdout, redirect, then exec
+static void run_child (struct command *cmd, int in, int out, int unused)
+{
+    const struct builtin *b;
+    int status;
+
+    if (exec_child_hook) exec_child_hook();
+    if (in >= 0) {                      // does not apply to first cmd
+        dup2 (in, 0);                   // set stdin to previous pipe input
+        close(in);
+    }
+    if (out >= 0) {                     // does not apply to last cmd
+        dup2 (out, 1);                  // set stdout to pipe output
+        close(out);
+        close(unused);                  // read end belongs to the next cmd (a builtin stage
+    }                                   // never execs, so close-on-exec does not cover it)
+    if (apply_redirs(cmd->redirs) < 0) exit(1);
+    if (cmd->argc == 0) exit(0);        // bare redirections
+    if ((b = builtin_find(cmd->argv[0])) &&
+        (status = builtin_run(b, cmd->argv)) != BUILTIN_EXEC) {
+        exit(status);                   // builtin stage: no exec needed
+    }
+    pathhash_execvp (path_cache, cmd->argv);
+    if (errno == ENOENT) {
+        fprintf(stderr, "%s: command not found\n", cmd->argv[0]);
+        exit(127);
+    }
+    perror (cmd->argv[0]);
+    exit(126);
+}
+
+int exec_in_shell (struct pipeline *pl)
+{
+    struct command *cmd = pl->cmds;
+    const struct builtin *b = NULL;
+
+    // a lone builtin runs in the shell itself, so cd and friends work
+    if (pl->ncmds == 1 && !pl->bg && (cmd->argc == 0 || (b = builtin_find(cmd->argv[0]))))
+        return run_in_shell(cmd, b);
+    return BUILTIN_EXEC;
+}
+
+int exec_start (struct pipeline *pl, pid_t *pids)
+{
+    struct command *cmd;
+    int i, in = -1, p[2];
+
+    // fork the child processes, each one only holds the pipe ends it uses
+    for (i = 0, cmd = pl->cmds; cmd; cmd = cmd->next, i++) {
+        p[0] = p[1] = -1;
+        if (cmd->next && pipe2(p, O_CLOEXEC) < 0) {    // pipe failed
+            perror("pipe");
+            break;
+        }
+        if (cmd->next && exec_pipe_size > 0)    // larger buffer, fewer stalls between stages
+            fcntl(p[1], F_SETPIPE_SZ, exec_pipe_size);
+        if ((pids[i] = fork()) < 0) {   // fork failed
+            perror("fork");
+            close(p[0]);
+            close(p[1]);
+            break;
+        } else if (pids[i] == 0) {      // child process
+            run_child(cmd, in, p[1], p[0]);
+        }
+        if (exec_fork_hook) exec_fork_hook(pids[i]);
+        if (in >= 0) close(in);         // parent: the children own these ends now
+        if (p[1] >= 0) close(p[1]);
+        in = p[0];
+    }
+    if (in >= 0) close(in);
+    return i;
+}
+
+int exec_status (int status)
+{
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+int exec_pipeline (struct pipeline *pl)
+{
+    pid_t *pids;
+    int i, n, status = 0, st;
+
+    if ((status = exec_in_shell(pl)) != BUILTIN_EXEC) return status;
+    if (!(pids = malloc(pl->ncmds * sizeof *pids))) {
+        perror("malloc");
+        return 1;
+    }
+    n = exec_start(pl, pids);
+
+    // wait for all child processes to finish
+    for (status = 0, i = 0; i < n; i++) {
+        if (wait_child(pids[i], &st) < 0) st = 0;
+        status = st;                    // the last cmd decides the pipeline status
+    }
+    free(pids);
+    if (n < pl->ncmds) return 1;        // the pipeline could not be started completely
+    return exec_status(status);
+}
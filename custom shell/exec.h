@@ -0,0 +1,35 @@
+/* Pipeline execution shared by bsh and the command server */
+
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <sys/types.h>
+
+#include "parse.h"
+
+// called in every forked child before its redirections are applied (NULL: nothing)
+extern void (*exec_child_hook) (void);
+
+// called in the parent after each child was forked (NULL: nothing)
+extern void (*exec_fork_hook) (pid_t pid);
+
+// waits for one child of a pipeline (NULL: waitpid)
+extern pid_t (*exec_wait_hook) (pid_t pid, int *status);
+
+// buffer size of the pipes between stages in bytes (0: the system default, 64 KB)
+extern int exec_pipe_size;
+
+// run a parsed pipeline and wait for it; returns the exit status of the last command
+int exec_pipeline (struct pipeline *pl);
+
+// the steps of exec_pipeline for programs that wait on their own (job control):
+// run a lone foreground builtin in this process, BUILTIN_EXEC if it has to be forked
+int exec_in_shell (struct pipeline *pl);
+
+// fork every stage of the pipeline into pids[ncmds]; returns how many were started
+int exec_start (struct pipeline *pl, pid_t *pids);
+
+// exit status as the shell reports it, from a status returned by wait
+int exec_status (int status);
+
+#endif // EXEC_H
@@ -0,0 +1,289 @@
+/* Command history for bsh
+**
+** All shells of a user append to the same file with O_APPEND, one write per line, so
+** concurrent shells never mix up each other's lines. Each shell maps the file read-only and
+** remaps it when the file grew. Entries point into the mapping and are never copied.
+**
+** Searches go through a suffix array over the mapped text: the suffixes starting with a
+** pattern form one range, found with two binary searches. Lines added since the last search
+** are sorted on their own and merged into the array, so it is never rebuilt from scratch.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "builtin.h"
+#include "history.h"
+
+static struct {
+    int fd;                 // history file, -1 if there is none
+    const char *text;       // read-only mapping of the file
+    size_t size;            // mapped bytes
+    size_t end;             // end of the last complete line
+    size_t *start;          // offset of each entry, start[n] == end
+    int n, max;
+    unsigned *sa;           // suffix array over text[0..indexed)
+    size_t nsa, indexed;
+} hist = {-1};
+
+/* ============ File ======================================================================= */
+// forget every entry (the file was replaced or truncated)
+static void history_reset (void)
+{
+    hist.n = 0;
+    hist.end = 0;
+    hist.nsa = 0;
+    hist.indexed = 0;
+    if (hist.start) hist.start[0] = 0;
+}
+
+int history_sync (void)
+{
+    struct stat st;
+    size_t p;
+    void *m;
+
+    if (hist.fd < 0 || fstat(hist.fd, &st) < 0) return hist.n;
+    if ((size_t)st.st_size < hist.end) history_reset();
+    if ((size_t)st.st_size != hist.size) {
+        if (hist.size) munmap((void *)hist.text, hist.size);
+        hist.text = NULL;
+        hist.size = 0;
+        if (st.st_size == 0) return hist.n;
+        m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist.fd, 0);
+        if (m == MAP_FAILED) {
+            history_reset();
+            return 0;
+        }
+        hist.text = m;
+        hist.size = st.st_size;
+    }
+
+    // new complete lines, a line still being written by another shell waits
+    for (p = hist.end; p < hist.size; p++) {
+        if (hist.text[p] != '\n') continue;
+        if (hist.n + 2 > hist.max) {
+            size_t *s = realloc(hist.start, (hist.max ? 2 * hist.max : 256) * sizeof *s);
+            if (!s) break;
+            hist.start = s;
+            hist.max = hist.max ? 2 * hist.max : 256;
+        }
+        hist.start[hist.n++] = hist.end;
+        hist.end = p + 1;
+        hist.start[hist.n] = hist.end;
+    }
+    return hist.n;
+}
+
+const char *history_get (int i, size_t *len)
+{
+    if (i < 0 || i >= hist.n) return NULL;
+    *len = hist.start[i + 1] - hist.start[i] - 1;   // without the newline
+    return hist.text + hist.start[i];
+}
+
+void history_add (const char *line)
+{
+    size_t len = strlen(line), last;
+    const char *prev;
+    char *buf;
+
+    if (hist.fd < 0 || len == 0) return;
+    history_sync();
+    prev = history_get(hist.n - 1, &last);
+    if (prev && last == len && memcmp(prev, line, len) == 0) return;   // same as before
+
+    // one write, so that the line arrives whole even with other shells appending
+    if (!(buf = malloc(len + 1))) return;
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    if (write(hist.fd, buf, len + 1) < 0) perror("bsh: history");
+    free(buf);
+    history_sync();
+}
+
+/* ============ Index ====================================================================== */
+static const char *sa_text;         // text the suffixes are taken from
+
+// compare two suffixes up to the end of their lines
+static int sa_cmp (unsigned a, unsigned b)
+{
+    const unsigned char *x = (const unsigned char *)sa_text + a;
+    const unsigned char *y = (const unsigned char *)sa_text + b;
+    for (; *x == *y; x++, y++) {
+        if (*x == '\n') return 0;
+    }
+    if (*x == '\n') return -1;          // the shorter line comes first
+    if (*y == '\n') return 1;
+    return *x - *y;
+}
+
+// compare a suffix with a pattern: 0 if the suffix starts with it
+static int sa_cmp_pat (unsigned pos, const char *pat, size_t m)
+{
+    const unsigned char *x = (const unsigned char *)hist.text + pos;
+    size_t i;
+    for (i = 0; i < m; i++) {
+        if (x[i] == '\n') return -1;
+        if (x[i] != (unsigned char)pat[i]) return x[i] - (unsigned char)pat[i];
+    }
+    return 0;
+}
+
+// byte d of a suffix, 0 past the end of its line
+static int sa_char (unsigned pos, size_t d)
+{
+    unsigned char c = hist.text[pos + d];
+    return c == '\n' ? 0 : c;
+}
+
+// sort suffix positions whose first d bytes are equal: multikey quicksort, which looks at
+// every byte of the common prefixes once instead of in every comparison
+static void sa_sort (unsigned *a, size_t n, size_t d)
+{
+    size_t lt, gt, i, j;
+    unsigned t;
+    int pivot, c;
+
+    while (n > 1) {
+        if (n < 8) {                    // insertion sort on the rest of the suffixes
+            for (i = 1; i < n; i++) {
+                for (j = i; j > 0 && sa_cmp(a[j - 1] + d, a[j] + d) > 0; j--) {
+                    t = a[j];
+                    a[j] = a[j - 1];
+                    a[j - 1] = t;
+                }
+            }
+            return;
+        }
+
+        // split into bytes < pivot, == pivot and > pivot
+        pivot = sa_char(a[n / 2], d);
+        for (lt = i = 0, gt = n; i < gt; ) {
+            c = sa_char(a[i], d);
+            if (c < pivot) {
+                t = a[i]; a[i++] = a[lt]; a[lt++] = t;
+            } else if (c > pivot) {
+                t = a[i]; a[i] = a[--gt]; a[gt] = t;
+            } else {
+                i++;
+            }
+        }
+        sa_sort(a, lt, d);
+        sa_sort(a + gt, n - gt, d);
+        if (pivot == 0) return;         // the middle lines all ended here
+        a += lt;
+        n = gt - lt;
+        d++;
+    }
+}
+
+// add the suffixes of lines appended since the last search to the suffix array
+static int history_index (void)
+{
+    unsigned *add, *merged;
+    size_t i, j, k, nadd = 0, p;
+
+    if (hist.indexed == hist.end) return 0;
+    for (p = hist.indexed; p < hist.end; p++) nadd += hist.text[p] != '\n';
+    if (!(add = malloc(nadd * sizeof *add + 1))) return -1;
+    if (!(merged = malloc((hist.nsa + nadd) * sizeof *merged + 1))) {
+        free(add);
+        return -1;
+    }
+    for (nadd = 0, p = hist.indexed; p < hist.end; p++) {
+        if (hist.text[p] != '\n') add[nadd++] = p;
+    }
+    sa_text = hist.text;
+    sa_sort(add, nadd, 0);
+    for (i = j = k = 0; i < hist.nsa || j < nadd; k++) {
+        if (j == nadd || (i < hist.nsa && sa_cmp(hist.sa[i], add[j]) <= 0))
+            merged[k] = hist.sa[i++];
+        else
+            merged[k] = add[j++];
+    }
+    free(add);
+    free(hist.sa);
+    hist.sa = merged;
+    hist.nsa = k;
+    hist.indexed = hist.end;
+    return 0;
+}
+
+// entry that contains the text offset pos
+static int history_entry_at (size_t pos)
+{
+    int lo = 0, hi = hist.n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (hist.start[mid] <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+int history_search (const char *pat, int before, int prefix)
+{
+    size_t m = strlen(pat), lo, hi, first;
+    int best = -1, e;
+
+    history_sync();
+    if (before > hist.n) before = hist.n;
+    if (m == 0) return before - 1;
+    if (history_index() < 0) return -1;
+
+    // the range of suffixes starting with pat
+    for (lo = 0, hi = hist.nsa; lo < hi; ) {
+        size_t mid = (lo + hi) / 2;
+        if (sa_cmp_pat(hist.sa[mid], pat, m) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    first = lo;
+    for (hi = hist.nsa; lo < hi; ) {
+        size_t mid = (lo + hi) / 2;
+        if (sa_cmp_pat(hist.sa[mid], pat, m) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // the newest matching entry older than before
+    for (; first < lo; first++) {
+        e = history_entry_at(hist.sa[first]);
+        if (e >= before || e <= best) continue;
+        if (prefix && hist.start[e] != hist.sa[first]) continue;
+        best = e;
+    }
+    return best;
+}
+
+/* ============ Builtin ==================================================================== */
+// history [n]: list the last n entries (all by default)
+static int b_history (char *argv[])
+{
+    const char *s;
+    size_t len;
+    int i, n = history_sync();
+    i = argv[1] ? n - atoi(argv[1]) : 0;
+    for (i = i < 0 ? 0 : i; i < n; i++) {
+        s = history_get(i, &len);
+        printf("%5d  %.*s\n", i + 1, (int)len, s);
+    }
+    return 0;
+}
+
+static const struct builtin history_builtins[] = {
+    {"history", b_history},
+};
+
+int history_open (const char *path)
+{
+    builtin_register(history_builtins, sizeof history_builtins / sizeof history_builtins[0]);
+    if ((hist.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) return -1;
+    history_sync();
+    return 0;
+}
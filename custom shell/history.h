@@ -0,0 +1,24 @@
+/* Command history for bsh: one append-only file shared by all shells, with a search index */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+// open or create the history file and register the history builtin; -1 if it cannot be used
+int history_open (const char *path);
+
+// append a line to the file, where every shell using it will find it
+void history_add (const char *line);
+
+// pick up lines other shells appended; returns the number of entries
+int history_sync (void);
+
+// entry i, 0 being the oldest; the text is not terminated and ends after *len bytes
+const char *history_get (int i, size_t *len);
+
+// newest entry before entry `before` that contains pat (prefix: that starts with pat),
+// -1 if there is none
+int history_search (const char *pat, int before, int prefix);
+
+#endif // HISTORY_H
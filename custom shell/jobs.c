@@ -0,0 +1,712 @@
+/* Job control for bsh
+**
+** Every pipeline that is not a lone builtin becomes a job. With an interactive shell, its
+** processes form their own process group, which is given the terminal while it runs in the
+** foreground. SIGCHLD is blocked and read from a signalfd instead, so children are reaped
+** whenever the shell gets around to it and no exit status is lost to a handler.
+**
+** `time [-v] pipeline` reports the real, user and sys time and the peak RSS of every stage,
+** taken from wait4. With -v it also traces how long the shell took to fork each stage, how
+** long each stage took to reach exec (a close-on-exec pipe per stage reports it; a builtin
+** stage never execs, so it shows when the stage exited), and the bytes each stage read and
+** wrote, from /proc/<pid>/io of the zombie before it is reaped.
+*/
+
+#define _GNU_SOURCE         // pipe2()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "jobs.h"
+
+enum job_state { J_RUNNING, J_STOPPED, J_DONE };
+enum proc_state { P_RUNNING, P_STOPPED, P_EXITED };
+
+// measurements of one stage of a timed job
+struct stage {
+    char *name;             // command name
+    struct timespec fork;   // fork returned in the shell
+    struct timespec exec;   // exec succeeded (-v), zero if unknown
+    struct timespec end;    // reaped
+    long spawn_ns;          // shell time spent creating the stage (-v)
+    struct rusage ru;
+    unsigned long long rchar, wchar;    // bytes read and written (-v)
+    int exec_fd;            // read end of the close-on-exec pipe, -1 when done
+    int exec_wfd;           // write end, held by the stage until exec
+};
+
+struct job {
+    int id;                 // job number, [n]
+    pid_t pgid;             // process group (the first process)
+    pid_t *pids;            // one process per pipeline stage
+    enum proc_state *pstate;
+    int nprocs;
+    int status;             // wait status of the last stage
+    enum job_state state;
+    int bg;                 // running in the background
+    int notified;           // the current state has been reported
+    char *cmd;              // command line for messages
+    struct termios tmodes;  // terminal modes of a stopped job
+    struct stage *stages;   // time: one per pipeline stage, NULL if the job is not timed
+    int nstages;
+    int trace;              // time -v
+    int nforked;            // processes forked so far (the index of a new child)
+    struct timespec start;  // time: before the first fork
+    struct job *next;
+};
+
+static struct job *job_list;        // ordered by job number
+static struct job *launching;       // job being forked by exec_start()
+static int sfd = -1;                // signalfd for SIGCHLD
+static int tracing;                 // running jobs with time -v
+
+/* ============ Job Table ================================================================== */
+// command text of a pipeline, the syntax tree goes away with the line
+static char *job_text (struct pipeline *pl)
+{
+    struct command *c;
+    size_t len = 1, n;
+    char *s, *p;
+    int i;
+    for (c = pl->cmds; c; c = c->next) {
+        for (i = 0; i < c->argc; i++) len += strlen(c->argv[i]) + 1;
+        if (c->next) len += 3;      // " | ", also after a command without words
+    }
+    if (!(s = p = malloc(len))) return NULL;
+    for (c = pl->cmds; c; c = c->next) {
+        for (i = 0; i < c->argc; i++) {
+            n = strlen(c->argv[i]);
+            memcpy(p, c->argv[i], n);
+            p += n;
+            if (i < c->argc - 1) *p++ = ' ';
+        }
+        if (c->next) {
+            memcpy(p, " | ", 3);
+            p += 3;
+        }
+    }
+    *p = '\0';
+    return s;
+}
+
+static struct job *job_new (struct pipeline *pl)
+{
+    struct job *j = calloc(1, sizeof *j);
+    if (!j) return NULL;
+    j->pids = calloc(pl->ncmds, sizeof *j->pids);
+    j->pstate = calloc(pl->ncmds, sizeof *j->pstate);
+    j->cmd = job_text(pl);
+    j->bg = pl->bg;
+    j->tmodes = shell_tmodes;
+    if (!j->pids || !j->pstate || !j->cmd) {
+        free(j->pids);
+        free(j->pstate);
+        free(j->cmd);
+        free(j);
+        return NULL;
+    }
+    return j;
+}
+
+// append a job with the next free number
+static void job_add (struct job *j)
+{
+    struct job **p = &job_list;
+    j->id = 1;
+    while (*p) {
+        j->id = (*p)->id + 1;
+        p = &(*p)->next;
+    }
+    *p = j;
+}
+
+static void job_remove (struct job *j)
+{
+    struct job **p;
+    int i;
+    for (p = &job_list; *p; p = &(*p)->next) {
+        if (*p == j) {
+            *p = j->next;
+            break;
+        }
+    }
+    for (i = 0; i < j->nstages; i++) {
+        free(j->stages[i].name);
+        if (j->stages[i].exec_fd >= 0) close(j->stages[i].exec_fd);
+        if (j->stages[i].exec_wfd >= 0) close(j->stages[i].exec_wfd);
+    }
+    if (j->trace && j->state != J_DONE) tracing--;
+    free(j->stages);
+    free(j->pids);
+    free(j->pstate);
+    free(j->cmd);
+    free(j);
+}
+
+// the current job (%+): the most recent one
+static struct job *job_current (void)
+{
+    struct job *j = job_list;
+    while (j && j->next) j = j->next;
+    return j;
+}
+
+// find a job from %n, %%, %+ or a process ID
+static struct job *job_find (const char *spec)
+{
+    struct job *j;
+    char *end;
+    long n;
+    int i;
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) return job_current();
+    n = strtol(spec + (spec[0] == '%'), &end, 10);
+    if (*end || end == spec + (spec[0] == '%')) return NULL;
+    for (j = job_list; j; j = j->next) {
+        if (spec[0] == '%' && j->id == n) return j;
+        for (i = 0; spec[0] != '%' && i < j->nprocs; i++) {
+            if (j->pids[i] == n) return j;
+        }
+    }
+    return NULL;
+}
+
+/* ============ Timing ===================================================================== */
+static double seconds (const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static double tv_seconds (const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// byte count with a unit: 512, 12.5K, 3.1M, 1.2G
+static const char *human (char *buf, size_t len, double n)
+{
+    const char *unit = " KMGT";
+    while (n >= 1024 && unit[1]) {
+        n /= 1024;
+        unit++;
+    }
+    if (*unit == ' ') snprintf(buf, len, "%.0f", n);
+    else snprintf(buf, len, "%.1f%c", n, *unit);
+    return buf;
+}
+
+// rchar and wchar of a child that exited but was not reaped yet
+static void read_io (pid_t pid, struct stage *st)
+{
+    char path[64], line[128];
+    FILE *f;
+    snprintf(path, sizeof path, "/proc/%d/io", (int)pid);
+    if (!(f = fopen(path, "r"))) return;
+    while (fgets(line, sizeof line, f)) {
+        sscanf(line, "rchar: %llu", &st->rchar);
+        sscanf(line, "wchar: %llu", &st->wchar);
+    }
+    fclose(f);
+}
+
+// a stage reached exec (or exited): its end of the exec pipe was closed
+static void exec_done (struct stage *st)
+{
+    clock_gettime(CLOCK_MONOTONIC, &st->exec);
+    close(st->exec_fd);
+    st->exec_fd = -1;
+}
+
+static void print_row (const char *name, double real, double user, double sys, long rss)
+{
+    char buf[16];
+    fprintf(stderr, "%-16.16s %8.3fs %8.3fs %8.3fs %8s", name, real, user, sys,
+            rss < 0 ? "-" : human(buf, sizeof buf, rss * 1024.0));
+}
+
+// the report of time: one row per stage and the total
+static void job_report (struct job *j)
+{
+    struct timespec last = j->start;
+    double user = 0, sys = 0;
+    long rss = 0;
+    char buf[3][16];
+    int i;
+
+    fprintf(stderr, "%-16s %9s %9s %9s %8s", "stage", "real", "user", "sys", "maxrss");
+    if (j->trace) fprintf(stderr, " %9s %9s %8s %8s %9s", "spawn", "exec", "read", "written",
+                          "write/s");
+    fprintf(stderr, "\n");
+    for (i = 0; i < j->nprocs; i++) {
+        struct stage *st = &j->stages[i];
+        double real = seconds(&st->fork, &st->end);
+        print_row(st->name, real, tv_seconds(&st->ru.ru_utime), tv_seconds(&st->ru.ru_stime),
+                  st->ru.ru_maxrss);
+        if (j->trace) {
+            fprintf(stderr, " %7.1fus", st->spawn_ns / 1e3);
+            if (st->exec.tv_sec)
+                fprintf(stderr, " %7.3fms", seconds(&st->fork, &st->exec) * 1e3);
+            else
+                fprintf(stderr, " %9s", "-");
+            fprintf(stderr, " %8s %8s %8s/s", human(buf[0], sizeof buf[0], st->rchar),
+                    human(buf[1], sizeof buf[1], st->wchar),
+                    human(buf[2], sizeof buf[2], real > 0 ? st->wchar / real : 0));
+        }
+        fprintf(stderr, "\n");
+        user += tv_seconds(&st->ru.ru_utime);
+        sys += tv_seconds(&st->ru.ru_stime);
+        if (st->ru.ru_maxrss > rss) rss = st->ru.ru_maxrss;
+        if (seconds(&last, &st->end) > 0) last = st->end;
+    }
+    print_row("total", seconds(&j->start, &last), user, sys, rss);
+    fprintf(stderr, "\n");
+}
+
+// set up the stages of a timed job before it is forked
+static int job_time (struct job *j, struct pipeline *pl, int trace)
+{
+    struct command *c;
+    int i, p[2];
+
+    if (!(j->stages = calloc(pl->ncmds, sizeof *j->stages))) return -1;
+    j->nstages = pl->ncmds;
+    j->trace = trace;
+    for (i = 0, c = pl->cmds; c; c = c->next, i++) {
+        struct stage *st = &j->stages[i];
+        st->name = strdup(c->argc ? c->argv[0] : "(redirect)");
+        st->exec_fd = st->exec_wfd = -1;
+        if (trace && pipe2(p, O_CLOEXEC) == 0) {
+            st->exec_fd = p[0];
+            st->exec_wfd = p[1];
+        }
+    }
+    if (trace) tracing++;
+    clock_gettime(CLOCK_MONOTONIC, &j->start);
+    return 0;
+}
+
+/* ============ Reaping ==================================================================== */
+// record the new state of a child reported by wait4
+static void job_update (pid_t pid, int status, struct rusage *ru)
+{
+    struct job *j;
+    int i, running = 0, stopped = 0;
+    enum job_state old;
+
+    for (j = job_list; j; j = j->next) {
+        for (i = 0; i < j->nprocs && j->pids[i] != pid; i++);
+        if (i < j->nprocs) break;
+    }
+    if (!j) return;                     // not one of ours (e.g. a builtin's child)
+    if (WIFSTOPPED(status)) {
+        j->pstate[i] = P_STOPPED;
+    } else if (WIFCONTINUED(status)) {
+        j->pstate[i] = P_RUNNING;
+    } else {
+        j->pstate[i] = P_EXITED;
+        if (i == j->nprocs - 1) j->status = status;
+        if (j->stages) {
+            clock_gettime(CLOCK_MONOTONIC, &j->stages[i].end);
+            j->stages[i].ru = *ru;
+        }
+    }
+    for (i = 0; i < j->nprocs; i++) {
+        running += j->pstate[i] == P_RUNNING;
+        stopped += j->pstate[i] == P_STOPPED;
+    }
+    old = j->state;
+    j->state = running ? J_RUNNING : (stopped ? J_STOPPED : J_DONE);
+    if (j->state != old) j->notified = 0;
+    if (j->trace && j->state == J_DONE && old != J_DONE) tracing--;
+}
+
+// the stage of a traced job that pid runs, NULL if there is none
+static struct stage *traced_stage (pid_t pid)
+{
+    struct job *j;
+    int i;
+    for (j = job_list; j; j = j->next) {
+        for (i = 0; j->trace && i < j->nprocs; i++) {
+            if (j->pids[i] == pid) return &j->stages[i];
+        }
+    }
+    return NULL;
+}
+
+// collect every child state change that is pending, without blocking
+static void jobs_reap (void)
+{
+    struct signalfd_siginfo si;
+    struct rusage ru;
+    struct stage *st;
+    siginfo_t info;
+    pid_t pid;
+    int status;
+    while (read(sfd, &si, sizeof si) == sizeof si);     // drain the signalfd
+    while (1) {
+        // time -v: look at a child that exited before it is gone, for its I/O counters
+        if (tracing) {
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid &&
+                (st = traced_stage(info.si_pid)) != NULL) read_io(info.si_pid, st);
+        }
+        if ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) <= 0) break;
+        job_update(pid, status, &ru);
+    }
+}
+
+// sleep until some child changes state, or a stage of the traced job j reaches exec
+static void jobs_block (struct job *j)
+{
+    struct pollfd one = {sfd, POLLIN, 0}, *pfd = &one;
+    int i, n = 1;
+
+    if (j && j->trace && (pfd = malloc((1 + j->nprocs) * sizeof *pfd)) != NULL) {
+        pfd[0] = one;
+        for (i = 0; i < j->nprocs; i++) {
+            pfd[n].fd = j->stages[i].exec_fd;       // poll skips the stages that are done
+            pfd[n++].events = POLLIN;
+        }
+    } else {
+        pfd = &one;
+    }
+    while (poll(pfd, n, -1) < 0 && errno == EINTR);
+    for (i = 1; i < n; i++) {
+        if (pfd[i].fd >= 0 && pfd[i].revents) exec_done(&j->stages[i - 1]);
+    }
+    if (pfd != &one) free(pfd);
+}
+
+// report a timed job and remove it from the table
+static void job_finish (struct job *j)
+{
+    if (j->stages) job_report(j);
+    job_remove(j);
+}
+
+static void job_print (struct job *j, const char *state)
+{
+    printf("[%d]%c  %-22s %s%s\n", j->id, j == job_current() ? '+' : ' ', state, j->cmd,
+           j->state == J_RUNNING && j->bg ? " &" : "");
+}
+
+// wording of a job state for jobs and notifications
+static const char *job_state_text (struct job *j, char *buf, size_t len)
+{
+    if (j->state == J_RUNNING) return "Running";
+    if (j->state == J_STOPPED) return "Stopped";
+    if (WIFSIGNALED(j->status)) return strsignal(WTERMSIG(j->status));
+    if (WEXITSTATUS(j->status) == 0) return "Done";
+    snprintf(buf, len, "Exit %d", WEXITSTATUS(j->status));
+    return buf;
+}
+
+void jobs_notify (void)
+{
+    struct job *j, *next;
+    char buf[32];
+    jobs_reap();
+    for (j = job_list; j; j = next) {
+        next = j->next;
+        if (j->notified) continue;
+        if (j->state == J_DONE) {
+            if (shell_is_interactive) job_print(j, job_state_text(j, buf, sizeof buf));
+            job_finish(j);
+        } else if (j->state == J_STOPPED) {
+            job_print(j, "Stopped");
+            j->notified = 1;
+        }
+    }
+    fflush(stdout);
+}
+
+/* ============ Foreground and Background ================================================== */
+// put a job in the foreground (continuing it if cont) and wait until it finishes or stops
+static int job_fg (struct job *j, int cont)
+{
+    int i, status;
+    j->bg = 0;
+    if (shell_is_interactive) tcsetpgrp(shell_terminal, j->pgid);
+    if (cont) {
+        if (shell_is_interactive) tcsetattr(shell_terminal, TCSADRAIN, &j->tmodes);
+        for (i = 0; i < j->nprocs; i++) {
+            if (j->pstate[i] == P_STOPPED) j->pstate[i] = P_RUNNING;
+        }
+        j->state = J_RUNNING;
+        if (kill(-j->pgid, SIGCONT) < 0) perror("kill (SIGCONT)");
+    }
+
+    jobs_reap();
+    while (j->state == J_RUNNING) {
+        jobs_block(j);
+        jobs_reap();
+    }
+
+    // Put the shell back in the foreground.
+    if (shell_is_interactive) {
+        tcsetpgrp(shell_terminal, shell_pgid);
+        tcgetattr(shell_terminal, &j->tmodes);
+        tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+    }
+    if (j->state == J_STOPPED) {
+        printf("\n");
+        job_print(j, "Stopped");
+        j->notified = 1;
+        return 128 + SIGTSTP;
+    }
+    status = exec_status(j->status);
+    if (WIFSIGNALED(j->status) && WTERMSIG(j->status) != SIGINT &&
+        WTERMSIG(j->status) != SIGPIPE) {
+        fprintf(stderr, "%s\n", strsignal(WTERMSIG(j->status)));
+    }
+    job_finish(j);
+    return status;
+}
+
+// time a builtin that runs in the shell itself
+static int time_in_shell (struct pipeline *pl)
+{
+    struct rusage r0, r1;
+    struct timespec t0, t1;
+    int status;
+
+    getrusage(RUSAGE_SELF, &r0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((status = exec_in_shell(pl)) == BUILTIN_EXEC) return status;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    getrusage(RUSAGE_SELF, &r1);
+    fprintf(stderr, "%-16s %9s %9s %9s %8s\n", "stage", "real", "user", "sys", "maxrss");
+    print_row(pl->cmds->argc ? pl->cmds->argv[0] : "(redirect)", seconds(&t0, &t1),
+              tv_seconds(&r1.ru_utime) - tv_seconds(&r0.ru_utime),
+              tv_seconds(&r1.ru_stime) - tv_seconds(&r0.ru_stime), -1);
+    fprintf(stderr, "\n");
+    return status;
+}
+
+int job_run (struct pipeline *pl)
+{
+    struct command *c = pl->cmds;
+    struct job *j;
+    int i, status, timed = 0, trace = 0;
+
+    // time [-v] pipeline
+    if (c->argc && strcmp(c->argv[0], "time") == 0) {
+        timed = 1;
+        c->argv++;
+        c->argc--;
+        if (c->argc && strcmp(c->argv[0], "-v") == 0) {
+            trace = 1;
+            c->argv++;
+            c->argc--;
+        }
+        if (c->argc == 0 && !c->redirs && pl->ncmds == 1) return 0;     // nothing to time
+    }
+
+    status = timed ? time_in_shell(pl) : exec_in_shell(pl);
+    if (status != BUILTIN_EXEC) return status;
+    if (!(j = job_new(pl)) || (timed && job_time(j, pl, trace) < 0)) {
+        perror("bsh");
+        if (j) job_remove(j);
+        return 1;
+    }
+    launching = j;
+    j->nprocs = exec_start(pl, j->pids);
+    launching = NULL;
+    for (i = 0; i < j->nstages; i++) {     // only the stages hold the exec pipes now
+        if (j->stages[i].exec_wfd >= 0) close(j->stages[i].exec_wfd);
+        j->stages[i].exec_wfd = -1;
+    }
+    if (j->nprocs == 0) {               // nothing could be started
+        job_remove(j);
+        return 1;
+    }
+    job_add(j);
+    if (j->bg) {
+        if (shell_is_interactive) fprintf(stderr, "[%d] %d\n", j->id, j->pgid);
+        return 0;
+    }
+    return job_fg(j, 0);
+}
+
+/* ============ Process Groups ============================================================= */
+// parent side of each fork: the first process of a job leads its group
+static void jobs_fork_hook (pid_t pid)
+{
+    struct stage *st;
+    if (!launching) return;
+    if (launching->stages) {
+        st = &launching->stages[launching->nforked];
+        clock_gettime(CLOCK_MONOTONIC, &st->fork);
+        st->spawn_ns = (long)(seconds(launching->nforked ? &st[-1].fork : &launching->start,
+                                      &st->fork) * 1e9);
+    }
+    launching->nforked++;
+    if (!launching->pgid) launching->pgid = pid;
+    if (shell_is_interactive) setpgid(pid, launching->pgid);   // the child does it too
+}
+
+void jobs_child_setup (void)
+{
+    sigset_t mask;
+    int i;
+
+    // time -v: keep only the write end of our own exec pipe, exec closes it
+    for (i = 0; launching && launching->trace && i < launching->nstages; i++) {
+        close(launching->stages[i].exec_fd);
+        if (i != launching->nforked) close(launching->stages[i].exec_wfd);
+    }
+    if (launching && shell_is_interactive) {
+        pid_t pgid = launching->pgid ? launching->pgid : getpid();
+        setpgid(0, pgid);
+        if (!launching->bg) tcsetpgrp(shell_terminal, pgid);
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+void jobs_subshell (void)
+{
+    sigset_t mask;
+    while (job_list) job_remove(job_list);  // the parent's jobs, not ours to wait for
+    shell_is_interactive = 0;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);    // the signalfd reports our own children
+}
+
+/* ============ Builtins =================================================================== */
+// jobs: list the jobs
+static int b_jobs (char *argv[])
+{
+    struct job *j, *next;
+    char buf[32];
+    jobs_reap();
+    for (j = job_list; j; j = next) {
+        next = j->next;
+        job_print(j, job_state_text(j, buf, sizeof buf));
+        j->notified = 1;
+        if (j->state == J_DONE) job_finish(j);
+    }
+    return 0;
+}
+
+// fg [%n]: continue a job in the foreground
+static int b_fg (char *argv[])
+{
+    struct job *j;
+    if (!shell_is_interactive) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+    jobs_reap();
+    if (!(j = job_find(argv[1])) || j->state == J_DONE) {
+        fprintf(stderr, "fg: %s: no such job\n", argv[1] ? argv[1] : "current");
+        return 1;
+    }
+    printf("%s\n", j->cmd);
+    fflush(stdout);
+    return job_fg(j, 1);
+}
+
+// bg [%n]: continue a stopped job in the background
+static int b_bg (char *argv[])
+{
+    struct job *j;
+    int i;
+    if (!shell_is_interactive) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
+    jobs_reap();
+    if (!(j = job_find(argv[1])) || j->state == J_DONE) {
+        fprintf(stderr, "bg: %s: no such job\n", argv[1] ? argv[1] : "current");
+        return 1;
+    }
+    for (i = 0; i < j->nprocs; i++) {
+        if (j->pstate[i] == P_STOPPED) j->pstate[i] = P_RUNNING;
+    }
+    j->state = J_RUNNING;
+    j->bg = 1;
+    j->notified = 0;
+    if (kill(-j->pgid, SIGCONT) < 0) perror("kill (SIGCONT)");
+    printf("[%d]+ %s &\n", j->id, j->cmd);
+    return 0;
+}
+
+// wait [%n|pid ...]: wait for the given jobs, or for all running jobs
+static int b_wait (char *argv[])
+{
+    struct job *j;
+    int i, status = 0, busy;
+    jobs_reap();
+    if (!argv[1]) {
+        do {
+            for (busy = 0, j = job_list; j; j = j->next) busy |= j->state == J_RUNNING;
+            if (busy) {
+                jobs_block(NULL);
+                jobs_reap();
+            }
+        } while (busy);
+        return 0;
+    }
+    for (i = 1; argv[i]; i++) {
+        if (!(j = job_find(argv[i]))) {
+            fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+            status = 127;
+            continue;
+        }
+        while (j->state == J_RUNNING) {
+            jobs_block(NULL);
+            jobs_reap();
+        }
+        status = j->state == J_DONE ? exec_status(j->status) : 128 + SIGTSTP;
+        if (j->state == J_DONE) job_finish(j);
+    }
+    return status;
+}
+
+// kill %n: the process group of the job
+static pid_t job_pid (const char *spec)
+{
+    struct job *j;
+    jobs_reap();
+    if (!(j = job_find(spec)) || j->state == J_DONE) return 0;
+    return shell_is_interactive ? -j->pgid : j->pids[j->nprocs - 1];
+}
+
+static const struct builtin job_builtins[] = {
+    {"jobs", b_jobs},
+    {"fg", b_fg},
+    {"bg", b_bg},
+    {"wait", b_wait},
+};
+
+/* ============ Setup ====================================================================== */
+void jobs_init (void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    signal(SIGCHLD, SIG_DFL);           // SIG_IGN would reap the children for us
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0 ||
+        (sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        perror("bsh: signalfd");
+        exit(1);
+    }
+    exec_fork_hook = jobs_fork_hook;
+    builtin_job_pid = job_pid;
+    builtin_job_control = &shell_is_interactive;    // 0 again in subshells
+    builtin_register(job_builtins, sizeof job_builtins / sizeof job_builtins[0]);
+}
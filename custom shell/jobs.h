@@ -0,0 +1,33 @@
+/* Job control for bsh: process groups, the terminal, and the job table */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <termios.h>
+
+#include "parse.h"
+
+// Keep track of attributes of the shell (bsh.c).
+extern pid_t shell_pgid;
+extern struct termios shell_tmodes;
+extern int shell_terminal;
+extern int shell_is_interactive;
+
+// block SIGCHLD in favor of a signalfd, and register the jobs/fg/bg/wait builtins
+void jobs_init (void);
+
+// in a forked child: join the job's process group, take the terminal if in the foreground
+void jobs_child_setup (void);
+
+// in a forked child that goes on running commands (a function in a pipeline, $(...)):
+// forget the parent's jobs and run without job control
+void jobs_subshell (void);
+
+// run a pipeline as a job; waits for foreground jobs, returns the exit status
+int job_run (struct pipeline *pl);
+
+// reap children and report background jobs that finished or stopped (before a prompt)
+void jobs_notify (void);
+
+#endif // JOBS_H
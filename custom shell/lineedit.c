@@ -0,0 +1,485 @@
+/* Line editor for interactive bsh
+**
+** The line is read with the terminal in raw mode and redrawn on one row, scrolling sideways
+** when it does not fit. Without a usable terminal the prompt is printed and getline is used.
+**
+**  ^A ^E Home End      start / end of the line     ^B ^F Left Right    move by a character
+**  ^H Backspace        delete before the cursor    ^D Delete           delete at the cursor
+**  ^K ^U ^W            cut to the end / to the start / the word before the cursor
+**  Up Down ^P ^N       walk the history; with text typed, only entries starting with it
+**  ^R                  search the history for entries containing the typed text
+**  Tab                 complete a command from $PATH or a file name; twice: list choices
+**  ^C                  drop the line           ^L  clear the screen
+**  ^D                  end of input on an empty line
+*/
+
+#define _GNU_SOURCE         // getline()
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "lineedit.h"
+#include "pathhash.h"
+
+enum key {                  // keys sent as escape sequences
+    K_UP = 256, K_DOWN, K_LEFT, K_RIGHT, K_HOME, K_END, K_DELETE, K_NONE
+};
+
+struct editor {
+    char *buf;              // the line, always terminated
+    size_t len, pos, size;  // length, cursor and allocated size of buf
+    const char *prompt;
+    size_t plen;
+    int hist;               // history entry shown, history_sync() for the edited line
+    char *saved;            // the edited line while walking the history
+    int tabs;               // Tab presses in a row
+};
+
+static struct editor ed;
+
+/* ============ Terminal =================================================================== */
+static void out (const char *s, size_t n)
+{
+    ssize_t r;
+    while (n > 0) {
+        if ((r = write(STDOUT_FILENO, s, n)) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        s += r;
+        n -= r;
+    }
+}
+
+static int term_cols (void)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0) return 80;
+    return ws.ws_col;
+}
+
+// next key, or -1 at the end of input
+static int read_key (void)
+{
+    unsigned char c, seq[3];
+    ssize_t r;
+    while ((r = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR);
+    if (r <= 0) return -1;
+    if (c != 27) return c;
+
+    // ESC [ x, ESC O x and ESC [ n ~
+    if (read(STDIN_FILENO, seq, 2) < 2) return K_NONE;
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, seq + 2, 1) < 1 || seq[2] != '~') return K_NONE;
+        switch (seq[1]) {
+            case '1': case '7': return K_HOME;
+            case '4': case '8': return K_END;
+            case '3': return K_DELETE;
+        }
+        return K_NONE;
+    }
+    if (seq[0] != '[' && seq[0] != 'O') return K_NONE;
+    switch (seq[1]) {
+        case 'A': return K_UP;
+        case 'B': return K_DOWN;
+        case 'C': return K_RIGHT;
+        case 'D': return K_LEFT;
+        case 'H': return K_HOME;
+        case 'F': return K_END;
+    }
+    return K_NONE;
+}
+
+// draw the prompt and the part of the line around the cursor
+static void refresh (void)
+{
+    size_t avail, off = 0, show;
+    char *s, move[32];
+    int cols = term_cols();
+
+    avail = cols > (int)ed.plen + 1 ? cols - ed.plen - 1 : 1;
+    if (ed.pos >= avail) off = ed.pos - avail + 1;
+    show = ed.len - off < avail ? ed.len - off : avail;
+    if (!(s = malloc(ed.plen + show + 64))) return;
+    memcpy(s, "\r", 1);
+    memcpy(s + 1, ed.prompt, ed.plen);
+    memcpy(s + 1 + ed.plen, ed.buf + off, show);
+    snprintf(move, sizeof move, "\x1b[K\r\x1b[%zuC", ed.plen + ed.pos - off);
+    memcpy(s + 1 + ed.plen + show, move, strlen(move));
+    out(s, 1 + ed.plen + show + strlen(move));
+    free(s);
+}
+
+/* ============ Editing ==================================================================== */
+static int reserve (size_t n)
+{
+    char *b;
+    size_t size = ed.size ? ed.size : 128;
+    if (ed.len + n + 1 <= ed.size) return 0;
+    while (ed.len + n + 1 > size) size *= 2;
+    if (!(b = realloc(ed.buf, size))) return -1;
+    ed.buf = b;
+    ed.size = size;
+    return 0;
+}
+
+static void insert (const char *s, size_t n)
+{
+    if (reserve(n) < 0) return;
+    memmove(ed.buf + ed.pos + n, ed.buf + ed.pos, ed.len - ed.pos + 1);
+    memcpy(ed.buf + ed.pos, s, n);
+    ed.len += n;
+    ed.pos += n;
+}
+
+// delete n characters starting at from
+static void cut (size_t from, size_t n)
+{
+    memmove(ed.buf + from, ed.buf + from + n, ed.len - from - n + 1);
+    ed.len -= n;
+    if (ed.pos > from + n) ed.pos -= n;
+    else if (ed.pos > from) ed.pos = from;
+}
+
+// replace the whole line
+static void set_line (const char *s, size_t n)
+{
+    ed.len = ed.pos = 0;
+    ed.buf[0] = '\0';
+    insert(s, n);
+}
+
+/* ============ History ==================================================================== */
+// show entry e, or the edited line if e is past the newest entry
+static void show_entry (int e)
+{
+    const char *s;
+    size_t len;
+    if ((s = history_get(e, &len)) != NULL) {
+        set_line(s, len);
+    } else {
+        e = history_sync();
+        set_line(ed.saved ? ed.saved : "", ed.saved ? strlen(ed.saved) : 0);
+    }
+    ed.hist = e;
+}
+
+// Up and Down: older or newer entries, those starting with the edited text if there is any
+static void history_move (int dir)
+{
+    const char *s;
+    size_t len, plen;
+    int n = history_sync(), e;
+
+    if (ed.hist >= n) {                 // leaving the edited line, keep it
+        free(ed.saved);
+        ed.saved = strdup(ed.buf);
+    }
+    plen = ed.saved ? strlen(ed.saved) : 0;
+    if (dir < 0) {
+        e = plen ? history_search(ed.saved, ed.hist, 1) : ed.hist - 1;
+        if (e >= 0) show_entry(e);
+        return;
+    }
+    for (e = ed.hist + 1; e < n; e++) {
+        s = history_get(e, &len);
+        if (len >= plen && memcmp(s, ed.saved, plen) == 0) break;
+    }
+    show_entry(e);
+}
+
+// ^R: incremental search; returns 1 if the line is to be run right away
+static int history_isearch (void)
+{
+    char *pat, *line, *msg, *p;
+    const char *s = "";
+    size_t plen = 0, psize = 64, len = 0;
+    int match = -1, k, e;
+
+    line = strdup(ed.buf);
+    pat = malloc(psize);
+    while (line && pat) {
+        // (reverse-i-search)`pat': match
+        if (!(msg = malloc(plen + len + 64))) break;
+        k = sprintf(msg, "\r%s`%.*s': %.*s\x1b[K", match < 0 && plen ?
+                    "(failed reverse-i-search)" : "(reverse-i-search)", (int)plen, pat,
+                    (int)len, s);
+        out(msg, k);
+        free(msg);
+
+        k = read_key();
+        if (k == CTRL('R')) {                   // the next older match
+            if (match >= 0 && (e = history_search(pat, match, 0)) >= 0) match = e;
+        } else if (k == 127 || k == CTRL('H') || (k >= 32 && k < 127)) {
+            if (k == 127 || k == CTRL('H')) {
+                if (plen) plen--;
+            } else {
+                if (plen + 2 > psize && (p = realloc(pat, 2 * psize)) != NULL) {
+                    pat = p;
+                    psize *= 2;
+                }
+                if (plen + 2 <= psize) pat[plen++] = k;
+            }
+            pat[plen] = '\0';
+            match = plen ? history_search(pat, history_sync(), 0) : -1;
+        } else {
+            if (k == CTRL('G') || k == CTRL('C') || k < 0) {    // give up, line as before
+                set_line(line, strlen(line));
+                k = 0;
+            } else {                            // take the match, Enter also runs it
+                if (match >= 0) {
+                    set_line(s, len);
+                    ed.hist = match;
+                }
+                k = k == '\r' || k == '\n';
+            }
+            free(pat);
+            free(line);
+            return k;
+        }
+        if (match < 0 || !(s = history_get(match, &len))) {
+            s = "";
+            len = 0;
+        }
+    }
+    free(pat);
+    free(line);
+    return 0;
+}
+
+/* ============ Completion ================================================================= */
+struct choices {
+    char **s;
+    int n, max;
+};
+
+static void add_choice (struct choices *c, const char *s, const char *suffix)
+{
+    char **p;
+    if (c->n == c->max) {
+        c->max = c->max ? 2 * c->max : 32;
+        if (!(p = realloc(c->s, c->max * sizeof *p))) return;
+        c->s = p;
+    }
+    if ((c->s[c->n] = malloc(strlen(s) + strlen(suffix) + 1)) != NULL) {
+        strcpy(c->s[c->n], s);
+        strcat(c->s[c->n++], suffix);
+    }
+}
+
+// files in the directory part of word whose names start with the rest; directories get a /
+static void complete_file (struct choices *c, const char *word)
+{
+    const char *slash = strrchr(word, '/'), *base = slash ? slash + 1 : word;
+    char dir[4096], path[8192];
+    struct dirent *d;
+    struct stat st;
+    DIR *dp;
+
+    snprintf(dir, sizeof dir, "%.*s", slash ? (int)(slash - word + 1) : 0, word);
+    if (!(dp = opendir(dir[0] ? dir : "."))) return;
+    while ((d = readdir(dp)) != NULL) {
+        if (strncmp(d->d_name, base, strlen(base)) != 0) continue;
+        if (d->d_name[0] == '.' && base[0] != '.') continue;
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        snprintf(path, sizeof path, "%s%s", dir, d->d_name);
+        add_choice(c, d->d_name, stat(path, &st) == 0 && S_ISDIR(st.st_mode) ? "/" : "");
+    }
+    closedir(dp);
+}
+
+// print the choices in columns below the line
+static void list_choices (struct choices *c)
+{
+    size_t width = 0, n;
+    int i, cols, per_row;
+    for (i = 0; i < c->n; i++) {
+        if ((n = strlen(c->s[i])) > width) width = n;
+    }
+    cols = term_cols();
+    per_row = cols / (width + 2) > 0 ? cols / (width + 2) : 1;
+    out("\r\n", 2);
+    for (i = 0; i < c->n; i++) {
+        char cell[4096];
+        int k = snprintf(cell, sizeof cell, "%-*s", (int)width + 2, c->s[i]);
+        out(cell, k < (int)sizeof cell ? k : (int)sizeof cell - 1);
+        if ((i + 1) % per_row == 0 || i == c->n - 1) out("\r\n", 2);
+    }
+}
+
+static int choice_cmp (const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Tab: complete the word before the cursor
+static void complete (void)
+{
+    struct choices c = {0};
+    size_t start = ed.pos, common, base;
+    char *word, **names;
+    int i, n, command;
+
+    while (start > 0 && ed.buf[start - 1] != ' ' && ed.buf[start - 1] != '\t') start--;
+    for (i = start; i > 0 && (ed.buf[i - 1] == ' ' || ed.buf[i - 1] == '\t'); i--);
+    command = i == 0 || ed.buf[i - 1] == '|' || ed.buf[i - 1] == '&';
+    if (!(word = strndup(ed.buf + start, ed.pos - start))) return;
+
+    // commands come from the PATH cache, anything with a / is a file
+    if (command && !strchr(word, '/') && path_cache) {
+        n = pathhash_complete(path_cache, word, &names);
+        for (i = 0; i < n; i++) add_choice(&c, names[i], "");
+    } else {
+        complete_file(&c, word);
+    }
+    base = strrchr(word, '/') ? strlen(strrchr(word, '/') + 1) : strlen(word);
+
+    if (c.n == 1) {
+        insert(c.s[0] + base, strlen(c.s[0]) - base);
+        if (c.s[0][strlen(c.s[0]) - 1] != '/') insert(" ", 1);
+    } else if (c.n > 1) {
+        qsort(c.s, c.n, sizeof *c.s, choice_cmp);
+        for (common = 0; c.s[0][common] && c.s[0][common] == c.s[c.n - 1][common]; common++);
+        if (common > base) insert(c.s[0] + base, common - base);
+        else if (ed.tabs > 1) list_choices(&c);
+    }
+    for (i = 0; i < c.n; i++) free(c.s[i]);
+    free(c.s);
+    free(word);
+}
+
+/* ============ Interface ================================================================== */
+// without a terminal: plain getline
+static char *read_plain (const char *prompt)
+{
+    ssize_t n;
+    fputs(prompt, stdout);
+    fflush(stdout);
+    if ((n = getline(&ed.buf, &ed.size, stdin)) < 0) return NULL;
+    if (n && ed.buf[n - 1] == '\n') ed.buf[--n] = '\0';
+    return ed.buf;
+}
+
+char *lineedit_read (const char *prompt)
+{
+    struct termios orig, raw;
+    const char *term = getenv("TERM");
+    int k, done = 0, eof = 0;
+    size_t i;
+
+    if (!isatty(STDIN_FILENO) || (term && strcmp(term, "dumb") == 0) ||
+        tcgetattr(STDIN_FILENO, &orig) < 0) return read_plain(prompt);
+    raw = orig;
+    raw.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) < 0) return read_plain(prompt);
+
+    fflush(stdout);
+    ed.prompt = prompt;
+    ed.plen = strlen(prompt);
+    ed.len = ed.pos = 0;
+    ed.hist = history_sync();
+    ed.tabs = 0;
+    free(ed.saved);
+    ed.saved = NULL;
+    if (reserve(0) < 0) return NULL;
+    ed.buf[0] = '\0';
+    refresh();
+
+    while (!done) {
+        k = read_key();
+        ed.tabs = k == '\t' ? ed.tabs + 1 : 0;
+        switch (k) {
+            case -1:
+                eof = 1;
+                done = 1;
+                break;
+            case '\r':
+            case '\n':
+                done = 1;
+                break;
+            case CTRL('C'):
+                out("^C\r\n", 4);
+                ed.len = ed.pos = 0;
+                ed.buf[0] = '\0';
+                ed.hist = history_sync();
+                break;
+            case CTRL('D'):
+                if (ed.len == 0) {
+                    eof = done = 1;
+                    break;
+                }
+                // fall through
+            case K_DELETE:
+                if (ed.pos < ed.len) cut(ed.pos, 1);
+                break;
+            case 127:
+            case CTRL('H'):
+                if (ed.pos > 0) cut(ed.pos - 1, 1);
+                break;
+            case CTRL('A'):
+            case K_HOME:
+                ed.pos = 0;
+                break;
+            case CTRL('E'):
+            case K_END:
+                ed.pos = ed.len;
+                break;
+            case CTRL('B'):
+            case K_LEFT:
+                if (ed.pos > 0) ed.pos--;
+                break;
+            case CTRL('F'):
+            case K_RIGHT:
+                if (ed.pos < ed.len) ed.pos++;
+                break;
+            case CTRL('K'):
+                cut(ed.pos, ed.len - ed.pos);
+                break;
+            case CTRL('U'):
+                cut(0, ed.pos);
+                break;
+            case CTRL('W'):
+                for (i = ed.pos; i > 0 && ed.buf[i - 1] == ' '; i--);
+                while (i > 0 && ed.buf[i - 1] != ' ') i--;
+                cut(i, ed.pos - i);
+                break;
+            case CTRL('L'):
+                out("\x1b[H\x1b[2J", 7);
+                break;
+            case CTRL('P'):
+            case K_UP:
+                history_move(-1);
+                break;
+            case CTRL('N'):
+            case K_DOWN:
+                history_move(1);
+                break;
+            case CTRL('R'):
+                done = history_isearch();
+                break;
+            case '\t':
+                complete();
+                break;
+            default:
+                if (k >= 32 && k < 256 && k != 127) {
+                    char c = k;
+                    insert(&c, 1);
+                }
+        }
+        refresh();
+    }
+    if (!eof) out("\r\n", 2);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &orig);
+    return eof ? NULL : ed.buf;
+}
@@ -0,0 +1,10 @@
+/* Line editor for interactive bsh: editing keys, history and tab completion */
+
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+// print the prompt and read one line without its newline, NULL at the end of input;
+// the line stays valid until the next call
+char *lineedit_read (const char *prompt);
+
+#endif // LINEEDIT_H
@@ -0,0 +1,355 @@
+/* parallel builtin for bsh
+**
+**  parallel [-j slots] [-k] [-s] command [args] [::: arg ...]
+**
+** Runs the command once for every argument, with up to `slots` jobs at a time (default: one
+** per CPU). The arguments follow ::: or are read from stdin, one per line. {} in the command
+** is replaced by the argument, otherwise the argument is appended. Each job line goes through
+** the shell's own parser and executor, so commands may use pipes and redirections.
+**
+** The stdout of every job is collected and written in one piece when the job ends (-k: in the
+** order of the arguments), so the output of different jobs never interleaves. Failed jobs are
+** counted and reported; -s also prints the run time and throughput. No new jobs are started
+** after one was interrupted with ^C. The exit status is the number of failed jobs, 101 for
+** more than 100.
+*/
+
+#define _GNU_SOURCE         // pipe2()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "parallel.h"
+#include "parse.h"
+
+#define OUT_CHUNK 4096      // output buffer growth
+#define MAX_FAILED 100      // exit statuses above this mean "more than 100 failed"
+
+struct output {
+    char *buf;
+    size_t len, size;
+    int done;               // -k: the job finished and buf holds all of its output
+};
+
+struct slot {
+    pid_t *pids;            // processes of the job (one per pipeline stage)
+    int npids, maxpids;
+    int fd;                 // read end of the job's stdout, -1 if the slot is free
+    int index;              // argument number of the job
+    struct output out;
+};
+
+/* ============ Arguments ================================================================== */
+// read the lines of stdin as arguments
+static char **read_args (int *n)
+{
+    char **args = NULL, *line = NULL, **tmp;
+    size_t len = 0;
+    ssize_t r;
+    int max = 0;
+    *n = 0;
+    while ((r = getline(&line, &len, stdin)) >= 0) {
+        if (r && line[r - 1] == '\n') line[--r] = '\0';
+        if (*n == max) {
+            max = max ? 2 * max : 64;
+            if (!(tmp = realloc(args, max * sizeof *args))) break;
+            args = tmp;
+        }
+        if (!(args[*n] = strdup(line))) break;
+        (*n)++;
+    }
+    free(line);
+    clearerr(stdin);
+    return args;
+}
+
+// append s (n bytes) to a growing string
+static int append (struct output *o, const char *s, size_t n)
+{
+    if (o->len + n + 1 > o->size) {
+        size_t size = o->size ? o->size : OUT_CHUNK;
+        char *buf;
+        while (o->len + n + 1 > size) size *= 2;
+        if (!(buf = realloc(o->buf, size))) return -1;
+        o->buf = buf;
+        o->size = size;
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+    return 0;
+}
+
+// append an argument quoted for the lexer: 'it'\''s'
+static int append_quoted (struct output *o, const char *arg)
+{
+    const char *q;
+    if (append(o, "'", 1) < 0) return -1;
+    while ((q = strchr(arg, '\'')) != NULL) {
+        if (append(o, arg, q - arg) < 0 || append(o, "'\\''", 4) < 0) return -1;
+        arg = q + 1;
+    }
+    return append(o, arg, strlen(arg)) < 0 || append(o, "'", 1) < 0 ? -1 : 0;
+}
+
+// command line of one job: the template words with {} replaced by the argument
+static int job_line (struct output *line, char **tmpl, const char *arg)
+{
+    const char *p, *q;
+    int i, used = 0;
+    line->len = 0;
+    for (i = 0; tmpl[i]; i++) {
+        if (i && append(line, " ", 1) < 0) return -1;
+        for (p = tmpl[i]; (q = strstr(p, "{}")) != NULL; p = q + 2, used = 1) {
+            if (append(line, p, q - p) < 0 || append_quoted(line, arg) < 0) return -1;
+        }
+        if (append(line, p, strlen(p)) < 0) return -1;
+    }
+    if (!used && (append(line, " ", 1) < 0 || append_quoted(line, arg) < 0)) return -1;
+    return 0;
+}
+
+/* ============ Jobs ======================================================================= */
+static int write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// start a job with its stdout on a new pipe; -1 if it could not be started
+static int spawn (struct slot *s, struct arena *a, const char *line, int out)
+{
+    struct pipeline *pl;
+    const char *err;
+    int p[2];
+
+    arena_reset(a);
+    if (!(pl = parse_line(a, line, &err))) {
+        fprintf(stderr, "parallel: %s\n", err ? err : "empty command");
+        return -1;
+    }
+    pl->bg = 0;
+    if (pl->ncmds > s->maxpids) {
+        pid_t *pids = realloc(s->pids, pl->ncmds * sizeof *pids);
+        if (!pids) {
+            perror("parallel");
+            return -1;
+        }
+        s->pids = pids;
+        s->maxpids = pl->ncmds;
+    }
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("parallel: pipe");
+        return -1;
+    }
+
+    // the children find the pipe on fd 1, the shell gets its own stdout back
+    dup2(p[1], STDOUT_FILENO);
+    close(p[1]);
+    s->npids = exec_start(pl, s->pids);
+    dup2(out, STDOUT_FILENO);
+    if (s->npids == 0) {
+        close(p[0]);
+        return -1;
+    }
+    s->fd = p[0];
+    s->out.len = 0;
+    s->out.done = 0;
+    return 0;
+}
+
+// wait for the processes of a finished job; returns its exit status
+static int reap (struct slot *s)
+{
+    int i, status = 0, st;
+    for (i = 0; i < s->npids; i++) {
+        while (waitpid(s->pids[i], &st, 0) < 0 && errno == EINTR);
+        status = exec_status(st);
+    }
+    return status;
+}
+
+/* ============ Builtin ==================================================================== */
+static int b_parallel (char *argv[])
+{
+    struct arena arena = {0};
+    struct output line = {0}, *results = NULL;
+    struct slot *slots;
+    struct pollfd *pfd;
+    struct timespec t0, t1;
+    char **tmpl, **args, **owned = NULL, buf[OUT_CHUNK];
+    int nslots = sysconf(_SC_NPROCESSORS_ONLN), keep = 0, stats = 0;
+    int i, j, n, nargs, next = 0, printed = 0, running = 0, failed = 0, stop = 0, st;
+    int out, in, null;
+    ssize_t r;
+
+    // options
+    for (i = 1; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *v = argv[i][2] ? argv[i] + 2 : argv[++i];
+            if (!v || (nslots = atoi(v)) < 1) {
+                fprintf(stderr, "parallel: -j needs a number of slots\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-k") == 0) {
+            keep = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
+        } else {
+            fprintf(stderr, "usage: parallel [-j slots] [-k] [-s] command [args] "
+                            "[::: arg ...]\n");
+            return 2;
+        }
+    }
+    tmpl = argv + i;
+    for (j = i; argv[j] && strcmp(argv[j], ":::") != 0; j++);
+    if (j == i) {
+        fprintf(stderr, "parallel: no command\n");
+        return 2;
+    }
+    if (argv[j]) {                          // arguments on the command line
+        argv[j] = NULL;
+        args = argv + j + 1;
+        for (nargs = 0; args[nargs]; nargs++);
+    } else {                                // one argument per line of stdin
+        owned = args = read_args(&nargs);
+    }
+    if (nslots > nargs) nslots = nargs ? nargs : 1;
+
+    slots = calloc(nslots, sizeof *slots);
+    pfd = calloc(nslots, sizeof *pfd);
+    if (keep) results = calloc(nargs ? nargs : 1, sizeof *results);
+    if (!slots || !pfd || (keep && !results)) {
+        perror("parallel");
+        return 1;
+    }
+    for (i = 0; i < nslots; i++) slots[i].fd = -1;
+
+    // jobs do not read our stdin, and must not inherit the original stdout
+    fflush(stdout);
+    out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+    if ((null = open("/dev/null", O_RDONLY)) >= 0) {
+        dup2(null, STDIN_FILENO);
+        close(null);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (running || (next < nargs && !stop)) {
+        // fill the free slots
+        for (i = 0; i < nslots && next < nargs && !stop; i++) {
+            if (slots[i].fd >= 0) continue;
+            slots[i].index = next;
+            if (job_line(&line, tmpl, args[next++]) < 0 ||
+                spawn(&slots[i], &arena, line.buf, out) < 0) {
+                failed++;
+                if (keep) results[slots[i].index].done = 1;
+                i--;                        // try the next argument in this slot
+                continue;
+            }
+            running++;
+        }
+        if (!running) continue;
+
+        // collect output until a job ends
+        for (i = 0; i < nslots; i++) {
+            pfd[i].fd = slots[i].fd;
+            pfd[i].events = POLLIN;
+        }
+        if (poll(pfd, nslots, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("parallel: poll");
+            break;
+        }
+        for (i = 0; i < nslots; i++) {
+            struct slot *s = &slots[i];
+            if (s->fd < 0 || !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if ((r = read(s->fd, buf, sizeof buf)) > 0) {
+                if (append(&s->out, buf, r) < 0) {
+                    perror("parallel");
+                    s->out.len = 0;
+                }
+                continue;
+            }
+            if (r < 0 && errno == EINTR) continue;
+
+            // end of output: the job is over
+            close(s->fd);
+            s->fd = -1;
+            running--;
+            if ((st = reap(s)) != 0) failed++;
+            if (st == 128 + SIGINT) stop = 1;   // ^C: no new jobs
+            if (!keep) {
+                write_all(out, s->out.buf, s->out.len);
+            } else {                        // hand the buffer to the result list
+                results[s->index] = s->out;
+                results[s->index].done = 1;
+                memset(&s->out, 0, sizeof s->out);
+            }
+        }
+
+        // -k: write the results that are next in line
+        while (keep && printed < nargs && results[printed].done) {
+            write_all(out, results[printed].buf, results[printed].len);
+            free(results[printed++].buf);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // restore stdin and stdout of the shell
+    dup2(out, STDOUT_FILENO);
+    dup2(in, STDIN_FILENO);
+    close(out);
+    close(in);
+
+    if (failed) fprintf(stderr, "parallel: %d of %d jobs failed\n", failed, next);
+    if (stats) {
+        double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        fprintf(stderr, "parallel: %d jobs in %.3f s on %d slots, %.0f jobs/s\n",
+                next, secs, nslots, secs > 0 ? next / secs : 0.0);
+    }
+
+    for (i = 0; i < nslots; i++) {
+        free(slots[i].pids);
+        free(slots[i].out.buf);
+    }
+    for (n = 0; owned && n < nargs; n++) free(owned[n]);
+    while (keep && printed < nargs) free(results[printed++].buf);
+    free(owned);
+    free(results);
+    free(slots);
+    free(pfd);
+    free(line.buf);
+    arena_free(&arena);
+    return failed > MAX_FAILED ? MAX_FAILED + 1 : failed;
+}
+
+static const struct builtin parallel_builtins[] = {
+    {"parallel", b_parallel},
+};
+
+void parallel_init (void)
+{
+    builtin_register(parallel_builtins, sizeof parallel_builtins / sizeof *parallel_builtins);
+}
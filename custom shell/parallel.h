@@ -0,0 +1,9 @@
+/* parallel builtin for bsh: run a command for many arguments, several at a time */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// register the parallel builtin
+void parallel_init (void);
+
+#endif // PARALLEL_H
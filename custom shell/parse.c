@@ -0,0 +1,399 @@
+/* Command line lexer and parser shared by bsh and the command server */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+
+#define ARENA_CHUNK 4096    // default chunk size in bytes
+#define ARENA_ALIGN 16      // alignment of every allocation
+
+/* ============ Arena ====================================================================== */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;            // usable bytes in data[]
+    size_t used;            // bytes handed out since the last reset
+    char data[];
+};
+
+void *arena_alloc (struct arena *a, size_t n)
+{
+    struct arena_chunk *c;
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (a->cur && a->cur->size - a->cur->used >= n) {
+        c = a->cur;
+    } else if (a->cur && a->cur->next && a->cur->next->size >= n) {
+        c = a->cur = a->cur->next;  // reuse a chunk from before the last reset
+        c->used = 0;
+    } else {
+        size_t size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+        if (!(c = malloc(sizeof *c + size))) {
+            perror("arena");
+            exit(1);
+        }
+        c->size = size;
+        c->used = 0;
+        if (a->cur) {               // insert after the current chunk
+            c->next = a->cur->next;
+            a->cur->next = c;
+        } else {
+            c->next = NULL;
+            a->head = c;
+        }
+        a->cur = c;
+    }
+    c->used += n;
+    return c->data + c->used - n;
+}
+
+char *arena_strndup (struct arena *a, const char *s, size_t n)
+{
+    char *d = arena_alloc(a, n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+void arena_reset (struct arena *a)
+{
+    a->cur = a->head;
+    if (a->head) a->head->used = 0;
+}
+
+struct arena_mark arena_mark (struct arena *a)
+{
+    struct arena_mark m = {a->cur, a->cur ? a->cur->used : 0};
+    return m;
+}
+
+void arena_release (struct arena *a, struct arena_mark m)
+{
+    if (!m.chunk) {
+        arena_reset(a);
+        return;
+    }
+    a->cur = m.chunk;               // later chunks are reused from the start
+    a->cur->used = m.used;
+}
+
+void arena_free (struct arena *a)
+{
+    struct arena_chunk *c, *next;
+    for (c = a->head; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    a->head = a->cur = NULL;
+}
+
+/* ============ Lexer ====================================================================== */
+enum token { T_END, T_WORD, T_PIPE, T_AMP, T_REDIR, T_ERROR };
+
+struct heredoc {            // here-document whose text follows the current line
+    struct redir *r;        // its file is the delimiter until the text was read
+    int strip;              // <<- removes leading tabs
+    struct heredoc *next;
+};
+
+struct lexer {
+    struct arena *a;
+    const char *p;          // read position in the line
+    char *out;              // where the next word is written
+    enum token tok;         // current token
+    char *word;             // T_WORD: the word without quotes
+    enum redir_type rtype;  // T_REDIR: kind of redirection
+    int fd;                 // T_REDIR: redirected descriptor
+    int strip;              // T_REDIR: <<- (leading tabs are removed from the text)
+    struct heredoc *here;   // here-documents waiting for the end of the line
+    struct heredoc **here_tail;
+    const char *err;        // T_ERROR: message
+};
+
+char *heredoc_read (struct arena *a, const char **p, const char *delim, int strip,
+                    long *lines)
+{
+    const char *s = *p, *end, *eol, *next;
+    size_t n = strlen(delim);
+    char *text, *o;
+    long nl = 0;
+
+    // find the delimiter line first, then copy the text before it
+    for (end = s; ; end = eol + 1, nl++) {
+        const char *t = end;
+        if (strip) t += strspn(t, "\t");
+        eol = t + strcspn(t, "\n");
+        if ((size_t)(eol - t) == n && memcmp(t, delim, n) == 0) break;
+        if (!*eol) return NULL;
+    }
+    next = *eol ? eol + 1 : eol;
+    text = o = arena_alloc(a, end - s + 1);
+    while (s < end) {
+        if (strip) s += strspn(s, "\t");
+        eol = s + strcspn(s, "\n") + 1;
+        memcpy(o, s, eol - s);
+        o += eol - s;
+        s = eol;
+    }
+    *o = '\0';
+    *p = next;
+    *lines += nl + 1;
+    return text;
+}
+
+// read the text of the here-documents started on the line that just ended
+static void lex_heredocs (struct lexer *lx)
+{
+    struct heredoc *h;
+    long lines = 0;
+    for (h = lx->here; h; h = h->next) {
+        if (!(h->r->file = heredoc_read(lx->a, &lx->p, h->r->file, h->strip, &lines))) {
+            lx->tok = T_ERROR;
+            lx->err = "here-document not terminated";
+            return;
+        }
+    }
+    lx->here = NULL;
+    lx->here_tail = &lx->here;
+}
+
+// characters that end a word
+static int is_special (char c)
+{
+    return c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+           c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+// read a word, removing quotes and backslashes
+static void lex_word (struct lexer *lx)
+{
+    const char *p = lx->p;
+    char *o = lx->out, q;
+    lx->word = o;
+    while (!is_special(*p)) {
+        if (*p == '\'' || *p == '"') {          // quoted part of the word
+            q = *p++;
+            while (*p && *p != q) {
+                if (q == '"' && *p == '\\' && (p[1] == '"' || p[1] == '\\' || p[1] == '$'))
+                    p++;
+                *o++ = *p++;
+            }
+            if (!*p) {
+                lx->tok = T_ERROR;
+                lx->err = "unterminated quote";
+                return;
+            }
+            p++;
+        } else if (*p == '\\' && p[1]) {      // escaped character
+            p++;
+            *o++ = *p++;
+        } else {
+            *o++ = *p++;
+        }
+    }
+    *o++ = '\0';
+    lx->out = o;
+    lx->p = p;
+    lx->tok = T_WORD;
+}
+
+// read an output redirection starting at '>' for descriptor fd: > >> >&
+static void lex_output (struct lexer *lx, int fd)
+{
+    lx->tok = T_REDIR;
+    lx->fd = fd;
+    if (*++lx->p == '>') {
+        lx->p++;
+        lx->rtype = R_APPEND;
+    } else if (*lx->p == '&') {
+        lx->p++;
+        lx->rtype = R_DUP;
+    } else {
+        lx->rtype = R_OUT;
+    }
+}
+
+// read an input redirection starting at '<' for descriptor fd: < <& <<< << <<-
+static void lex_input (struct lexer *lx, int fd)
+{
+    lx->tok = T_REDIR;
+    lx->fd = fd;
+    lx->strip = 0;
+    if (*++lx->p == '&') {
+        lx->p++;
+        lx->rtype = R_DUP;
+    } else if (lx->p[0] == '<' && lx->p[1] == '<') {
+        lx->p += 2;
+        lx->rtype = R_HERE_STR;
+    } else if (*lx->p == '<') {
+        lx->strip = *++lx->p == '-';
+        lx->p += lx->strip;
+        lx->rtype = R_HERE_DOC;
+    } else {
+        lx->rtype = R_IN;
+    }
+}
+
+// advance to the next token
+static void next (struct lexer *lx)
+{
+    const char *q;
+    while (*lx->p == ' ' || *lx->p == '\t' || *lx->p == '\r' || *lx->p == '\n') {
+        if (*lx->p++ == '\n' && lx->here) {     // here-documents follow the line
+            lex_heredocs(lx);
+            if (lx->tok == T_ERROR) return;
+        }
+    }
+    switch (*lx->p) {
+        case '\0':
+        case '#':                               // comment until the end of the line
+            if (lx->here) {
+                lx->tok = T_ERROR;
+                lx->err = "here-document not terminated";
+                return;
+            }
+            lx->tok = T_END;
+            return;
+        case '|':
+            lx->p++;
+            lx->tok = T_PIPE;
+            return;
+        case '&':
+            if (lx->p[1] == '>') {              // &> file
+                lx->p += 2;
+                lx->tok = T_REDIR;
+                lx->rtype = R_OUT_ERR;
+                lx->fd = 1;
+            } else {
+                lx->p++;
+                lx->tok = T_AMP;
+            }
+            return;
+        case '>':
+            lex_output(lx, 1);
+            return;
+        case '<':
+            lex_input(lx, 0);
+            return;
+    }
+    for (q = lx->p; *q >= '0' && *q <= '9'; q++);
+    if (q > lx->p && (*q == '>' || *q == '<')) {    // n> n< ... with an explicit descriptor
+        int fd = atoi(lx->p);
+        lx->p = q;
+        if (*q == '>') lex_output(lx, fd);
+        else lex_input(lx, fd);
+        return;
+    }
+    lex_word(lx);
+}
+
+/* ============ Parser ===================================================================== */
+struct word_list {
+    char *word;
+    struct word_list *next;
+};
+
+// describe the current token for an error message
+static const char *syntax_error (struct lexer *lx)
+{
+    static const char *names[] = {"newline", "word", "|", "&", "redirection", ""};
+    char *msg;
+    if (lx->tok == T_ERROR) return lx->err;
+    msg = arena_alloc(lx->a, 64);
+    snprintf(msg, 64, "syntax error near unexpected token `%s'", names[lx->tok]);
+    return msg;
+}
+
+// command := (word | redirection file)+
+static struct command *parse_command (struct lexer *lx, const char **err)
+{
+    struct command *cmd = arena_alloc(lx->a, sizeof *cmd);
+    struct word_list *words = NULL, **wtail = &words, *w;
+    struct redir **rtail;
+    int i;
+
+    memset(cmd, 0, sizeof *cmd);
+    rtail = &cmd->redirs;
+    while (lx->tok == T_WORD || lx->tok == T_REDIR) {
+        if (lx->tok == T_WORD) {
+            w = arena_alloc(lx->a, sizeof *w);
+            w->word = lx->word;
+            w->next = NULL;
+            *wtail = w;
+            wtail = &w->next;
+            cmd->argc++;
+        } else {
+            struct redir *r = arena_alloc(lx->a, sizeof *r);
+            r->type = lx->rtype;
+            r->fd = lx->fd;
+            r->next = NULL;
+            next(lx);
+            if (lx->tok != T_WORD) {            // a redirection needs a file name
+                *err = syntax_error(lx);
+                return NULL;
+            }
+            r->file = lx->word;
+            *rtail = r;
+            rtail = &r->next;
+            if (r->type == R_HERE_DOC) {        // the text comes after the line
+                struct heredoc *h = arena_alloc(lx->a, sizeof *h);
+                h->r = r;
+                h->strip = lx->strip;
+                h->next = NULL;
+                *lx->here_tail = h;
+                lx->here_tail = &h->next;
+            }
+        }
+        next(lx);
+    }
+    if (lx->tok == T_ERROR || (cmd->argc == 0 && !cmd->redirs)) {
+        *err = syntax_error(lx);
+        return NULL;
+    }
+    cmd->argv = arena_alloc(lx->a, (cmd->argc + 1) * sizeof *cmd->argv);
+    for (i = 0, w = words; w; w = w->next) cmd->argv[i++] = w->word;
+    cmd->argv[i] = NULL;
+    return cmd;
+}
+
+// line := command ('|' command)* ['&']
+struct pipeline *parse_line (struct arena *a, const char *line, const char **err)
+{
+    struct lexer lx;
+    struct pipeline *pl;
+    struct command *cmd, **tail;
+    const char *dummy;
+
+    if (!err) err = &dummy;
+    *err = NULL;
+    lx.a = a;
+    lx.p = line;
+    lx.here = NULL;
+    lx.here_tail = &lx.here;
+    lx.out = arena_alloc(a, strlen(line) + 1);  // words never outgrow the line
+    next(&lx);
+    if (lx.tok == T_END) return NULL;           // empty line
+
+    pl = arena_alloc(a, sizeof *pl);
+    pl->cmds = NULL;
+    pl->ncmds = 0;
+    pl->bg = 0;
+    tail = &pl->cmds;
+    while (1) {
+        if (!(cmd = parse_command(&lx, err))) return NULL;
+        *tail = cmd;
+        tail = &cmd->next;
+        pl->ncmds++;
+        if (lx.tok != T_PIPE) break;
+        next(&lx);
+    }
+    if (lx.tok == T_AMP) {
+        pl->bg = 1;
+        next(&lx);
+    }
+    if (lx.tok != T_END) {
+        *err = syntax_error(&lx);
+        return NULL;
+    }
+    return pl;
+}
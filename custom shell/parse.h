@@ -0,0 +1,79 @@
+/* Command line lexer and parser shared by bsh and the command server
+**
+** A line is parsed in a single pass into a small syntax tree: a pipeline of commands, each
+** with its own argument vector and list of redirections. All nodes and strings are allocated
+** from an arena that is reset in O(1) once the line has been executed.
+*/
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stddef.h>
+
+/* ============ Arena ====================================================================== */
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *head;   // first chunk, kept across resets
+    struct arena_chunk *cur;    // chunk currently allocated from
+};
+
+struct arena_mark {
+    struct arena_chunk *chunk;  // chunk in use when the mark was taken, NULL if none
+    size_t used;
+};
+
+void *arena_alloc (struct arena *a, size_t n);
+char *arena_strndup (struct arena *a, const char *s, size_t n);
+void arena_reset (struct arena *a);    // drop everything, keep the memory for the next line
+void arena_free (struct arena *a);     // give the memory back
+
+// everything allocated after arena_mark() is dropped by arena_release() (like a stack)
+struct arena_mark arena_mark (struct arena *a);
+void arena_release (struct arena *a, struct arena_mark m);
+
+/* ============ Syntax Tree ================================================================ */
+enum redir_type {
+    R_IN,                   // n< file  (n defaults to 0)
+    R_OUT,                  // n> file  (n defaults to 1)
+    R_APPEND,               // n>> file (n defaults to 1)
+    R_OUT_ERR,              // &> file  (stdout and stderr)
+    R_DUP,                  // n>&m n<&m: n becomes a copy of m, n>&- closes n
+    R_HERE_STR,             // n<<< word: n reads the word and a newline (n defaults to 0)
+    R_HERE_DOC              // n<< delim: n reads the lines up to delim (n defaults to 0)
+};
+
+// The redirections of a command are the list of descriptor actions done in its child, in
+// order, before it execs (and around a builtin that runs in the shell itself).
+struct redir {
+    enum redir_type type;
+    int fd;                 // redirected descriptor
+    char *file;             // target file, descriptor m or "-" (R_DUP), text (R_HERE_*)
+    struct redir *next;
+};
+
+struct command {
+    char **argv;            // NULL terminated argument vector
+    int argc;
+    struct redir *redirs;   // in the order they appeared
+    struct command *next;   // next command in the pipeline
+};
+
+struct pipeline {
+    struct command *cmds;   // cmd0 | cmd1 ... | cmdn
+    int ncmds;
+    int bg;                 // terminated by &
+};
+
+// parse one command line; returns NULL for an empty line or on a syntax error, in which
+// case *err (if given) points to a message describing it. The text of a here-document
+// follows the line, after its newline.
+struct pipeline *parse_line (struct arena *a, const char *line, const char **err);
+
+// read the text of a here-document starting at *p up to the line delim, without leading tabs
+// if strip is set; moves *p past the delimiter and adds the lines read to *lines. NULL if the
+// text ends before the delimiter.
+char *heredoc_read (struct arena *a, const char **p, const char *delim, int strip,
+                    long *lines);
+
+#endif // PARSE_H
@@ -0,0 +1,285 @@
+/* Hashed command lookup shared by bsh and the command server
+**
+** The table lives in an anonymous shared mapping protected by a process-shared mutex, so a
+** command resolved in one forked child (or server worker) is found by all the others. It is
+** emptied whenever $PATH changes and an entry is dropped when its file no longer exists.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pathhash.h"
+
+#define PH_SIZE 512         // number of slots (power of 2)
+#define PH_NAME 64          // maximum length of a command name
+#define PH_PATH 256         // maximum length of a resolved path
+
+enum { PH_EMPTY, PH_USED, PH_DELETED };
+
+struct ph_entry {
+    int state;              // PH_EMPTY, PH_USED or PH_DELETED
+    unsigned hits;          // number of times the entry was used
+    char name[PH_NAME];     // command name
+    char path[PH_PATH];     // absolute path of the command
+};
+
+struct pathhash {
+    pthread_mutex_t lock;   // process-shared
+    unsigned long path_id;  // hash of the $PATH the entries were resolved with
+    unsigned long gen;      // bumped whenever the entries are dropped
+    struct ph_entry entry[PH_SIZE];
+};
+
+struct pathhash *path_cache = NULL;
+
+// all command names in $PATH for completion, sorted; private to each process
+static struct {
+    unsigned long path_id, gen;     // table state the list was made for
+    char **names;
+    int n;
+} listing;
+
+/* ============ Helpers ==================================================================== */
+// FNV-1a string hash
+static unsigned long ph_hash (const char *s)
+{
+    unsigned long h = 14695981039346656037UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// find the slot of name, or NULL; with insert set, return a free slot for it instead
+static struct ph_entry *ph_slot (struct pathhash *ph, const char *name, int insert)
+{
+    unsigned long i, h = ph_hash(name);
+    struct ph_entry *e, *free_slot = NULL;
+    for (i = 0; i < PH_SIZE; i++) {
+        e = &ph->entry[(h + i) & (PH_SIZE - 1)];
+        if (e->state == PH_EMPTY) break;
+        if (e->state == PH_DELETED) {
+            if (!free_slot) free_slot = e;
+        } else if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    if (!insert) return NULL;
+    return free_slot ? free_slot : (i < PH_SIZE ? e : NULL);
+}
+
+// lock the table, recovering it if a process died while holding the lock
+static void ph_lock (struct pathhash *ph)
+{
+    if (pthread_mutex_lock(&ph->lock) == EOWNERDEAD) {
+        memset(ph->entry, 0, sizeof ph->entry);     // the entries may be half written
+        pthread_mutex_consistent(&ph->lock);
+    }
+}
+
+// drop all entries if $PATH changed since they were resolved (lock held)
+static void ph_check_path (struct pathhash *ph, const char *env)
+{
+    unsigned long id = ph_hash(env);
+    if (id != ph->path_id) {
+        memset(ph->entry, 0, sizeof ph->entry);
+        ph->path_id = id;
+        ph->gen++;
+    }
+}
+
+// walk $PATH for an executable regular file called name
+static int ph_search (const char *env, const char *name, char *path, size_t len)
+{
+    const char *dir = env, *end;
+    struct stat st;
+    int n;
+    while (1) {
+        end = strchr(dir, ':');
+        n = end ? end - dir : (int)strlen(dir);
+        if (n == 0) snprintf(path, len, "%s", name);     // empty entry: current directory
+        else snprintf(path, len, "%.*s/%s", n, dir, name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) return 0;
+        if (!end) return -1;
+        dir = end + 1;
+    }
+}
+
+static int ph_strcmp (const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// list the executables of every $PATH directory into listing, without duplicates
+static void ph_list (const char *env)
+{
+    const char *dir = env, *end;
+    char path[PH_PATH * 2], **names;
+    struct dirent *d;
+    struct stat st;
+    DIR *dp;
+    int i, j, max = listing.n;
+
+    for (i = 0; i < listing.n; i++) free(listing.names[i]);
+    listing.n = 0;
+    while (1) {
+        end = strchr(dir, ':');
+        snprintf(path, sizeof path, "%.*s", end ? (int)(end - dir) : (int)strlen(dir), dir);
+        if ((dp = opendir(path[0] ? path : ".")) != NULL) {
+            while ((d = readdir(dp)) != NULL) {
+                if (d->d_name[0] == '.') continue;
+                snprintf(path, sizeof path, "%.*s/%s",
+                         end ? (int)(end - dir) : (int)strlen(dir), dir, d->d_name);
+                if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || access(path, X_OK) < 0)
+                    continue;
+                if (listing.n == max) {
+                    max = max ? 2 * max : 256;
+                    if (!(names = realloc(listing.names, max * sizeof *names))) break;
+                    listing.names = names;
+                }
+                if (!(listing.names[listing.n] = strdup(d->d_name))) break;
+                listing.n++;
+            }
+            closedir(dp);
+        }
+        if (!end) break;
+        dir = end + 1;
+    }
+    qsort(listing.names, listing.n, sizeof *listing.names, ph_strcmp);
+    for (i = j = 0; i < listing.n; i++) {   // the first directory in $PATH wins anyway
+        if (j && strcmp(listing.names[j - 1], listing.names[i]) == 0) free(listing.names[i]);
+        else listing.names[j++] = listing.names[i];
+    }
+    listing.n = j;
+}
+
+/* ============ Interface ================================================================== */
+struct pathhash *pathhash_create (void)
+{
+    struct pathhash *ph;
+    pthread_mutexattr_t ma;
+    ph = mmap(NULL, sizeof *ph, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ph == MAP_FAILED) return NULL;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&ph->lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+    return ph;
+}
+
+int pathhash_lookup (struct pathhash *ph, const char *name, char *path, size_t len)
+{
+    const char *env = getenv("PATH");
+    struct ph_entry *e;
+    if (!env) env = "/usr/local/bin:/bin:/usr/bin";
+
+    ph_lock(ph);
+    ph_check_path(ph, env);
+    if ((e = ph_slot(ph, name, 0)) != NULL) {
+        e->hits++;
+        snprintf(path, len, "%s", e->path);
+        pthread_mutex_unlock(&ph->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&ph->lock);
+
+    // resolve without holding the lock, the other processes may keep going
+    if (ph_search(env, name, path, len) < 0) return -1;
+    if (strlen(name) >= PH_NAME || strlen(path) >= PH_PATH) return 0;  // too long to keep
+
+    ph_lock(ph);
+    ph_check_path(ph, env);
+    if ((e = ph_slot(ph, name, 1)) != NULL) {
+        if (e->state != PH_USED) e->hits = 0;
+        e->state = PH_USED;
+        strcpy(e->name, name);
+        strcpy(e->path, path);
+        e->hits++;
+    }
+    pthread_mutex_unlock(&ph->lock);
+    return 0;
+}
+
+void pathhash_forget (struct pathhash *ph, const char *name)
+{
+    struct ph_entry *e;
+    ph_lock(ph);
+    if (!name) {
+        memset(ph->entry, 0, sizeof ph->entry);
+        ph->gen++;
+    } else if ((e = ph_slot(ph, name, 0)) != NULL) {
+        e->state = PH_DELETED;
+    }
+    pthread_mutex_unlock(&ph->lock);
+}
+
+void pathhash_print (struct pathhash *ph, FILE *out)
+{
+    int i, n = 0;
+    ph_lock(ph);
+    for (i = 0; i < PH_SIZE; i++) {
+        if (ph->entry[i].state != PH_USED) continue;
+        if (n++ == 0) fprintf(out, "hits\tcommand\n");
+        fprintf(out, "%4u\t%s\n", ph->entry[i].hits, ph->entry[i].path);
+    }
+    pthread_mutex_unlock(&ph->lock);
+    if (n == 0) fprintf(out, "hash table empty\n");
+}
+
+int pathhash_execvp (struct pathhash *ph, char *argv[])
+{
+    char path[PH_PATH * 2];
+    int retry;
+    if (!ph || strchr(argv[0], '/')) return execvp(argv[0], argv);
+    for (retry = 0; retry < 2; retry++) {
+        if (pathhash_lookup(ph, argv[0], path, sizeof path) < 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        execv(path, argv);
+        if (errno != ENOENT && errno != ENOTDIR) break;
+        pathhash_forget(ph, argv[0]);   // stale entry: the file moved, search $PATH again
+    }
+    if (errno == ENOEXEC) return execvp(argv[0], argv); // script without #!, let execvp run sh
+    return -1;
+}
+
+int pathhash_complete (struct pathhash *ph, const char *prefix, char ***names)
+{
+    const char *env = getenv("PATH");
+    size_t len = strlen(prefix);
+    int lo = 0, hi, n;
+    if (!env) env = "/usr/local/bin:/bin:/usr/bin";
+
+    // the list is made again after $PATH changed or hash -r
+    ph_lock(ph);
+    ph_check_path(ph, env);
+    if (!listing.names || listing.path_id != ph->path_id || listing.gen != ph->gen) {
+        listing.path_id = ph->path_id;
+        listing.gen = ph->gen;
+        pthread_mutex_unlock(&ph->lock);
+        ph_list(env);
+    } else {
+        pthread_mutex_unlock(&ph->lock);
+    }
+
+    // binary search for the first name >= prefix, the matches follow it
+    hi = listing.n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(listing.names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (n = 0; lo + n < listing.n && strncmp(listing.names[lo + n], prefix, len) == 0; n++);
+    *names = listing.names + lo;
+    return n;
+}
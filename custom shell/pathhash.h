@@ -0,0 +1,32 @@
+/* Hashed command lookup: remembers where commands were found in $PATH (like bash's hash) */
+
+#ifndef PATHHASH_H
+#define PATHHASH_H
+
+#include <stdio.h>
+
+struct pathhash;
+
+// the table of the running program (bsh or server), NULL until created
+extern struct pathhash *path_cache;
+
+// create an empty table in shared memory, so lookups done by forked children are kept
+struct pathhash *pathhash_create (void);
+
+// find the absolute path of a command and add it to the table; -1 if it is not in $PATH
+int pathhash_lookup (struct pathhash *ph, const char *name, char *path, size_t len);
+
+// forget one command (NULL: all commands, as in hash -r)
+void pathhash_forget (struct pathhash *ph, const char *name);
+
+// print the remembered commands with their hit counts
+void pathhash_print (struct pathhash *ph, FILE *out);
+
+// commands in $PATH whose names start with prefix, for completion; *names points to the sorted
+// matches, valid until the next call; returns how many there are
+int pathhash_complete (struct pathhash *ph, const char *prefix, char ***names);
+
+// execvp() replacement using the table; only returns on failure
+int pathhash_execvp (struct pathhash *ph, char *argv[]);
+
+#endif // PATHHASH_H
@@ -0,0 +1,1664 @@
+/* Shell language for bsh
+**
+** Text is compiled once into a tree of nodes and run from the tree as often as needed, so a
+** loop body or a function is never tokenized again. Words are split at compile time into
+** literal text and expansions: a word without expansions is final, and a simple command made
+** of such words keeps a ready argument vector. A variable reference points straight at the
+** variable. What a command expands to lives in an arena that is released when it finished.
+**
+** Files run with `.` (or bsh file) stay compiled and are compiled again only when they
+** changed on disk.
+*/
+
+#define _GNU_SOURCE         // pipe2()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "jobs.h"
+#include "parse.h"
+#include "script.h"
+
+#define VAR_SLOTS 256       // hash chains of the variable table (power of 2)
+#define SUBST_READ 4096     // read size for the output of $(...)
+#define READ_CHUNK 128      // read size of the read builtin on seekable input
+
+/* ============ Compiled Form ============================================================== */
+enum part_type {
+    P_TEXT,                 // literal text
+    P_VAR,                  // $name ${name}
+    P_PARAM,                // $1 ${10} $0 $# $? $@ $* $$
+    P_SUBST                 // $(list)
+};
+
+enum { PARAM_STATUS = -1, PARAM_COUNT = -2, PARAM_ALL = -3, PARAM_STAR = -4, PARAM_PID = -5 };
+
+struct part {
+    enum part_type type;
+    int quoted;             // inside double quotes: the result is not split into fields
+    char *text;             // P_TEXT
+    struct var *var;        // P_VAR
+    int param;              // P_PARAM: positional parameter n, or PARAM_*
+    struct node *sub;       // P_SUBST
+    struct part *next;
+};
+
+struct word {
+    struct part *parts;
+    char *text;             // the final word if it needs no expansion, else NULL
+    struct word *next;
+};
+
+struct assign {             // name=value before a command
+    struct var *var;
+    struct word *value;
+    struct assign *next;
+};
+
+struct redirect {           // redirection whose file name is expanded when it runs
+    enum redir_type type;
+    int fd;
+    struct word *file;
+    struct redirect *next;
+};
+
+struct simple {             // one stage of a pipeline
+    struct assign *assigns;
+    struct word *words;
+    int nwords;
+    struct redirect *redirs;
+    char **argv;            // every word is final: the argument vector, ready to use
+    struct simple *next;
+};
+
+enum node_type {
+    N_PIPELINE,             // stages
+    N_AND,                  // a && b
+    N_OR,                   // a || b
+    N_GROUP,                // { a }
+    N_IF,                   // if a then b else c (an elif is an N_IF in c)
+    N_WHILE,                // while a do b done
+    N_UNTIL,                // until a do b done
+    N_FOR,                  // for var in words do b done
+    N_FUNCTION              // var () b
+};
+
+struct node {
+    enum node_type type;
+    int negate;             // ! pipeline
+    int bg;                 // pipeline &
+    struct simple *stages;
+    int nstages;
+    struct node *a, *b, *c; // operands and bodies, lists are linked through next
+    struct var *var;        // N_FOR: loop variable, N_FUNCTION: name
+    struct word *words;     // N_FOR
+    int in;                 // N_FOR: has a word list (without one it loops over "$@")
+    struct script *script;  // N_FUNCTION: the text the body belongs to
+    struct node *next;      // next command of a list
+};
+
+struct script {
+    struct arena arena;     // every node and word of the text
+    struct node *tree;
+    int refs;               // holders: the compiler, runs in progress, functions, the cache
+};
+
+struct var {
+    char *name;
+    char *value;            // NULL if unset
+    int exported;           // in the environment of commands
+    struct node *func;      // function of the same name, NULL if none
+    struct script *fscript; // the text of func
+    struct var *next;       // hash chain
+};
+
+int script_status = 0;
+volatile sig_atomic_t script_interrupted = 0;
+
+static struct var *vars[VAR_SLOTS];
+static struct arena run;    // expansions of the commands being run, used like a stack
+static int subst_status;    // status of the last $(...) of a command, -1 if none ran
+
+static struct {
+    char *name;             // $0
+    char **argv;            // $1 is argv[1]
+    int argc;               // $#
+} args;
+
+static pid_t shell_pid;     // this process, changes in forked children
+static pid_t main_pid;      // $$
+
+enum jump { J_NONE, J_BREAK, J_CONTINUE, J_RETURN };
+
+static struct {
+    enum jump jump;         // break, continue or return on its way to the loop or function
+    int count;              // loops the break or continue still has to leave
+    int loops;              // loops running in the current function
+    int depth;              // functions and sourced files running
+    int running;            // nested script_run() calls
+} flow;
+
+/* ============ Variables ================================================================== */
+// strdup that gives up like the arena does when memory runs out
+static char *xstrdup (const char *s, size_t n)
+{
+    char *d = malloc(n + 1);
+    if (!d) {
+        perror("bsh");
+        exit(1);
+    }
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+static int is_name_start (char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_name_char (char c)
+{
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+// s[0..n) is a variable name
+static int is_name (const char *s, size_t n)
+{
+    size_t i;
+    if (n == 0 || !is_name_start(s[0])) return 0;
+    for (i = 1; i < n; i++) {
+        if (!is_name_char(s[i])) return 0;
+    }
+    return 1;
+}
+
+// FNV-1a hash of n bytes
+static unsigned long var_hash (const char *s, size_t n)
+{
+    unsigned long h = 14695981039346656037UL;
+    while (n--) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// the variable called s[0..n), NULL if it was never used
+static struct var *var_lookup (const char *s, size_t n)
+{
+    struct var *v;
+    for (v = vars[var_hash(s, n) & (VAR_SLOTS - 1)]; v; v = v->next) {
+        if (strncmp(v->name, s, n) == 0 && v->name[n] == '\0') return v;
+    }
+    return NULL;
+}
+
+// the variable called s[0..n), created on first use with its value from the environment
+static struct var *var_get (const char *s, size_t n)
+{
+    struct var *v = var_lookup(s, n), **slot;
+    const char *env;
+    if (v) return v;
+    if (!(v = calloc(1, sizeof *v))) {
+        perror("bsh");
+        exit(1);
+    }
+    v->name = xstrdup(s, n);
+    if ((env = getenv(v->name)) != NULL) {
+        v->value = xstrdup(env, strlen(env));
+        v->exported = 1;
+    }
+    slot = &vars[var_hash(s, n) & (VAR_SLOTS - 1)];
+    v->next = *slot;
+    *slot = v;
+    return v;
+}
+
+// set a variable (NULL: unset it), in the environment as well if it is exported
+static void var_set (struct var *v, const char *value)
+{
+    char *copy = value ? xstrdup(value, strlen(value)) : NULL;
+    free(v->value);
+    v->value = copy;
+    if (v->exported && value) setenv(v->name, value, 1);
+    else if (v->exported) unsetenv(v->name);
+}
+
+/* ============ Lexer ====================================================================== */
+enum token { T_END, T_WORD, T_NEWLINE, T_SEMI, T_AMP, T_PIPE, T_AND, T_OR, T_LPAREN,
+             T_RPAREN, T_REDIR, T_ERROR };
+
+struct lexer {
+    struct script *s;       // script being compiled
+    struct arena *a;        // its arena
+    const char *p;          // read position in the text
+    char *out;              // where the next literal text is written
+    long line;              // line of p
+    enum token tok;         // current token
+    struct word *word;      // T_WORD
+    int plain;              // T_WORD: no quotes and no expansions, may be a keyword
+    size_t assign;          // T_WORD: length of a leading name= (0 if there is none)
+    enum redir_type rtype;  // T_REDIR: kind of redirection
+    int fd;                 // T_REDIR: redirected descriptor
+    int strip;              // T_REDIR: <<- (leading tabs are removed from the text)
+    struct heredoc *here;   // here-documents waiting for the end of the line
+    struct heredoc **here_tail;
+    struct script_error *err;
+};
+
+struct heredoc {            // here-document whose text follows the current line
+    struct redirect *r;     // its file is the delimiter until the text was read
+    int strip;              // <<- removes leading tabs
+    int expand;             // the delimiter was not quoted: $ expansions in the text
+    struct heredoc *next;
+};
+
+static struct node *parse_list (struct lexer *lx);
+static void next (struct lexer *lx);
+
+// record the first error of a compilation
+static void lex_error (struct lexer *lx, const char *msg, int incomplete)
+{
+    if (!lx->err->msg) {
+        lx->err->msg = msg;
+        lx->err->line = lx->line;
+        lx->err->incomplete = incomplete;
+    }
+    lx->tok = T_ERROR;
+}
+
+// an unexpected token; at the end of the text, more lines may still complete the command
+static void syntax_error (struct lexer *lx)
+{
+    static const char *names[] = {"", "word", "newline", ";", "&", "|", "&&", "||", "(", ")",
+                                  "redirection", ""};
+    static char msg[96];
+    if (lx->tok == T_ERROR) return;
+    if (lx->tok == T_END) {
+        lex_error(lx, "syntax error: unexpected end of file", 1);
+        return;
+    }
+    snprintf(msg, sizeof msg, "syntax error near unexpected token `%.40s'",
+             lx->tok == T_WORD && lx->word->text ? lx->word->text : names[lx->tok]);
+    lex_error(lx, msg, 0);
+}
+
+// characters that end a word outside quotes
+static int is_special (char c)
+{
+    return strchr(" \t\r\n;&|<>()", c) != NULL;     // includes '\0'
+}
+
+// append a part to a word
+static struct part *part_add (struct lexer *lx, struct part ***tail, enum part_type type,
+                              int quoted)
+{
+    struct part *pt = arena_alloc(lx->a, sizeof *pt);
+    memset(pt, 0, sizeof *pt);
+    pt->type = type;
+    pt->quoted = quoted;
+    **tail = pt;
+    *tail = &pt->next;
+    return pt;
+}
+
+// a parameter or variable name s[0..n) after $ or in ${}
+static void lex_param (struct lexer *lx, struct part *pt, const char *s, size_t n)
+{
+    static const char special[] = "?#@*$";
+    static const int params[] = {PARAM_STATUS, PARAM_COUNT, PARAM_ALL, PARAM_STAR, PARAM_PID};
+    if (s[0] >= '0' && s[0] <= '9') {
+        pt->type = P_PARAM;
+        pt->param = atoi(s);
+    } else if (n == 1 && strchr(special, s[0])) {
+        pt->type = P_PARAM;
+        pt->param = params[strchr(special, s[0]) - special];
+    } else {
+        pt->type = P_VAR;
+        pt->var = var_get(s, n);
+    }
+}
+
+// an expansion starting at the '$' at lx->p: $name $n $? ${name} $(list)
+static int lex_dollar (struct lexer *lx, struct part ***tail, int quoted)
+{
+    const char *p = lx->p + 1, *q;
+    struct part *pt = part_add(lx, tail, P_VAR, quoted);
+
+    if (*p == '(') {                            // $(list): compiled with the word
+        if (p[1] == '(') {
+            lex_error(lx, "arithmetic expansion is not supported", 0);
+            return -1;
+        }
+        pt->type = P_SUBST;
+        lx->p = p + 1;
+        next(lx);
+        pt->sub = parse_list(lx);
+        if (lx->tok != T_RPAREN) {
+            syntax_error(lx);
+            return -1;
+        }
+        return 0;                               // lx->p is past the ')'
+    }
+    if (*p == '{') {
+        q = ++p;
+        if (*q && strchr("?#@*$", *q)) q++;
+        else if (*q >= '0' && *q <= '9') while (*q >= '0' && *q <= '9') q++;
+        else while (is_name_char(*q)) q++;
+        if (*q != '}' || q == p) {
+            lex_error(lx, *q ? "bad substitution" : "unterminated ${", !*q);
+            return -1;
+        }
+        lex_param(lx, pt, p, q - p);
+        lx->p = q + 1;
+        return 0;
+    }
+    for (q = p + 1; is_name_start(*p) && is_name_char(*q); q++);
+    lex_param(lx, pt, p, q - p);                // $1 is one digit, $? one character
+    lx->p = q;
+    return 0;
+}
+
+// a $ that starts an expansion rather than standing for itself
+static int is_expansion (const char *p)
+{
+    return p[0] == '$' && (is_name_char(p[1]) || strchr("?#@*${(", p[1]) != NULL) && p[1];
+}
+
+// read a word: literal text between expansions, with quotes and backslashes removed
+static void lex_word (struct lexer *lx)
+{
+    struct word *w = arena_alloc(lx->a, sizeof *w);
+    struct part **tail = &w->parts;
+    const char *p = lx->p, *q;
+    char *lit = lx->out, *o = lx->out;          // literal text being collected
+    int dq = 0, quoted = 0, expand = 0;
+    size_t assign = 0;
+
+    w->parts = NULL;
+    w->text = NULL;
+    w->next = NULL;
+    for (q = p; is_name_char(*q); q++);
+    if (*q == '=' && is_name(p, q - p)) assign = q - p + 1;
+
+    while (dq || !is_special(*p)) {
+        if (*p == '\0') {                       // inside double quotes
+            lex_error(lx, "unterminated quote", 1);
+            return;
+        } else if (*p == '"') {
+            dq = !dq;
+            quoted = 1;
+            p++;
+        } else if (*p == '\'' && !dq) {
+            if (!(q = strchr(++p, '\''))) {
+                lex_error(lx, "unterminated quote", 1);
+                return;
+            }
+            for (; p < q; p++) {
+                if (*p == '\n') lx->line++;
+                *o++ = *p;
+            }
+            quoted = 1;
+            p++;
+        } else if (*p == '\\' && p[1] == '\n') {     // line continuation
+            lx->line++;
+            p += 2;
+        } else if (*p == '\\' && (dq ? strchr("$\"\\`", p[1]) != NULL : p[1] != '\0')) {
+            *o++ = p[1];
+            quoted = 1;
+            p += 2;
+        } else if (is_expansion(p)) {
+            if (o > lit) {                      // end the literal text before it
+                part_add(lx, &tail, P_TEXT, dq)->text = lit;
+                *o++ = '\0';
+            }
+            lx->p = p;
+            lx->out = o;
+            if (lex_dollar(lx, &tail, dq) < 0) return;
+            p = lx->p;
+            lit = o = lx->out;                  // after the words of a $(list)
+            expand = 1;
+        } else {
+            if (*p == '\n') lx->line++;
+            *o++ = *p++;
+        }
+    }
+    if (o > lit || !w->parts) {                 // "" is an empty word, not none
+        part_add(lx, &tail, P_TEXT, 0)->text = lit;
+        *o++ = '\0';
+    }
+    if (!expand) w->text = w->parts->text;
+    lx->out = o;
+    lx->p = p;
+    lx->tok = T_WORD;
+    lx->word = w;
+    lx->plain = !quoted && !expand;
+    lx->assign = assign;
+}
+
+// the text of a here-document as a word: with $ expansions that are not split into fields,
+// backslashes only quote $ ` \\ and the newline
+static struct word *lex_here_text (struct lexer *lx, char *text, int expand)
+{
+    struct word *w = arena_alloc(lx->a, sizeof *w);
+    struct part **tail = &w->parts;
+    const char *saved = lx->p, *p = text;
+    char *lit = lx->out, *o = lx->out;
+    long line = lx->line;                       // the lines were counted by heredoc_read()
+
+    w->parts = NULL;
+    w->text = NULL;
+    w->next = NULL;
+    if (!expand) {
+        part_add(lx, &tail, P_TEXT, 1)->text = w->text = text;
+        return w;
+    }
+    while (*p) {
+        if (*p == '\\' && p[1] == '\n') {
+            p += 2;
+        } else if (*p == '\\' && strchr("$`\\", p[1])) {
+            *o++ = p[1];
+            p += 2;
+        } else if (is_expansion(p)) {
+            if (o > lit) {
+                part_add(lx, &tail, P_TEXT, 1)->text = lit;
+                *o++ = '\0';
+            }
+            lx->p = p;
+            lx->out = o;
+            if (lex_dollar(lx, &tail, 1) < 0) return NULL;
+            p = lx->p;
+            lit = o = lx->out;
+        } else {
+            *o++ = *p++;
+        }
+    }
+    if (o > lit || !w->parts) {
+        part_add(lx, &tail, P_TEXT, 1)->text = lit;
+        *o++ = '\0';
+    }
+    if (!w->parts->next && w->parts->type == P_TEXT) w->text = w->parts->text;
+    lx->out = o;
+    lx->p = saved;
+    lx->line = line;
+    return w;
+}
+
+// read the text of the here-documents started on the line that just ended
+static void lex_heredocs (struct lexer *lx)
+{
+    struct heredoc *h = lx->here;
+    char *text;
+
+    lx->here = NULL;                            // a $(list) in the text has its own
+    lx->here_tail = &lx->here;
+    for (; h; h = h->next) {
+        if (!(text = heredoc_read(lx->a, &lx->p, h->r->file->text, h->strip, &lx->line))) {
+            lex_error(lx, "here-document not terminated", 1);
+            return;
+        }
+        if (!(h->r->file = lex_here_text(lx, text, h->expand))) return;
+    }
+}
+
+// read an output redirection starting at '>' for descriptor fd: > >> >&
+static void lex_output (struct lexer *lx, int fd)
+{
+    lx->tok = T_REDIR;
+    lx->fd = fd;
+    if (*++lx->p == '>') {
+        lx->p++;
+        lx->rtype = R_APPEND;
+    } else if (*lx->p == '&') {
+        lx->p++;
+        lx->rtype = R_DUP;
+    } else {
+        lx->rtype = R_OUT;
+    }
+}
+
+// read an input redirection starting at '<' for descriptor fd: < <& <<< << <<-
+static void lex_input (struct lexer *lx, int fd)
+{
+    lx->tok = T_REDIR;
+    lx->fd = fd;
+    lx->strip = 0;
+    if (*++lx->p == '&') {
+        lx->p++;
+        lx->rtype = R_DUP;
+    } else if (lx->p[0] == '<' && lx->p[1] == '<') {
+        lx->p += 2;
+        lx->rtype = R_HERE_STR;
+    } else if (*lx->p == '<') {
+        lx->strip = *++lx->p == '-';
+        lx->p += lx->strip;
+        lx->rtype = R_HERE_DOC;
+    } else {
+        lx->rtype = R_IN;
+    }
+}
+
+// advance to the next token
+static void next (struct lexer *lx)
+{
+    const char *q;
+    if (lx->tok == T_ERROR) return;
+    while (*lx->p == ' ' || *lx->p == '\t' || *lx->p == '\r' ||
+           (*lx->p == '\\' && lx->p[1] == '\n')) {
+        if (*lx->p == '\\') {
+            lx->line++;
+            lx->p++;
+        }
+        lx->p++;
+    }
+    if (*lx->p == '#') lx->p += strcspn(lx->p, "\n");    // comment until the end of the line
+    switch (*lx->p) {
+        case '\0':
+            if (lx->here) lex_error(lx, "here-document not terminated", 1);
+            else lx->tok = T_END;
+            return;
+        case '\n':
+            lx->line++;
+            lx->p++;
+            if (lx->here) lex_heredocs(lx);     // their text follows the line
+            if (!lx->err->msg) lx->tok = T_NEWLINE;
+            return;
+        case ';':
+            lx->p++;
+            lx->tok = T_SEMI;
+            return;
+        case '(':
+            lx->p++;
+            lx->tok = T_LPAREN;
+            return;
+        case ')':
+            lx->p++;
+            lx->tok = T_RPAREN;
+            return;
+        case '|':
+            lx->tok = lx->p[1] == '|' ? T_OR : T_PIPE;
+            lx->p += lx->tok == T_OR ? 2 : 1;
+            return;
+        case '&':
+            if (lx->p[1] == '>') {              // &> file
+                lx->p += 2;
+                lx->tok = T_REDIR;
+                lx->rtype = R_OUT_ERR;
+                lx->fd = 1;
+                return;
+            }
+            lx->tok = lx->p[1] == '&' ? T_AND : T_AMP;
+            lx->p += lx->tok == T_AND ? 2 : 1;
+            return;
+        case '>':
+            lex_output(lx, 1);
+            return;
+        case '<':
+            lex_input(lx, 0);
+            return;
+    }
+    for (q = lx->p; *q >= '0' && *q <= '9'; q++);
+    if (q > lx->p && (*q == '>' || *q == '<')) {    // n> n< ... with an explicit descriptor
+        int fd = atoi(lx->p);
+        lx->p = q;
+        if (*q == '>') lex_output(lx, fd);
+        else lex_input(lx, fd);
+        return;
+    }
+    lex_word(lx);
+}
+
+/* ============ Parser ===================================================================== */
+static int failed (struct lexer *lx)
+{
+    return lx->err->msg != NULL;
+}
+
+// the current token is the keyword kw
+static int is_word (struct lexer *lx, const char *kw)
+{
+    return lx->tok == T_WORD && lx->plain && strcmp(lx->word->text, kw) == 0;
+}
+
+// step over the keyword kw, which has to come next
+static int expect (struct lexer *lx, const char *kw)
+{
+    if (!is_word(lx, kw)) {
+        syntax_error(lx);
+        return -1;
+    }
+    next(lx);
+    return 0;
+}
+
+static void skip_newlines (struct lexer *lx)
+{
+    while (lx->tok == T_NEWLINE) next(lx);
+}
+
+static struct node *node_new (struct lexer *lx, enum node_type type)
+{
+    struct node *n = arena_alloc(lx->a, sizeof *n);
+    memset(n, 0, sizeof *n);
+    n->type = type;
+    return n;
+}
+
+// simple := (name=value)* (word | redirection file)*, with at least one of them
+static struct node *parse_simple (struct lexer *lx)
+{
+    struct node *n = node_new(lx, N_PIPELINE);
+    struct simple *c = arena_alloc(lx->a, sizeof *c);
+    struct word **wtail, *w;
+    struct assign **atail, *as;
+    struct redirect **rtail, *r;
+    int i;
+
+    memset(c, 0, sizeof *c);
+    wtail = &c->words;
+    atail = &c->assigns;
+    rtail = &c->redirs;
+    n->stages = c;
+    n->nstages = 1;
+    while (lx->tok == T_WORD || lx->tok == T_REDIR) {
+        if (lx->tok == T_WORD && lx->assign && !c->words) {
+            as = arena_alloc(lx->a, sizeof *as);
+            w = lx->word;
+            as->var = var_get(w->parts->text, lx->assign - 1);
+            w->parts->text += lx->assign;       // the value is the rest of the word
+            if (w->text) w->text = w->parts->text;
+            as->value = w;
+            as->next = NULL;
+            *atail = as;
+            atail = &as->next;
+        } else if (lx->tok == T_WORD) {
+            *wtail = lx->word;
+            wtail = &lx->word->next;
+            c->nwords++;
+        } else {
+            struct heredoc *h = NULL;
+            r = arena_alloc(lx->a, sizeof *r);
+            r->type = lx->rtype;
+            r->fd = lx->fd;
+            r->next = NULL;
+            if (r->type == R_HERE_DOC) {
+                h = arena_alloc(lx->a, sizeof *h);
+                h->strip = lx->strip;
+            }
+            next(lx);
+            if (lx->tok != T_WORD) {            // a redirection needs a file name
+                syntax_error(lx);
+                return NULL;
+            }
+            r->file = lx->word;
+            *rtail = r;
+            rtail = &r->next;
+            if (h) {                            // the text comes after the line
+                if (!lx->word->text) {
+                    lex_error(lx, "here-document delimiter must not be expanded", 0);
+                    return NULL;
+                }
+                h->r = r;
+                h->expand = lx->plain;
+                h->next = NULL;
+                *lx->here_tail = h;
+                lx->here_tail = &h->next;
+            }
+        }
+        next(lx);
+    }
+    if (failed(lx) || (!c->words && !c->assigns && !c->redirs)) {
+        syntax_error(lx);
+        return NULL;
+    }
+    for (w = c->words; w && w->text; w = w->next);
+    if (!w && c->words) {                       // nothing to expand: build argv right now
+        c->argv = arena_alloc(lx->a, (c->nwords + 1) * sizeof *c->argv);
+        for (i = 0, w = c->words; w; w = w->next) c->argv[i++] = w->text;
+        c->argv[i] = NULL;
+    }
+    return n;
+}
+
+// a list that must not be empty
+static struct node *parse_body (struct lexer *lx)
+{
+    struct node *n = parse_list(lx);
+    if (!n && !failed(lx)) syntax_error(lx);
+    return n;
+}
+
+// if := 'if' list 'then' list ('elif' list 'then' list)* ['else' list] 'fi'
+static struct node *parse_if (struct lexer *lx)
+{
+    struct node *n = node_new(lx, N_IF);
+    next(lx);                                   // if or elif
+    if (!(n->a = parse_body(lx)) || expect(lx, "then") < 0 || !(n->b = parse_body(lx)))
+        return NULL;
+    if (is_word(lx, "elif")) {                  // the rest of the chain, up to the fi
+        n->c = parse_if(lx);
+        return n->c ? n : NULL;
+    }
+    if (is_word(lx, "else")) {
+        next(lx);
+        if (!(n->c = parse_body(lx))) return NULL;
+    }
+    return expect(lx, "fi") < 0 ? NULL : n;
+}
+
+// while := ('while' | 'until') list 'do' list 'done'
+static struct node *parse_loop (struct lexer *lx, enum node_type type)
+{
+    struct node *n = node_new(lx, type);
+    next(lx);
+    if (!(n->a = parse_body(lx)) || expect(lx, "do") < 0 || !(n->b = parse_body(lx)) ||
+        expect(lx, "done") < 0) return NULL;
+    return n;
+}
+
+// for := 'for' name ['in' word* (';' | newline)] 'do' list 'done'
+static struct node *parse_for (struct lexer *lx)
+{
+    struct node *n = node_new(lx, N_FOR);
+    struct word **tail = &n->words;
+
+    next(lx);
+    if (lx->tok != T_WORD || !lx->plain || !is_name(lx->word->text, strlen(lx->word->text))) {
+        syntax_error(lx);
+        return NULL;
+    }
+    n->var = var_get(lx->word->text, strlen(lx->word->text));
+    next(lx);
+    skip_newlines(lx);
+    if (is_word(lx, "in")) {
+        n->in = 1;
+        for (next(lx); lx->tok == T_WORD; next(lx)) {
+            *tail = lx->word;
+            tail = &lx->word->next;
+        }
+        if (lx->tok != T_SEMI && lx->tok != T_NEWLINE) {
+            syntax_error(lx);
+            return NULL;
+        }
+        next(lx);
+    } else if (lx->tok == T_SEMI) {
+        next(lx);
+    }
+    skip_newlines(lx);
+    if (expect(lx, "do") < 0 || !(n->b = parse_body(lx)) || expect(lx, "done") < 0)
+        return NULL;
+    return n;
+}
+
+// command := if | while | until | for | '{' list '}' | name '(' ')' command | simple
+static struct node *parse_command (struct lexer *lx)
+{
+    struct node *n, *f;
+    struct simple *c;
+
+    if (is_word(lx, "if")) return parse_if(lx);
+    if (is_word(lx, "while")) return parse_loop(lx, N_WHILE);
+    if (is_word(lx, "until")) return parse_loop(lx, N_UNTIL);
+    if (is_word(lx, "for")) return parse_for(lx);
+    if (is_word(lx, "{")) {
+        n = node_new(lx, N_GROUP);
+        next(lx);
+        if (!(n->a = parse_body(lx)) || expect(lx, "}") < 0) return NULL;
+        return n;
+    }
+    if (!(n = parse_simple(lx))) return NULL;
+    c = n->stages;
+    if (lx->tok != T_LPAREN) return n;
+
+    // a function definition: name () command
+    if (c->nwords != 1 || c->assigns || c->redirs || !c->words->text ||
+        !is_name(c->words->text, strlen(c->words->text))) {
+        syntax_error(lx);
+        return NULL;
+    }
+    next(lx);
+    if (lx->tok != T_RPAREN) {
+        syntax_error(lx);
+        return NULL;
+    }
+    next(lx);
+    skip_newlines(lx);
+    f = node_new(lx, N_FUNCTION);
+    f->var = var_get(c->words->text, strlen(c->words->text));
+    f->script = lx->s;
+    if (!(f->b = parse_command(lx))) return NULL;
+    if (f->b->type == N_PIPELINE) {
+        lex_error(lx, "syntax error: the body of a function must be a compound command", 0);
+        return NULL;
+    }
+    return f;
+}
+
+// pipeline := ['!'] command ('|' command)*, where only simple commands can be piped
+static struct node *parse_pipeline (struct lexer *lx)
+{
+    struct node *n, *c;
+    struct simple **tail;
+    int negate = 0;
+
+    if (is_word(lx, "!")) {
+        negate = 1;
+        next(lx);
+    }
+    if (!(n = parse_command(lx))) return NULL;
+    n->negate = negate;
+    for (tail = &n->stages; lx->tok == T_PIPE; n->nstages++) {
+        next(lx);
+        skip_newlines(lx);
+        if (!(c = parse_command(lx))) return NULL;
+        if (n->type != N_PIPELINE || c->type != N_PIPELINE) {
+            lex_error(lx, "syntax error: only simple commands can be piped", 0);
+            return NULL;
+        }
+        *(tail = &(*tail)->next) = c->stages;
+    }
+    return n;
+}
+
+// and_or := pipeline (('&&' | '||') pipeline)*
+static struct node *parse_and_or (struct lexer *lx)
+{
+    struct node *n, *op;
+    if (!(n = parse_pipeline(lx))) return NULL;
+    while (lx->tok == T_AND || lx->tok == T_OR) {
+        op = node_new(lx, lx->tok == T_AND ? N_AND : N_OR);
+        next(lx);
+        skip_newlines(lx);
+        op->a = n;
+        if (!(op->b = parse_pipeline(lx))) return NULL;
+        n = op;
+    }
+    return n;
+}
+
+// list := and_or ((';' | '&' | newline) and_or)*, up to a keyword or ')' that ends it;
+// NULL for an empty list as well as on errors
+static struct node *parse_list (struct lexer *lx)
+{
+    static const char *ends[] = {"then", "elif", "else", "fi", "do", "done", "}"};
+    struct node *head = NULL, **tail = &head, *n;
+    int i, nends = sizeof ends / sizeof *ends;
+
+    while (1) {
+        skip_newlines(lx);
+        if (lx->tok == T_END || lx->tok == T_RPAREN || lx->tok == T_ERROR) break;
+        for (i = 0; i < nends && !is_word(lx, ends[i]); i++);
+        if (i < nends) break;
+        if (!(n = parse_and_or(lx))) return NULL;
+        *tail = n;
+        tail = &n->next;
+        if (lx->tok == T_AMP) {
+            if (n->type != N_PIPELINE) {
+                lex_error(lx, "syntax error: only a pipeline can run in the background", 0);
+                return NULL;
+            }
+            n->bg = 1;
+        } else if (lx->tok != T_SEMI && lx->tok != T_NEWLINE) {
+            break;
+        }
+        next(lx);
+    }
+    return failed(lx) ? NULL : head;
+}
+
+struct script *script_compile (const char *text, long line, struct script_error *err)
+{
+    struct script *s = calloc(1, sizeof *s);
+    struct lexer lx;
+
+    err->msg = NULL;
+    err->line = line;
+    err->incomplete = 0;
+    if (!s) {
+        err->msg = strerror(errno);
+        return NULL;
+    }
+    s->refs = 1;
+    memset(&lx, 0, sizeof lx);
+    lx.s = s;
+    lx.a = &s->arena;
+    lx.p = text;
+    lx.line = line;
+    lx.err = err;
+    lx.here_tail = &lx.here;
+    lx.out = arena_alloc(&s->arena, 2 * strlen(text) + 2);     // literal text of the words
+    lx.tok = T_NEWLINE;
+    next(&lx);
+    s->tree = parse_list(&lx);
+    if (!failed(&lx) && lx.tok != T_END) syntax_error(&lx);
+    if (failed(&lx)) {
+        script_release(s);
+        return NULL;
+    }
+    return s;
+}
+
+void script_release (struct script *s)
+{
+    if (--s->refs > 0) return;
+    arena_free(&s->arena);
+    free(s);
+}
+
+/* ============ Expansion ================================================================== */
+static int run_list (struct node *n);
+
+struct fields {
+    char **v;               // finished fields, in the run arena
+    int n, max;
+    int open;               // a field is being collected (maybe still empty)
+    int join;               // one string: no field splitting, "$@" joined with spaces
+};
+
+static char *fbuf;          // text of the open field, kept between commands
+static size_t flen, fsize;
+
+static void field_add (const char *s, size_t n)
+{
+    if (flen + n > fsize) {
+        fsize = flen + n > 2 * fsize ? flen + n : 2 * fsize;
+        if (!(fbuf = realloc(fbuf, fsize))) {
+            perror("bsh");
+            exit(1);
+        }
+    }
+    memcpy(fbuf + flen, s, n);
+    flen += n;
+}
+
+// add a finished field
+static void field_push (struct fields *f, char *s)
+{
+    char **v;
+    if (f->n + 2 > f->max) {                    // room for the field and the final NULL
+        f->max = f->max ? 2 * f->max : 8;
+        v = arena_alloc(&run, f->max * sizeof *v);
+        if (f->n) memcpy(v, f->v, f->n * sizeof *v);
+        f->v = v;
+    }
+    f->v[f->n++] = s;
+}
+
+static void field_end (struct fields *f)
+{
+    if (!f->open || f->join) return;
+    field_push(f, arena_strndup(&run, fbuf ? fbuf : "", flen));
+    flen = 0;
+    f->open = 0;
+}
+
+// add the value of an expansion, split into fields at blanks unless it is quoted
+static void field_text (struct fields *f, const char *s, size_t n, int quoted)
+{
+    size_t i = 0, j;
+    if (quoted || f->join) {
+        field_add(s, n);
+        f->open = 1;
+        return;
+    }
+    while (i < n) {
+        if (s[i] == ' ' || s[i] == '\t' || s[i] == '\n') {
+            field_end(f);
+            i++;
+            continue;
+        }
+        for (j = i; j < n && s[j] != ' ' && s[j] != '\t' && s[j] != '\n'; j++);
+        field_add(s + i, j - i);
+        f->open = 1;
+        i = j;
+    }
+}
+
+// a forked child that goes on running commands: no job control in there
+static void subshell (void)
+{
+    if (getpid() == shell_pid) return;
+    shell_pid = getpid();
+    jobs_subshell();
+}
+
+// run a list with its output in a pipe; returns the output (malloc'd) without the trailing
+// newlines, NULL if there was none
+static char *run_subst (struct node *list, size_t *len)
+{
+    char *buf = NULL, *nb;
+    size_t size = 0, n = 0;
+    ssize_t r;
+    pid_t pid;
+    int p[2], st;
+
+    *len = 0;
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("bsh: pipe");
+        return NULL;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) < 0) {
+        perror("bsh: fork");
+        close(p[0]);
+        close(p[1]);
+        return NULL;
+    } else if (pid == 0) {
+        close(p[0]);
+        dup2(p[1], 1);
+        close(p[1]);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        subshell();
+        run_list(list);
+        fflush(stdout);
+        _exit(script_status);
+    }
+    close(p[1]);
+    while (1) {
+        if (size - n < SUBST_READ) {
+            if (!(nb = realloc(buf, size + SUBST_READ + size))) break;
+            buf = nb;
+            size += SUBST_READ + size;
+        }
+        if ((r = read(p[0], buf + n, size - n)) < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        n += r;
+    }
+    close(p[0]);
+    while (waitpid(pid, &st, 0) < 0 && errno == EINTR);
+    subst_status = exec_status(st);
+    while (n > 0 && buf[n - 1] == '\n') n--;
+    *len = n;
+    return buf;
+}
+
+// value of a single parameter, NULL if it is unset
+static const char *param_value (int param, char *buf, size_t len)
+{
+    if (param == PARAM_STATUS) snprintf(buf, len, "%d", script_status);
+    else if (param == PARAM_COUNT) snprintf(buf, len, "%d", args.argc);
+    else if (param == PARAM_PID) snprintf(buf, len, "%d", (int)main_pid);
+    else if (param == 0) return args.name;
+    else if (param <= args.argc) return args.argv[param];
+    else return NULL;
+    return buf;
+}
+
+// expand one word into fields
+static void expand_word (struct word *w, struct fields *f)
+{
+    struct part *pt;
+    const char *s;
+    char buf[24], *out;
+    size_t n;
+    int i;
+
+    if (w->text && !f->join) {                  // final already
+        field_push(f, w->text);
+        return;
+    }
+    for (pt = w->parts; pt; pt = pt->next) {
+        if (pt->type == P_TEXT) {
+            field_text(f, pt->text, strlen(pt->text), 1);
+        } else if (pt->type == P_PARAM && pt->param <= PARAM_ALL && pt->param >= PARAM_STAR) {
+            for (i = 1; i <= args.argc; i++) {
+                if (i > 1 && (f->join || (pt->quoted && pt->param == PARAM_STAR)))
+                    field_add(" ", 1);
+                else if (i > 1)
+                    field_end(f);
+                field_text(f, args.argv[i], strlen(args.argv[i]), pt->quoted);
+            }
+            if (pt->quoted && pt->param == PARAM_STAR) f->open = 1;
+        } else if (pt->type == P_SUBST) {
+            out = run_subst(pt->sub, &n);
+            field_text(f, out ? out : "", n, pt->quoted);
+            free(out);
+        } else {
+            s = pt->type == P_VAR ? pt->var->value : param_value(pt->param, buf, sizeof buf);
+            if (s) field_text(f, s, strlen(s), pt->quoted);
+            else if (pt->quoted) f->open = 1;   // "$unset" is an empty word
+        }
+    }
+    field_end(f);
+}
+
+// expand a word into one string (redirections, assignments)
+static char *expand_string (struct word *w)
+{
+    struct fields f = {NULL, 0, 0, 0, 1};
+    char *s;
+    if (w->text) return w->text;
+    expand_word(w, &f);
+    s = arena_strndup(&run, fbuf ? fbuf : "", flen);
+    flen = 0;
+    return s;
+}
+
+/* ============ Execution ================================================================== */
+// the command of a pipeline stage with its words expanded
+static struct command *build_command (struct simple *c)
+{
+    struct command *cmd = arena_alloc(&run, sizeof *cmd);
+    struct fields f = {NULL, 0, 0, 0, 0};
+    struct redir **rtail, *r;
+    struct redirect *cr;
+    struct word *w;
+
+    memset(cmd, 0, sizeof *cmd);
+    if (c->argv || !c->words) {
+        cmd->argv = c->argv;
+        cmd->argc = c->nwords;
+    } else {
+        for (w = c->words; w; w = w->next) expand_word(w, &f);
+        if (!f.v) {                             // every word expanded to nothing
+            field_push(&f, NULL);
+            f.n = 0;
+        }
+        f.v[f.n] = NULL;
+        cmd->argv = f.v;
+        cmd->argc = f.n;
+    }
+    if (!cmd->argv) {                           // bare redirections or assignments
+        cmd->argv = arena_alloc(&run, sizeof *cmd->argv);
+        cmd->argv[0] = NULL;
+    }
+    for (rtail = &cmd->redirs, cr = c->redirs; cr; cr = cr->next) {
+        r = arena_alloc(&run, sizeof *r);
+        r->type = cr->type;
+        r->fd = cr->fd;
+        r->file = expand_string(cr->file);
+        r->next = NULL;
+        *rtail = r;
+        rtail = &r->next;
+    }
+    return cmd;
+}
+
+static int run_pipeline (struct node *n)
+{
+    struct arena_mark m = arena_mark(&run);
+    struct pipeline *pl = arena_alloc(&run, sizeof *pl);
+    struct command **tail = &pl->cmds;
+    struct simple *c;
+    struct assign *as;
+    char **saved = NULL, *old;
+    int i, nsaved = 0, status;
+
+    subst_status = -1;
+    pl->ncmds = n->nstages;
+    pl->bg = n->bg;
+    for (c = n->stages; c; c = c->next) {
+        *tail = build_command(c);
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+
+    if (n->nstages == 1 && pl->cmds->argc == 0) {
+        // name=value alone sets shell variables
+        for (as = n->stages->assigns; as; as = as->next)
+            var_set(as->var, expand_string(as->value));
+        status = subst_status >= 0 ? subst_status : 0;
+        if (pl->cmds->redirs && job_run(pl) != 0) status = 1;
+    } else {
+        // name=value cmd: in the environment of cmd only
+        for (c = n->stages; c; c = c->next) {
+            for (as = c->assigns; as; as = as->next) nsaved++;
+        }
+        if (nsaved) saved = arena_alloc(&run, 2 * nsaved * sizeof *saved);
+        for (i = 0, c = n->stages; c; c = c->next) {
+            for (as = c->assigns; as; as = as->next, i += 2) {
+                old = getenv(as->var->name);
+                saved[i] = as->var->name;
+                saved[i + 1] = old ? arena_strndup(&run, old, strlen(old)) : NULL;
+                setenv(as->var->name, expand_string(as->value), 1);
+            }
+        }
+        status = job_run(pl);
+        for (i = 2 * nsaved - 2; i >= 0; i -= 2) {
+            if (saved[i + 1]) setenv(saved[i], saved[i + 1], 1);
+            else unsetenv(saved[i]);
+        }
+    }
+    if (status == 128 + SIGINT && shell_is_interactive) script_interrupted = 1;
+    arena_release(&run, m);
+    return status;
+}
+
+// after a part of a loop ran: whether the loop ends (break, return, ^C) or goes on
+static int loop_jump (void)
+{
+    if (script_interrupted) return 1;
+    if (flow.jump != J_BREAK && flow.jump != J_CONTINUE) return flow.jump != J_NONE;
+    if (--flow.count > 0) return 1;             // meant for an enclosing loop
+    if (flow.jump == J_BREAK) {
+        flow.jump = J_NONE;
+        return 1;
+    }
+    flow.jump = J_NONE;
+    return 0;
+}
+
+static int run_loop (struct node *n)
+{
+    int status = 0, cond;
+    flow.loops++;
+    while (1) {
+        cond = run_list(n->a);
+        if (loop_jump() || (cond == 0) != (n->type == N_WHILE)) break;
+        status = run_list(n->b);
+        if (loop_jump()) break;
+    }
+    flow.loops--;
+    return status;
+}
+
+static int run_for (struct node *n)
+{
+    struct arena_mark m = arena_mark(&run);
+    struct fields f = {NULL, 0, 0, 0, 0};
+    struct word *w;
+    int i, status = 0;
+
+    if (n->in) {
+        for (w = n->words; w; w = w->next) expand_word(w, &f);
+    } else {                                    // for name: the positional parameters
+        f.v = args.argv + 1;
+        f.n = args.argc;
+    }
+    flow.loops++;
+    for (i = 0; i < f.n; i++) {
+        var_set(n->var, f.v[i]);
+        status = run_list(n->b);
+        if (loop_jump()) break;
+    }
+    flow.loops--;
+    arena_release(&run, m);
+    return status;
+}
+
+// run one command of a list; sets $?
+static int run_node (struct node *n)
+{
+    int status = 0;
+    switch (n->type) {
+        case N_PIPELINE:
+            status = run_pipeline(n);
+            break;
+        case N_AND:
+        case N_OR:
+            status = run_node(n->a);
+            if (!flow.jump && !script_interrupted && (status == 0) == (n->type == N_AND))
+                status = run_node(n->b);
+            break;
+        case N_GROUP:
+            status = run_list(n->a);
+            break;
+        case N_IF:
+            status = run_list(n->a);
+            if (flow.jump || script_interrupted) break;
+            status = run_list(status == 0 ? n->b : n->c);
+            break;
+        case N_WHILE:
+        case N_UNTIL:
+            status = run_loop(n);
+            break;
+        case N_FOR:
+            status = run_for(n);
+            break;
+        case N_FUNCTION:
+            n->script->refs++;                  // the body lives in the text that defined it
+            if (n->var->fscript) script_release(n->var->fscript);
+            n->var->func = n->b;
+            n->var->fscript = n->script;
+            break;
+    }
+    if (n->negate) status = !status;
+    return script_status = status;
+}
+
+static int run_list (struct node *n)
+{
+    int status = 0;
+    for (; n && !flow.jump && !script_interrupted; n = n->next) status = run_node(n);
+    return status;
+}
+
+int script_run (struct script *s)
+{
+    if (flow.running++ == 0) script_interrupted = 0;
+    s->refs++;
+    run_list(s->tree);
+    if (script_interrupted) script_status = 128 + SIGINT;
+    script_release(s);
+    flow.running--;
+    return script_status;
+}
+
+/* ============ Functions and Files ======================================================== */
+// call the shell function argv[0] with the arguments as positional parameters
+static int call_function (char *argv[])
+{
+    struct var *v = var_lookup(argv[0], strlen(argv[0]));
+    char **saved_argv = args.argv;
+    int saved_argc = args.argc, loops = flow.loops, status;
+    struct script *s;
+
+    if (!v || !v->func) return BUILTIN_EXEC;
+    subshell();
+    s = v->fscript;
+    s->refs++;                                  // the function may be redefined while it runs
+    args.argv = argv;
+    for (args.argc = 0; argv[args.argc + 1]; args.argc++);
+    flow.loops = 0;                             // break does not reach the caller's loops
+    flow.depth++;
+    status = run_node(v->func);
+    flow.depth--;
+    flow.loops = loops;
+    if (flow.jump == J_RETURN) flow.jump = J_NONE;
+    args.argv = saved_argv;
+    args.argc = saved_argc;
+    script_release(s);
+    return status;
+}
+
+static const struct builtin function_builtin = {"function", call_function};
+
+// builtin_function hook: shell functions come before the builtins
+static const struct builtin *find_function (const char *name)
+{
+    struct var *v = var_lookup(name, strlen(name));
+    return v && v->func ? &function_builtin : NULL;
+}
+
+struct cached {             // a compiled file and the version of the file it was made from
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct script *s;
+    struct cached *next;
+};
+
+static struct cached *cache;
+
+// the compiled form of a file, compiled again only if the file changed; NULL with the
+// exit status in *status if it cannot be read (127) or has a syntax error (2)
+static struct script *script_load (const char *path, int *status)
+{
+    struct script_error err;
+    struct script *s;
+    struct cached *c;
+    struct stat st;
+    char *text;
+    ssize_t r;
+    size_t n = 0;
+    int fd;
+
+    *status = 127;
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "bsh: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    for (c = cache; c && strcmp(c->path, path) != 0; c = c->next);
+    if (c && c->dev == st.st_dev && c->ino == st.st_ino && c->size == st.st_size &&
+        c->mtime.tv_sec == st.st_mtim.tv_sec && c->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        close(fd);
+        c->s->refs++;
+        return c->s;
+    }
+
+    if (!(text = malloc(st.st_size + 1))) {
+        perror("bsh");
+        close(fd);
+        return NULL;
+    }
+    while (n < (size_t)st.st_size && (r = read(fd, text + n, st.st_size - n)) != 0) {
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) break;
+        n += r;
+    }
+    close(fd);
+    text[n] = '\0';
+    s = script_compile(text, 1, &err);
+    free(text);                                 // the script holds copies of the words
+    if (!s) {
+        fprintf(stderr, "bsh: %s: line %ld: %s\n", path, err.line, err.msg);
+        *status = 2;
+        return NULL;
+    }
+    if (!c) {
+        if (!(c = calloc(1, sizeof *c))) return s;
+        c->path = xstrdup(path, strlen(path));
+        c->next = cache;
+        cache = c;
+    } else {
+        script_release(c->s);
+    }
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->size = st.st_size;
+    c->mtime = st.st_mtim;
+    c->s = s;
+    s->refs++;                                  // one for the cache, one for the caller
+    return s;
+}
+
+int script_source (const char *path, char *argv[])
+{
+    char **saved_argv = args.argv;
+    int saved_argc = args.argc, status;
+    struct script *s;
+
+    if (!(s = script_load(path, &status))) return script_status = status;
+    if (argv) {
+        args.argv = argv;
+        for (args.argc = 0; argv[args.argc + 1]; args.argc++);
+    }
+    flow.depth++;
+    script_run(s);
+    flow.depth--;
+    if (flow.jump == J_RETURN) flow.jump = J_NONE;
+    args.argv = saved_argv;
+    args.argc = saved_argc;
+    script_release(s);
+    return script_status;
+}
+
+/* ============ Builtins =================================================================== */
+// . file [arg ...], source file [arg ...]
+static int b_source (char *argv[])
+{
+    if (!argv[1]) {
+        fprintf(stderr, "%s: filename argument required\n", argv[0]);
+        return 2;
+    }
+    subshell();
+    return script_source(argv[1], argv[2] ? argv + 1 : NULL);
+}
+
+// break [n], continue [n]: leave the nth enclosing loop, or go on with its next round
+static int b_break (char *argv[])
+{
+    int n = argv[1] ? atoi(argv[1]) : 1;
+    if (flow.loops == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+        return 0;
+    }
+    if (n < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+        return 1;
+    }
+    flow.jump = argv[0][0] == 'b' ? J_BREAK : J_CONTINUE;
+    flow.count = n < flow.loops ? n : flow.loops;
+    return 0;
+}
+
+// return [n]: leave the function or sourced file
+static int b_return (char *argv[])
+{
+    if (flow.depth == 0) {
+        fprintf(stderr, "return: can only `return' from a function or sourced script\n");
+        return 1;
+    }
+    flow.jump = J_RETURN;
+    return argv[1] ? atoi(argv[1]) : script_status;
+}
+
+// shift [n]: drop the first n positional parameters
+static int b_shift (char *argv[])
+{
+    int n = argv[1] ? atoi(argv[1]) : 1;
+    if (n < 0 || n > args.argc) {
+        fprintf(stderr, "shift: %s: shift count out of range\n", argv[1] ? argv[1] : "1");
+        return 1;
+    }
+    args.argv += n;                             // argv[0] is never used
+    args.argc -= n;
+    return 0;
+}
+
+// export name[=value] ...: put variables in the environment of commands
+static int b_export (char *argv[])
+{
+    struct var *v;
+    char *eq;
+    size_t n;
+    int i, status = 0;
+
+    for (i = 1; argv[i]; i++) {
+        n = (eq = strchr(argv[i], '=')) ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!is_name(argv[i], n)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        v = var_get(argv[i], n);
+        v->exported = 1;
+        if (eq) var_set(v, eq + 1);
+        else if (v->value) setenv(v->name, v->value, 1);
+    }
+    return status;
+}
+
+// unset [-f] name ...: forget variables, or functions with -f
+static int b_unset (char *argv[])
+{
+    int i = 1, func = argv[1] && strcmp(argv[1], "-f") == 0;
+    struct var *v;
+    for (i += func; argv[i]; i++) {
+        if (!(v = var_lookup(argv[i], strlen(argv[i])))) continue;
+        if (func && v->func) {
+            script_release(v->fscript);
+            v->func = NULL;
+            v->fscript = NULL;
+        } else if (!func) {
+            var_set(v, NULL);
+            v->exported = 0;
+        }
+    }
+    return 0;
+}
+
+// one line of stdin, without reading past it so that the rest stays for the next command;
+// NULL at the end of input
+static char *read_input_line (size_t *len)
+{
+    static char *buf;
+    static size_t size;
+    char chunk[READ_CHUNK], *nl;
+    off_t pos = lseek(STDIN_FILENO, 0, SEEK_CUR);   // seekable: read ahead, then go back
+    ssize_t r, want;
+    int eol = 0;
+
+    *len = 0;
+    while (!eol) {
+        want = pos >= 0 ? READ_CHUNK : 1;
+        if ((r = read(STDIN_FILENO, chunk, want)) < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if ((nl = memchr(chunk, '\n', r)) != NULL) {
+            eol = 1;
+            if (pos >= 0) lseek(STDIN_FILENO, pos + *len + (nl - chunk) + 1, SEEK_SET);
+            r = nl - chunk;
+        }
+        if (*len + r + 1 > size) {
+            size = 2 * (*len + r + 1);
+            if (!(buf = realloc(buf, size))) {
+                perror("read");
+                exit(1);
+            }
+        }
+        memcpy(buf + *len, chunk, r);
+        *len += r;
+    }
+    if (!eol && *len == 0) return NULL;
+    buf[*len] = '\0';
+    return buf;
+}
+
+// read [-r] [name ...]: split a line of stdin over the variables, the last one gets the
+// rest of the line (default REPLY); 1 at the end of input
+static int b_read (char *argv[])
+{
+    int i = 1, last;
+    char *line, *p, *end;
+    size_t len;
+
+    if (argv[1] && strcmp(argv[1], "-r") == 0) i++;     // backslashes are never special
+    if (!(line = read_input_line(&len))) return 1;
+    if (!argv[i]) {
+        var_set(var_get("REPLY", 5), line);
+        return 0;
+    }
+    for (p = line; argv[i]; i++) {
+        if (!is_name(argv[i], strlen(argv[i]))) {
+            fprintf(stderr, "read: `%s': not a valid identifier\n", argv[i]);
+            return 1;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        last = !argv[i + 1];
+        end = last ? line + len : p + strcspn(p, " \t");
+        while (last && end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (*end) *end++ = '\0';
+        var_set(var_get(argv[i], strlen(argv[i])), p);
+        p = end;
+    }
+    return 0;
+}
+
+static const struct builtin script_builtins[] = {
+    {".", b_source},
+    {"break", b_break},
+    {"continue", b_break},
+    {"export", b_export},
+    {"read", b_read},
+    {"return", b_return},
+    {"shift", b_shift},
+    {"source", b_source},
+    {"unset", b_unset},
+};
+
+void script_init (char *name, char *argv[])
+{
+    static char *none[] = {NULL, NULL};
+    args.name = name;
+    args.argv = argv ? argv : none;
+    for (args.argc = 0; args.argv[args.argc + 1]; args.argc++);
+    shell_pid = main_pid = getpid();
+    builtin_function = find_function;
+    builtin_register(script_builtins, sizeof script_builtins / sizeof *script_builtins);
+}
@@ -0,0 +1,36 @@
+/* Shell language for bsh: variables, $(...), && || ;, if/while/until/for and functions */
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <signal.h>
+
+struct script;              // compiled text, shared by everything that runs it
+
+struct script_error {
+    const char *msg;        // description of the problem
+    long line;              // line it was found on
+    int incomplete;         // the text ended inside a command: more lines may complete it
+};
+
+extern int script_status;   // exit status of the last command ($?)
+extern volatile sig_atomic_t script_interrupted;    // set on ^C: loops stop
+
+// set $0 and the positional parameters argv[1..] (NULL: none), and register the builtins of
+// the language
+void script_init (char *name, char *argv[]);
+
+// compile text whose first line is line; NULL on a syntax error described in *err
+struct script *script_compile (const char *text, long line, struct script_error *err);
+
+// run compiled text; returns its exit status
+int script_run (struct script *s);
+
+// drop a compiled text, which stays alive as long as one of its functions is defined
+void script_release (struct script *s);
+
+// run a file with . or bsh file: it is compiled once and again only when it changed;
+// argv (if not NULL) replaces the positional parameters while it runs
+int script_source (const char *path, char *argv[]);
+
+#endif // SCRIPT_H
@@ -0,0 +1,29 @@
+#!/bin/sh
+#   bench_builtin.sh: Commands a second of bsh, each command run as the builtin and as the
+#	external program: a script of N lines of one command, timed from start to exit.
+#	usage: bench_builtin.sh [N]
+
+BSH=${BSH:-../bsh}
+N=${1:-2000}
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+# commands a second of N lines of $1
+rate() {
+	i=0
+	while [ $i -lt $N ]; do
+		echo "$1"
+		i=$((i + 1))
+	done > "$SCRIPT"
+	t0=$(date +%s%N)
+	"$BSH" "$SCRIPT" > /dev/null || exit 1
+	t1=$(date +%s%N)
+	echo $((N * 1000000000 / (t1 - t0)))
+}
+
+printf "%-24s %12s %12s %8s\n" command builtin external ratio
+for cmd in true "echo hello" pwd "cat /etc/passwd" "kill -0 \$\$"; do
+	b=$(rate "$cmd")
+	e=$(rate "/bin/$cmd")
+	printf "%-24s %10s/s %10s/s %7sx\n" "$cmd" $b $e $((b / (e > 0 ? e : 1)))
+done
@@ -0,0 +1,64 @@
+/* Parser throughput: parse_line over a large set of command lines
+**
+** The lines are a mix of what bsh and the server read: simple commands, pipelines,
+** redirections, quotes and background jobs. Each line is parsed into the arena, which is
+** reset after it, as the shell does once a line has run.
+**
+** usage: bench_parse [lines]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../parse.h"
+
+static const char *samples[] = {
+    "ls -l",
+    "echo hello world",
+    "cat file.txt | grep -v '^#' | sort | uniq -c | sort -rn | head -20",
+    "gcc -O2 -Wall -o prog main.c util.c > build.log 2>&1",
+    "sort < input.txt >> sorted.txt",
+    "make -j8 all &",
+    "echo \"a quoted string with $HOME and spaces\" | tr a-z A-Z",
+    "find . -name '*.c' -newer makefile | xargs wc -l &> counts",
+    "cut -d: -f1 /etc/passwd | sort 3< /dev/null 2>&1",
+    "grep -rn TODO src include tests docs | wc -l",
+};
+
+#define NSAMPLES (sizeof samples / sizeof samples[0])
+
+int main (int argc, char *argv[])
+{
+    struct arena a = { NULL, NULL };
+    struct timespec t0, t1;
+    long n = argc > 1 ? atol(argv[1]) : 10000000, i, cmds = 0;
+    size_t bytes = 0;
+    const char *err;
+    struct pipeline *pl;
+    double s;
+
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n; i++) {
+        const char *line = samples[i % NSAMPLES];
+        if (!(pl = parse_line(&a, line, &err))) {
+            fprintf(stderr, "%s: %s\n", line, err ? err : "empty");
+            return 1;
+        }
+        cmds += pl->ncmds;
+        bytes += strlen(line);
+        arena_reset(&a);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    arena_free(&a);
+
+    s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("parse_line: %ld lines, %ld commands in %.3f s: %.0f lines/s, %.1f MB/s, "
+           "%.0f ns a line\n", n, cmds, s, n / s, bytes / s / 1e6, s * 1e9 / n);
+    return 0;
+} // main (int argc, char *argv[])
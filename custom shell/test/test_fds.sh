@@ -0,0 +1,48 @@
+#!/bin/sh
+#   test_fds.sh: bsh does not leak descriptors. A script runs N rounds of commands with
+#	redirections, here-strings, here-documents and pipes, external and builtin (those run in
+#	the shell itself), some of them failing to open their file, then 100 N rounds of builtins
+#	alone; the descriptors of the shell in /proc are the same before and after.
+#	usage: test_fds.sh [N]
+
+BSH=${BSH:-../bsh}
+N=${1:-200}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+cat > "$DIR/script" <<END
+ls /proc/\$\$/fd > $DIR/before
+for i in \$(seq $N); do
+    echo \$i > $DIR/out
+    echo \$i >> $DIR/out 2>&1
+    pwd 3> $DIR/out >&3
+    cd . < $DIR/out
+    > $DIR/out
+    echo x &> $DIR/out
+    cat <<< word > $DIR/out
+    cat <<EOT > $DIR/out
+a \$i
+EOT
+    cat < $DIR/out | tr a-z A-Z | wc -c > $DIR/out
+    echo \$i | cat 2> $DIR/out | true
+    echo \$i 2> $DIR/none/out
+    cat < $DIR/none
+    true 4>&1 5<&0 4>&-
+done
+for i in \$(seq $((100 * N))); do
+    echo \$i > $DIR/out 2>&1
+    pwd >> $DIR/out 3< $DIR/out
+    true <<< \$i
+    false 2> $DIR/none/out
+    > $DIR/out
+done
+ls /proc/\$\$/fd > $DIR/after
+END
+
+"$BSH" "$DIR/script" 2> /dev/null
+if ! cmp -s "$DIR/before" "$DIR/after"; then
+	echo "FAIL: the descriptors of bsh changed over $N rounds:"
+	diff "$DIR/before" "$DIR/after"
+	exit 1
+fi
+echo "fds: $(wc -l < "$DIR/before") descriptors before and after $((101 * N)) rounds"
@@ -0,0 +1,222 @@
+/*
+**  morse.h: International Morse code (ITU-R M.1677-1) for the morsedev driver and its user
+**	programs. The header builds in the kernel and in user space alike.
+**
+**	A message is a stream of time units, on (1) or off (0): a dot is one unit on, a dash three,
+**	followed by one unit off. Letters are separated by three units off and words by seven.
+**	The table below holds, for every ASCII character, its whole pattern of units including the
+**	gap after it, generated at compile time from the dots and dashes.
+**
+**	Letters written between '<' and '>' are sent as one prosign without the gaps between them,
+**	e.g. "<SOS>" or "<AR>". Characters without a code are sent as a word space.
+**
+**	The layout of the ring a process maps from the device is here too, with the function that
+**	puts a message in it.
+*/
+
+#ifndef MORSE_H
+#define MORSE_H
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#endif
+
+#define MORSE_MAX_UNITS 22		// longest pattern of a character in units (the digit 0)
+#define MORSE_WORD_GAP 4		// units off added by a space (the letter gap has the other 3)
+
+struct morse_code {
+	unsigned int units;			// pattern, the first unit in bit len - 1
+	unsigned char len;			// length in units, 0 if the character has no code
+};
+
+// PATTERN GENERATION =========================================================================
+// element i of the dots and dashes in s: "10" for a dot, "1110" for a dash, none past the end
+#define MORSE_EL(s, i)		((i) < sizeof(s) - 1 ? ((s)[i] == '-' ? 0xEu : 0x2u) : 0u)
+#define MORSE_ELEN(s, i)	((i) < sizeof(s) - 1 ? ((s)[i] == '-' ? 4 : 2) : 0)
+#define MORSE_STEP(acc, s, i)	(((acc) << MORSE_ELEN(s, i)) | MORSE_EL(s, i))
+
+// up to 8 elements, then the two more units off that end a letter
+#define MORSE(s) { \
+	MORSE_STEP(MORSE_STEP(MORSE_STEP(MORSE_STEP(MORSE_STEP(MORSE_STEP(MORSE_STEP(MORSE_STEP( \
+		0u, s, 0), s, 1), s, 2), s, 3), s, 4), s, 5), s, 6), s, 7) << 2, \
+	MORSE_ELEN(s, 0) + MORSE_ELEN(s, 1) + MORSE_ELEN(s, 2) + MORSE_ELEN(s, 3) + \
+	MORSE_ELEN(s, 4) + MORSE_ELEN(s, 5) + MORSE_ELEN(s, 6) + MORSE_ELEN(s, 7) + 2 }
+
+#define MORSE_LETTER(c, s)	[c] = MORSE(s), [c - 'A' + 'a'] = MORSE(s)
+
+static const struct morse_code morse_table[128] = {
+	MORSE_LETTER('A', ".-"),	MORSE_LETTER('B', "-..."),	MORSE_LETTER('C', "-.-."),
+	MORSE_LETTER('D', "-.."),	MORSE_LETTER('E', "."),		MORSE_LETTER('F', "..-."),
+	MORSE_LETTER('G', "--."),	MORSE_LETTER('H', "...."),	MORSE_LETTER('I', ".."),
+	MORSE_LETTER('J', ".---"),	MORSE_LETTER('K', "-.-"),	MORSE_LETTER('L', ".-.."),
+	MORSE_LETTER('M', "--"),	MORSE_LETTER('N', "-."),	MORSE_LETTER('O', "---"),
+	MORSE_LETTER('P', ".--."),	MORSE_LETTER('Q', "--.-"),	MORSE_LETTER('R', ".-."),
+	MORSE_LETTER('S', "..."),	MORSE_LETTER('T', "-"),		MORSE_LETTER('U', "..-"),
+	MORSE_LETTER('V', "...-"),	MORSE_LETTER('W', ".--"),	MORSE_LETTER('X', "-..-"),
+	MORSE_LETTER('Y', "-.--"),	MORSE_LETTER('Z', "--.."),
+	['0'] = MORSE("-----"),		['1'] = MORSE(".----"),		['2'] = MORSE("..---"),
+	['3'] = MORSE("...--"),		['4'] = MORSE("....-"),		['5'] = MORSE("....."),
+	['6'] = MORSE("-...."),		['7'] = MORSE("--..."),		['8'] = MORSE("---.."),
+	['9'] = MORSE("----."),
+	// punctuation of ITU-R M.1677-1
+	['.'] = MORSE(".-.-.-"),	[','] = MORSE("--..--"),	[':'] = MORSE("---..."),
+	['?'] = MORSE("..--.."),	['\''] = MORSE(".----."),	['-'] = MORSE("-....-"),
+	['/'] = MORSE("-..-."),		['('] = MORSE("-.--."),		[')'] = MORSE("-.--.-"),
+	['"'] = MORSE(".-..-."),	['='] = MORSE("-...-"),		['+'] = MORSE(".-.-."),
+	['@'] = MORSE(".--.-."),
+	// in common use, though not in the recommendation
+	['!'] = MORSE("-.-.--"),	['&'] = MORSE(".-..."),		[';'] = MORSE("-.-.-."),
+	['_'] = MORSE("..--.-"),	['$'] = MORSE("...-..-"),
+	[' '] = { 0, MORSE_WORD_GAP },
+};
+
+// ENCODER ====================================================================================
+// Encode msg[0..len) into the bitmap out after the pos units it already holds (the first unit
+// is bit 7 of out[0]); with out NULL only count. Stops before a character that would end past
+// unit max and sets *done (if not NULL) to the number of characters encoded. *prosign tells
+// whether the text before msg left a prosign open and is updated for the next call; NULL when
+// msg starts a message. Returns the position after the last unit.
+static inline size_t morse_encode(const char *msg, size_t len, unsigned char *out, size_t pos,
+                                  size_t max, size_t *done, int *prosign)
+{
+	const struct morse_code *c;
+	unsigned long long acc = 0;	// units not yet stored, the oldest in bit nacc - 1
+	unsigned int nacc = 0, units, n;
+	size_t i;
+	int inside = prosign ? *prosign : 0;	// inside <...>: no gaps between letters
+
+	if (out) {					// continue the last byte
+		out += pos / 8;
+		nacc = pos % 8;
+		acc = nacc ? *out >> (8 - nacc) : 0;
+	}
+	for (i = 0; i < len; i++) {
+		unsigned char ch = msg[i];
+		c = &morse_table[ch & 0x7f];
+		units = c->units;
+		n = c->len;
+		if (!n || ch > 0x7f || inside) {	// everything but a plain character
+			if (ch == '<' || (ch == '>' && inside)) {
+				units = 0;
+				n = ch == '<' ? 0 : 2;	// the letter gap left out after the last letter
+			} else if (!n || ch > 0x7f) {
+				units = 0;
+				n = MORSE_WORD_GAP;
+			} else if (units) {
+				units >>= 2;
+				n -= 2;
+			}
+		}
+		if (pos + n > max) break;
+		pos += n;
+		if (ch == '<' || ch == '>') inside = ch == '<';
+		if (!out) continue;
+
+		// store 4 bytes at a time: fewer than 32 units are pending, so a pattern fits
+		acc = acc << n | units;
+		nacc += n;
+		if (nacc >= 32) {
+			nacc -= 32;
+			out[0] = acc >> (nacc + 24);
+			out[1] = acc >> (nacc + 16);
+			out[2] = acc >> (nacc + 8);
+			out[3] = acc >> nacc;
+			out += 4;
+		}
+	}
+	for (; out && nacc >= 8; nacc -= 8) *out++ = acc >> (nacc - 8);
+	if (out && nacc) *out = acc << (8 - nacc);
+	if (done) *done = i;
+	if (prosign) *prosign = inside;
+	return pos;
+}
+
+// unit pos of a bitmap written by morse_encode(): 1 for on
+static inline int morse_unit(const unsigned char *bits, size_t pos)
+{
+	return (bits[pos / 8] >> (7 - pos % 8)) & 1;
+}
+
+// number of equal units from unit pos of a bitmap of len units, one state of the output
+static inline size_t morse_run(const unsigned char *bits, size_t pos, size_t len)
+{
+	int on = morse_unit(bits, pos);
+	size_t end = pos + 1;
+
+	while (end < len && morse_unit(bits, end) == on) end++;
+	return end - pos;
+}
+
+// DECODER ====================================================================================
+// A received character is a symbol: 1, then a bit for each element, 1 for a dash. The longest
+// character has 7 elements, so e.g. "-.-" is 0b1101 and a symbol of 0 stands for noise.
+#define MORSE_SYMBOLS 256
+
+// fill symbols[MORSE_SYMBOLS], all 0 before, with the character of every symbol in the table;
+// letters come out upper case
+static inline void morse_symbols(char *symbols)
+{
+	unsigned int ch, sym, run;
+	int i;
+
+	for (ch = 1; ch < 128; ch++) {
+		const struct morse_code *c = &morse_table[ch];
+		if (!c->units) continue;
+		sym = 1;
+		// the elements from the first unit down to the letter gap in the 2 lowest bits
+		for (i = c->len - 1; i >= 2; i--) {
+			if (!(c->units >> i & 1)) continue;
+			for (run = 0; i >= 2 && (c->units >> i & 1); i--) run++;
+			sym = sym << 1 | (run == 3);
+		}
+		if (sym < MORSE_SYMBOLS && !symbols[sym]) symbols[sym] = ch;
+	}
+}
+
+// SHARED RING ================================================================================
+// mmap() of a device, MAP_SHARED, gives this control page and after it, at offset data, a ring
+// of messages. Each is a record of its length in 2 bytes, low first, and its bytes. head and
+// tail count bytes and wrap around, head - tail are in use. The producer only moves head, past
+// a record it wrote, and the driver only tail, past a record it took.
+struct morse_ring {
+	__u32 head;					// end of the last record put
+	__u32 pad1[15];				// head and tail on cache lines of their own
+	__u32 tail;					// start of the first record the driver did not take
+	__u32 pad2[15];
+	__u32 size;					// bytes of the data, a power of 2
+	__u32 data;					// offset of the data in the mapping, one page
+};
+
+// tell the driver there are records in the ring
+#define MORSE_KICK _IO('M', 0)
+
+#ifndef __KERNEL__
+// Put msg[0..len) in the ring as one record; one producer at a time. Returns -1 if there is no
+// room, 1 if the driver had taken every record before this one and may be idle: kick it with
+// ioctl(fd, MORSE_KICK). Returns 0 if the driver will find the record by itself.
+static inline int morse_ring_put(struct morse_ring *r, unsigned char *data, const char *msg,
+                                 size_t len)
+{
+	__u32 head = r->head, start = head, mask = r->size - 1;
+	// the driver is done with the bytes before tail once it is seen
+	__u32 used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t i;
+
+	if (len > 0xffff || r->size - used < len + 2) return -1;
+	data[head++ & mask] = len;
+	data[head++ & mask] = len >> 8;
+	for (i = 0; i < len; i++) data[head++ & mask] = msg[i];
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	// head is stored before tail is read again, and the driver stores tail before it reads
+	// head: either it sees this record or this sees that it took everything before
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == start;
+}
+#endif
+
+#endif // MORSE_H
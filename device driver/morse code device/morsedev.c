@@ -1,35 +1,91 @@
 /*
 **  morsedev.c: Device driver for a morse code trasmitter device. The device uses a GPIO pin
-**	whose high and low signals represent the morse code transmission. Writing a character to
-**	the device stores sends that character in the device buffer. Reading from the device
-**  prints from the device buffer to user space and produces a morse code representation on
-**  the selected GPIO pin.
+**	whose high and low signals represent the morse code transmission. Every write to the
+**	device is one message, queued and sent in turn on the selected GPIO pin. Any number of
+**	processes may open the device and write to it. A write waits while the queue is full, or
+**	fails with EAGAIN if the device was opened with O_NONBLOCK. Reading from the device prints
+**	the message being sent, or the last one, to user space.
+**
+**	One module drives a device for each pin in the gpios parameter, /dev/morsedev0 for the
+**	first and so on. Each has its own queue and buffers. One timer serves them all: it fires
+**	when the next change of state of any device is due and sets every line in one operation.
+**
+**	The output parameter picks what the devices drive: "gpio" sets the pins (real ones or
+**	lines of gpio-mockup; the timer sets them in interrupt context, so lines that can sleep,
+**	like those of I2C or SPI expanders, are refused), "trace" needs no hardware and records
+**	every change of state in a ring that debugfs shows in /sys/kernel/debug/morsedev/morsedevN,
+**	one line of "time level lateness" each, in ns, the lateness measured from the timer's
+**	expiry.
+**
+**	poll() reports POLLOUT while the queue has room for a message of the whole capacity and
+**	POLLPRI when a message finished since the file last read from offset 0. fsync() waits
+**	until every queued message was sent.
+**
+**	A process can also queue messages without a system call each: mmap() of a device gives a
+**	ring of the size of the ring parameter (see struct morse_ring in morse.h). The device
+**	takes the next message from the ring whenever its queue is empty, until the ring is empty
+**	too; only a message put in an empty ring needs ioctl(MORSE_KICK) to wake it. poll()
+**	reports POLLWRBAND while the ring is empty and fsync() waits for it too.
+**
+**	A device can receive too: the inputs parameter gives it a pin whose edges are timestamped
+**	in an interrupt and decoded by a work item, which follows the speed of the sender. Output
+**	"loop" needs no pins and has every device receive what it sends. Reading from a device
+**	that receives returns the decoded text, with a new line where the signal pauses, instead
+**	of the message being sent, and poll() reports POLLIN while there is some.
+**
+**	The pins are driven by a high-resolution timer that fires once per change of state, at
+**	the speed of the wpm parameter. With farnsworth set to a lower speed the characters keep
+**	their speed and only the gaps between them are longer. Both can be changed in
+**	/sys/module/morsedev/parameters and apply from the next message.
 **
 **	compile module with 	$ make
-**	insert module with		$ insmod morsedev.ko
+**	insert module with		$ insmod morsedev.ko [gpios=(pin),(pin),...]
+**							  [output=gpio|trace|loop] [inputs=(pin),(pin),...]
+**							  [capacity=(longest message in bytes)]
+**							  [queue=(bytes of waiting messages)]
+**							  [ring=(bytes of the ring to map)]
 **	check log messages		$ cat /var/log/messages.log
-**	(major#) written to log file
-**	make node with 			$ mknod /dev/morsedev c (major#) 0
+**	device files			/dev/morsedev0, /dev/morsedev1, ... are made by udev
 **
 */
 
 // INCLUDES ===================================================================================
-#include <asm/uaccess.h>	// put_user, get_user
+#include <asm/uaccess.h>	// copy_to_user, copy_from_user
+#include <linux/cdev.h>
+#include <linux/debugfs.h>
+#include <linux/bitmap.h>
+#include <linux/device.h>	// class_create(), device_create()
 #include <linux/errno.h>	// error codes
 #include <linux/fs.h>		// file structures
 #include <linux/init.h>		// macros
-#include <linux/kernel.h>	// KERN_INFO and printk()
+#include <linux/interrupt.h>	// request_irq()
+#include <linux/jiffies.h>	// nsecs_to_jiffies()
+#include <linux/kernel.h>	// KERN_INFO, printk() and DIV_ROUND_UP
+#include <linux/kfifo.h>	// message queue
+#include <linux/log2.h>		// roundup_pow_of_two()
 #include <linux/module.h>	// required for modules
 #include <linux/moduleparam.h>
-#include <linux/slab.h>		// kmalloc()
+#include <linux/mm.h>		// kvmalloc(), kvfree()
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>		// kcalloc()
+#include <linux/spinlock.h>
 #include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>	// vmalloc_user(), remap_vmalloc_range()
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 // TIMER USE - specifically for this device file ==============================================
-#include <asm/gpio.h>
-//#include <linux/delay.h>
-#include <linux/jiffies.h>
+#include <linux/gpio.h>		// gpio_request_one(), gpio_to_desc()
+#include <linux/gpio/consumer.h>	// gpiod_set_array_value()
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>	// div_u64(), div64_u64()
 #include <linux/sched.h>
-#include <linux/timer.h>
+
+#include "morse.h"			// code table, encoder and decoder, shared with the user programs
 
 // MACROS & DEFINES ===========================================================================
 MODULE_LICENSE("GPL");
@@ -37,110 +93,843 @@ MODULE_AUTHOR("Ben Heng <benheng@bu.edu>");
 MODULE_DESCRIPTION("A driver written for a homework assignment");
 
 #define DEVICE_NAME "morsedev"	// Dev name as it appears in /proc/devices
-#define CAP1X 32
+#define CAP1X 32				// default capacity
+#define CAP_MAX 65535			// longest record of the queue
+#define QUEUE 1024				// default size of the queue
+#define RING 16384				// default size of the ring
+#define RING_MAX 16777216
 #define SUCCESS 0
-#define GPIO 25
-#define MAX_UNIT 600
-#define TDELAY 20
+#define GPIO 25					// pin of the only device if gpios is not given
+#define DEVS_MAX 64				// most devices of one module
+#define PULSE_MIN 64			// first size of the pulse bitmap in bytes
+#define WPM 6					// default speed, 200 ms per unit like 20 jiffies at HZ=100
+#define WPM_MAX 100
+#define TRACE_LEN 4096			// changes of state the trace output keeps
+#define EDGES 64				// edges waiting for the decoder, a power of 2
+#define FLUSH_UNITS 10			// units of silence that end a message, longer than a word gap
+
+struct morsedev;
+
+// what the devices drive: set up and release the pin of one, set the levels of all of them
+struct morse_output {
+	const char *name;
+	int (*setup)(struct morsedev *);
+	// levels and changed have a bit for each device; called from the timer, must not sleep
+	void (*set)(unsigned long *levels, const unsigned long *changed);
+	void (*teardown)(struct morsedev *);
+};
+
+// a change of state recorded by the trace output
+struct trace_event {
+	u64 ns;						// when it was made
+	s64 late_ns;				// how long after the timer expiry
+	int level;
+};
+
+// the last TRACE_LEN changes of state of a device
+struct morse_trace {
+	spinlock_t lock;			// taken in the timer callback
+	unsigned int head;			// next event to write
+	unsigned int count;			// events kept, at most TRACE_LEN
+	struct trace_event ev[TRACE_LEN];
+};
+
+// an edge on the input of a device
+struct morse_edge {
+	u64 ns;						// when it was seen
+	int level;					// after it
+};
+
+// everything one pin needs
+struct morsedev {
+	int index;					// N of /dev/morsedevN, its bit in the level bitmaps
+	unsigned int gpio;
+	char label[16];				// of the GPIO request
+	struct cdev cdev;
+	struct device *dev;			// NULL until /dev/morsedevN was made
+	struct morse_trace *trace;	// of the trace output
+	struct dentry *trace_file;	// in debugfs
+
+	char *dbuff;				// device buffer: the message being sent and a terminator
+	size_t dbuff_len;			// length of the message in the device buffer
+	struct mutex dbuff_lock;	// taken to replace the message and to read it
+
+	struct kfifo_rec_ptr_2 fifo;	// waiting messages, one record each
+	struct mutex fifo_lock;		// one writer at a time, the transmit work is the only reader
+	wait_queue_head_t fifo_wait;	// writers waiting for room in the queue
+	atomic_t unsent;			// messages queued or being sent
+	unsigned long sent;			// messages sent since the module was loaded
+	wait_queue_head_t sent_wait;	// waiting for the end of a message
+
+	struct morse_ring *ring;	// control page of the ring to map, NULL without
+	unsigned char *ring_data;	// after it
+	u32 ring_size;
+	u32 ring_tail;				// the driver's own: user space may change the one in the ring
+
+	unsigned char *pulse;		// one bit per time unit (see morse.h), grown with the message
+	size_t pulse_size;			// bytes allocated for the pulse bitmap
+	size_t pulse_len;			// number of time units
+	size_t pulse_pos;			// next time unit to put out
+	u64 unit_ns;				// length of a time unit within a character
+	u64 gap_ns;					// length of a time unit between characters
+	u64 next_ns;				// when the next change of state is due
+	u64 due_ns;					// when the last one was due
+	int tmrbusy;				// prevents writing the pulse array while it's still pulsing
+	int stopping;				// the module is being removed: start no more messages
+	struct work_struct transmit_work;
+
+	int rx;						// decodes what it receives, for read()
+	unsigned int rx_gpio;		// of the inputs parameter
+	struct gpio_desc *rx_desc;	// NULL without an input pin
+	int rx_irq;					// 0 without an input pin
+	DECLARE_KFIFO(edges, struct morse_edge, EDGES);	// from the interrupt to the decoder
+	atomic_t edges_lost;		// because the decoder fell behind
+	struct delayed_work decode_work;
+	struct mutex rx_lock;		// the decoder state and the text
+	u64 rx_ns;					// when the last edge was seen, 0 before the first
+	int rx_level;				// after it
+	u64 rx_unit_ns;				// time unit of the sender as measured so far
+	unsigned int sym;			// elements of the character being received (see morse.h)
+	struct kfifo text;			// decoded, waiting to be read
+	wait_queue_head_t rx_wait;	// readers waiting for text
+};
+
+// what one open file of a device keeps
+struct morsefile {
+	struct morsedev *md;
+	unsigned long seen;			// messages this file has seen end
+};
 
 // PROTOTYPES - normally in a header file =====================================================
 static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
 static ssize_t device_read(struct file *, char *, size_t, loff_t *);
 static ssize_t device_write(struct file *, const char *, size_t, loff_t *);
+static unsigned int device_poll(struct file *, poll_table *);
+static int device_fsync(struct file *, loff_t, loff_t, int);
+static int device_mmap(struct file *, struct vm_area_struct *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
 static int __init morsedev_init(void);
 module_init(morsedev_init);
 static void __exit morsedev_exit(void);
 module_exit(morsedev_exit);
 
 // GLOBAL VARIABLES ===========================================================================
-static int Major;				// Major number assigned to our device driver
-static int Device_Open = 0;		// is the device open? prevents multiple access to devices
-static char *dbuff;				// device buffer
-static char *dbuff_ptr;			// device buffer pointer
+static dev_t first;				// device number of /dev/morsedev0
+static struct class *morse_class;
+static struct morsedev *devs;	// one for each pin
+static int ndevs = 0;
+static const struct morse_output *out;	// the one chosen with the output parameter
+static struct gpio_desc **descs;	// of the gpio output, one for each device
+static unsigned long *levels;	// a bit for each device: the level of its pin
+static unsigned long *changed;	// a bit for each device: its level changed in this tick
+static struct hrtimer timer;	// for every device
+static u64 timer_ns = U64_MAX;	// when it expires, U64_MAX when it is not armed
+static DEFINE_SPINLOCK(timer_lock);	// taken to step the devices and to start one
+static struct dentry *debug_dir;	// morsedev in debugfs, for the trace output
+static char symbols[MORSE_SYMBOLS];	// character of every received symbol, 0 for none
+static unsigned gpios[DEVS_MAX] = { GPIO };
+static int ngpios = 0;
+module_param_array(gpios, uint, &ngpios, S_IRUGO);
+MODULE_PARM_DESC(gpios, "pins to send on, one device each (default 25)");
+static char *output = "gpio";
+module_param(output, charp, S_IRUGO);
+MODULE_PARM_DESC(output, "gpio to set the pins, trace to record their levels in debugfs, "
+	"loop to receive what is sent");
+static unsigned inputs[DEVS_MAX];
+static int ninputs = 0;
+module_param_array(inputs, uint, &ninputs, S_IRUGO);
+MODULE_PARM_DESC(inputs, "pins to receive on, the first for /dev/morsedev0 and so on");
 static unsigned capacity = CAP1X;
 module_param(capacity, uint, S_IRUGO);
-static char pulse[MAX_UNIT];	// each byte is one time unit
-static char *pulse_ptr;			// pointers are faster than [] referencing
-static int pulse_len = 0;		// number of time units
-static int pulse_pos;			// used to countdown timer position
-static struct timer_list timer;	// so I don't have to manually allocate memory
-static int tmrbusy = 0;			// prevents writing the pulse array while it's still pulsing
+MODULE_PARM_DESC(capacity, "longest message in bytes");
+static unsigned queue = QUEUE;
+module_param(queue, uint, S_IRUGO);
+MODULE_PARM_DESC(queue, "bytes of messages waiting to be sent, rounded up to a power of 2");
+static unsigned ring = RING;
+module_param(ring, uint, S_IRUGO);
+MODULE_PARM_DESC(ring, "bytes of the ring a process can map, rounded up to a power of 2, "
+	"0 for none");
+static unsigned wpm = WPM;
+module_param(wpm, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(wpm, "character speed in words (PARIS) per minute");
+static unsigned farnsworth = 0;
+module_param(farnsworth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(farnsworth, "overall speed with longer gaps in words per minute, 0 for wpm");
 
 static struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.llseek = default_llseek,	// back to the start of the message
 	.read = device_read,
 	.write = device_write,
 	.open = device_open,
-	.release = device_release
+	.release = device_release,
+	.poll = device_poll,
+	.fsync = device_fsync,
+	.mmap = device_mmap,
+	.unlocked_ioctl = device_ioctl
+};
+
+// RECEIVER ===================================================================================
+// an edge on the input of a device, from the interrupt or the timer
+static void rx_edge(struct morsedev *md, int level, u64 ns)
+{
+	struct morse_edge e = { ns, level };
+
+	if (!kfifo_put(&md->edges, e)) atomic_inc(&md->edges_lost);
+	mod_delayed_work(system_wq, &md->decode_work, 0);
+}
+
+// both edges of an input pin: only take the time, the decoder may sleep
+static irqreturn_t rx_irq(int irq, void *data)
+{
+	struct morsedev *md = data;
+	u64 now = ktime_get_ns();
+
+	rx_edge(md, gpiod_get_value(md->rx_desc), now);
+	return IRQ_HANDLED;
+}
+
+// put the character received in the text, with rx_lock held; when nobody reads the text the
+// newest characters are dropped
+static void rx_char(struct morsedev *md)
+{
+	char c = symbols[md->sym];
+
+	kfifo_put(&md->text, c ? c : '*');
+	md->sym = 1;
+}
+
+// Decode the edges seen so far. The length of a mark tells a dot from a dash and the length of
+// a space the end of a character or a word, both against the time unit measured from the marks
+// before: each mark moves it a quarter of the way to its own unit. The gaps are not measured,
+// so Farnsworth timing much slower than the character speed reads as extra word spaces.
+static void decode(struct work_struct *work)
+{
+	struct morsedev *md = container_of(to_delayed_work(work), struct morsedev, decode_work);
+	struct morse_edge e;
+	u64 d, unit, idle, now;
+	int dash;
+
+	mutex_lock(&md->rx_lock);
+	if (atomic_xchg(&md->edges_lost, 0)) md->sym = 0;	// the character is lost
+	while (kfifo_get(&md->edges, &e)) {
+		if (e.level == md->rx_level) continue;	// the other edge was lost
+		d = e.ns - md->rx_ns;
+		unit = md->rx_unit_ns;
+		if (!md->rx_ns) {
+			// the first edge: how long the level read at load lasted is not known
+		} else if (md->rx_level) {
+			// a mark ended: a dot is 1 unit, a dash 3
+			dash = d > 2 * unit;
+			md->rx_unit_ns = clamp_t(u64, (3 * unit + (dash ? div_u64(d, 3) : d)) >> 2,
+			                         1200000000ULL / WPM_MAX, 1200000000ULL);
+			md->sym = md->sym && md->sym < MORSE_SYMBOLS / 2 ? md->sym << 1 | dash : 0;
+		} else if (md->sym != 1) {
+			// a space ended: 1 unit within a character, 3 after it, 7 after a word
+			if (d > 2 * unit) rx_char(md);
+			if (d > 5 * unit) kfifo_put(&md->text, ' ');
+		}
+		md->rx_level = e.level;
+		md->rx_ns = e.ns;
+	}
+
+	// silence after a character ends the message, come back for it
+	if (!md->rx_level && md->rx_ns && md->sym != 1) {
+		idle = md->rx_ns + FLUSH_UNITS * md->rx_unit_ns;
+		now = ktime_get_ns();
+		if (now >= idle) {
+			rx_char(md);
+			kfifo_put(&md->text, '\n');
+		} else {
+			mod_delayed_work(system_wq, &md->decode_work, nsecs_to_jiffies(idle - now) + 1);
+		}
+	}
+	mutex_unlock(&md->rx_lock);
+	// an edge may have come in before the line above delayed the work
+	if (!kfifo_is_empty(&md->edges)) mod_delayed_work(system_wq, &md->decode_work, 0);
+	wake_up_interruptible(&md->rx_wait);
+}
+
+// read decoded text, waiting for some unless the file is O_NONBLOCK
+static ssize_t rx_read(struct morsedev *md, struct file *filp, char *buff, size_t len)
+{
+	unsigned int copied;
+	int ret;
+
+	if (mutex_lock_interruptible(&md->rx_lock)) return -ERESTARTSYS;
+	while (kfifo_is_empty(&md->text)) {
+		mutex_unlock(&md->rx_lock);
+		if (filp->f_flags & O_NONBLOCK) return -EAGAIN;
+		if (wait_event_interruptible(md->rx_wait, !kfifo_is_empty(&md->text)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&md->rx_lock)) return -ERESTARTSYS;
+	}
+	ret = kfifo_to_user(&md->text, buff, len, &copied);
+	mutex_unlock(&md->rx_lock);
+	return ret ? ret : copied;
+}
+
+// set up the receiver of a device, if the loop output or the inputs parameter gives it one
+static int rx_setup(struct morsedev *md)
+{
+	int ret;
+
+	if (md->index < ninputs) md->rx = 1;
+	if (!md->rx) return SUCCESS;
+	INIT_KFIFO(md->edges);
+	atomic_set(&md->edges_lost, 0);
+	INIT_DELAYED_WORK(&md->decode_work, decode);
+	mutex_init(&md->rx_lock);
+	init_waitqueue_head(&md->rx_wait);
+	// the speed sent at until the sender was measured
+	md->rx_unit_ns = div_u64(1200000000ULL, clamp_t(unsigned, wpm, 1, WPM_MAX));
+	md->sym = 1;
+	ret = kfifo_alloc(&md->text, queue, GFP_KERNEL);
+	if (ret) {
+		printk(KERN_INFO "Insufficient kernel memory for %u bytes of text\n", queue);
+		return ret;
+	}
+	if (md->index >= ninputs) return SUCCESS;
+
+	// Request the input pin and an interrupt on both of its edges
+	md->rx_gpio = inputs[md->index];
+	ret = gpio_request_one(md->rx_gpio, GPIOF_IN, md->label);
+	if (ret < 0) {
+		printk(KERN_INFO "GPIO %u request failed\n", md->rx_gpio);
+		goto free_text;
+	}
+	md->rx_desc = gpio_to_desc(md->rx_gpio);
+	if (gpiod_cansleep(md->rx_desc)) {
+		printk(KERN_INFO "GPIO %u can not be read in an interrupt\n", md->rx_gpio);
+		ret = -EINVAL;
+		goto free_gpio;
+	}
+	md->rx_level = gpiod_get_value(md->rx_desc);
+	ret = gpiod_to_irq(md->rx_desc);
+	if (ret < 0) goto free_gpio;
+	md->rx_irq = ret;
+	ret = request_irq(md->rx_irq, rx_irq, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+	                  md->label, md);
+	if (ret < 0) {
+		printk(KERN_INFO "IRQ %d of GPIO %u request failed\n", md->rx_irq, md->rx_gpio);
+		md->rx_irq = 0;
+		goto free_gpio;
+	}
+	printk(KERN_INFO "GPIO %u requested for input, IRQ %d\n", md->rx_gpio, md->rx_irq);
+	return SUCCESS;
+
+free_gpio:
+	gpio_free(md->rx_gpio);
+	md->rx_desc = NULL;
+free_text:
+	kfifo_free(&md->text);
+	return ret;
+}
+
+// release the receiver of a device whose output stopped changing
+static void rx_teardown(struct morsedev *md)
+{
+	if (!md->rx) return;
+	if (md->rx_irq) free_irq(md->rx_irq, md);	// waits for a running handler
+	cancel_delayed_work_sync(&md->decode_work);
+	if (md->rx_desc) gpio_free(md->rx_gpio);
+	kfifo_free(&md->text);
+}
+
+// OUTPUTS ====================================================================================
+// the pins are given by number, so their descriptors come from the legacy requests
+static int gpio_setup(struct morsedev *md)
+{
+	int ret = gpio_request_one(md->gpio, GPIOF_OUT_INIT_LOW, md->label);
+	if (ret < 0) {
+		printk(KERN_INFO "GPIO %u request failed\n", md->gpio);
+		return ret;
+	} else { printk(KERN_INFO "GPIO %u requested\n", md->gpio); }
+	descs[md->index] = gpio_to_desc(md->gpio);
+	// the timer sets the lines with timer_lock held, in hard interrupt context
+	if (gpiod_cansleep(descs[md->index])) {
+		printk(KERN_INFO "GPIO %u can not be set in an interrupt\n", md->gpio);
+		descs[md->index] = NULL;
+		gpio_free(md->gpio);
+		return -EINVAL;
+	}
+	return SUCCESS;
+}
+
+// one write for every line, those that did not change get their level again
+static void gpio_set(unsigned long *levels, const unsigned long *changed)
+{
+	gpiod_set_array_value(ndevs, descs, NULL, levels);
+}
+
+static void gpio_teardown(struct morsedev *md)
+{
+	gpiod_set_value(descs[md->index], 0);
+	gpio_free(md->gpio);
+	descs[md->index] = NULL;
+}
+
+// debugfs file of a device: the trace, oldest first
+static int trace_show(struct seq_file *m, void *v)
+{
+	struct morse_trace *tr = ((struct morsedev *)m->private)->trace;
+	struct trace_event *e;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&tr->lock, flags);
+	for (i = 0; i < tr->count; i++) {
+		e = &tr->ev[(tr->head - tr->count + i) % TRACE_LEN];
+		seq_printf(m, "%llu %d %lld\n", e->ns, e->level, e->late_ns);
+	}
+	spin_unlock_irqrestore(&tr->lock, flags);
+	return 0;
+}
+
+static int trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, trace_show, inode->i_private);
+}
+
+static const struct file_operations trace_fops = {
+	.owner = THIS_MODULE,
+	.open = trace_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+static int trace_setup(struct morsedev *md)
+{
+	md->trace = kvmalloc(sizeof *md->trace, GFP_KERNEL | __GFP_ZERO);
+	if (!md->trace) return -ENOMEM;
+	spin_lock_init(&md->trace->lock);
+	// without debugfs the device still works, there is only nothing to read
+	md->trace_file = debugfs_create_file(md->label, S_IRUSR, debug_dir, md, &trace_fops);
+	return SUCCESS;
+}
+
+static void trace_set(unsigned long *levels, const unsigned long *changed)
+{
+	struct morse_trace *tr;
+	struct trace_event *e;
+	unsigned long flags;
+	u64 now = ktime_get_ns();
+	int i;
+
+	for_each_set_bit(i, changed, ndevs) {
+		tr = devs[i].trace;
+		spin_lock_irqsave(&tr->lock, flags);
+		e = &tr->ev[tr->head++ % TRACE_LEN];
+		e->ns = now;
+		e->late_ns = now - devs[i].due_ns;
+		e->level = test_bit(i, levels);
+		if (tr->count < TRACE_LEN) tr->count++;
+		spin_unlock_irqrestore(&tr->lock, flags);
+	}
+}
+
+static void trace_teardown(struct morsedev *md)
+{
+	debugfs_remove(md->trace_file);
+	kvfree(md->trace);
+}
+
+// no pins: every device receives what it sends, as an input wired to its output would
+static int loop_setup(struct morsedev *md)
+{
+	md->rx = 1;
+	return SUCCESS;
+}
+
+static void loop_set(unsigned long *levels, const unsigned long *changed)
+{
+	u64 now = ktime_get_ns();
+	int i;
+
+	for_each_set_bit(i, changed, ndevs) rx_edge(&devs[i], test_bit(i, levels), now);
+}
+
+static void loop_teardown(struct morsedev *md)
+{
+}
+
+static const struct morse_output outputs[] = {
+	{ "gpio", gpio_setup, gpio_set, gpio_teardown },
+	{ "trace", trace_setup, trace_set, trace_teardown },
+	{ "loop", loop_setup, loop_set, loop_teardown },
 };
 
-void expire(unsigned long arg)
+// RING =======================================================================================
+// Take the next record off the ring into buff, the first max bytes of it. Returns its length,
+// 0 if there is none. Only the transmit work takes records. The ring is written by user space,
+// so a record that does not make sense drops everything put so far.
+static unsigned int ring_out(struct morsedev *md, char *buff, unsigned int max)
+{
+	u32 head, used, len, mask = md->ring_size - 1, tail = md->ring_tail, i;
+
+	// tail was stored before head is read, see morse_ring_put()
+	smp_mb();
+	head = smp_load_acquire(&md->ring->head);
+	// empty records are skipped
+	for (len = 0; len == 0; tail += 2) {
+		used = head - tail;
+		if (used == 0) break;
+		if (used < 2 || used > md->ring_size) goto drop;
+		len = md->ring_data[tail & mask] | md->ring_data[(tail + 1) & mask] << 8;
+		if (len + 2 > used) goto drop;
+	}
+	for (i = 0; i < len && i < max; i++) buff[i] = md->ring_data[(tail + i) & mask];
+	tail += len;
+	if (len) atomic_inc(&md->unsent);	// before the ring shows it taken, see device_fsync()
+	md->ring_tail = tail;
+	smp_store_release(&md->ring->tail, tail);
+	return i;
+
+drop:
+	printk(KERN_INFO "%s: ring corrupted, %u bytes dropped\n", md->label, used);
+	md->ring_tail = head;
+	smp_store_release(&md->ring->tail, head);
+	return 0;
+}
+
+// the driver took every record of the ring
+static int ring_empty(struct morsedev *md)
+{
+	return !md->ring || READ_ONCE(md->ring->head) == md->ring_tail;
+}
+
+// TIMER ======================================================================================
+// time units for the speed parameters, taken again for every message
+static void morse_timing(struct morsedev *md)
+{
+	u64 c = clamp_t(unsigned, wpm, 1, WPM_MAX), f = farnsworth;
+
+	if (f == 0 || f > c) f = c;
+	md->unit_ns = div_u64(1200000000ULL, c);	// 50 units per word
+	// ARRL Farnsworth timing: the delay added to a word of f wpm, spread over its 19 gap units
+	md->gap_ns = div_u64((600 * c - 372 * f) * 100000000ULL, 19 * c * f);
+}
+
+// put out the run of equal units of a device at pulse_pos, with timer_lock held
+static void morse_step(struct morsedev *md)
+{
+	size_t run;
+	int on = 0;
+
+	md->due_ns = md->next_ns;
+	if (md->pulse_pos < md->pulse_len) {
+		on = morse_unit(md->pulse, md->pulse_pos);
+		run = morse_run(md->pulse, md->pulse_pos, md->pulse_len);
+		md->pulse_pos += run;
+		// from when this change was due, so that the delays in handling it do not add up;
+		// off runs of 3 units and more are the gaps between characters and words
+		md->next_ns += run * (on || run < 3 ? md->unit_ns : md->gap_ns);
+	} else {
+		// done: the pulse bitmap is free again, the next message can be encoded
+		WRITE_ONCE(md->tmrbusy, 0);
+		schedule_work(&md->transmit_work);
+		WRITE_ONCE(md->sent, md->sent + 1);
+		atomic_dec(&md->unsent);
+		wake_up_interruptible(&md->sent_wait);
+	}
+	__assign_bit(md->index, levels, on);
+	__set_bit(md->index, changed);
+}
+
+// step every device whose change of state is due, set their levels at once and come back
+// for the next one due
+static enum hrtimer_restart expire(struct hrtimer *t)
+{
+	u64 now = ktime_get_ns(), next = U64_MAX;
+	struct morsedev *md;
+	int i;
+
+	spin_lock(&timer_lock);
+	bitmap_zero(changed, ndevs);
+	for (i = 0; i < ndevs; i++) {
+		md = &devs[i];
+		if (!md->tmrbusy) continue;
+		if (md->next_ns <= now) morse_step(md);
+		if (md->tmrbusy && md->next_ns < next) next = md->next_ns;
+	}
+
+	// operate LEDs
+	if (!bitmap_empty(changed, ndevs)) out->set(levels, changed);
+	timer_ns = next;
+	if (next != U64_MAX) hrtimer_start(t, ns_to_ktime(next), HRTIMER_MODE_ABS);
+	spin_unlock(&timer_lock);
+	return HRTIMER_NORESTART;
+}
+
+// start sending the message in the pulse bitmap of a device
+static void morse_start(struct morsedev *md)
+{
+	unsigned long flags;
+
+	morse_timing(md);
+	md->pulse_pos = 0;
+	spin_lock_irqsave(&timer_lock, flags);
+	// on the next multiple of the unit: devices at the same speed change state together
+	md->next_ns = div64_u64(ktime_get_ns() + md->unit_ns - 1, md->unit_ns) * md->unit_ns;
+	WRITE_ONCE(md->tmrbusy, 1);	// the timer is now active
+	// only ever earlier: the timer comes back for the devices already sending, but a later
+	// expiry would hold back the one due first. A callback waiting for the lock sets it anew.
+	if (md->next_ns < timer_ns) {
+		timer_ns = md->next_ns;
+		hrtimer_start(&timer, ns_to_ktime(timer_ns), HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+// make the pulse bitmap hold at least units time units, doubling its size as it grows; the
+// bitmap is not in use
+static int pulse_grow(struct morsedev *md, size_t units)
 {
-	unsigned long delay;
-	if (pulse_pos-- > 0) {	// morse code sequence
-		// operate LED
-		if (*(pulse_ptr++) == '1') { gpio_set_value(GPIO, 1); }
-		else { gpio_set_value(GPIO, 0); }
+	size_t size = md->pulse_size ? md->pulse_size : PULSE_MIN;
+	unsigned char *p;
 
-		// mod the timer if there is still work to be done
-		delay = jiffies + TDELAY;
-		mod_timer(&timer, delay);
+	if (DIV_ROUND_UP(units, 8) <= md->pulse_size) return SUCCESS;
+	while (size < DIV_ROUND_UP(units, 8)) size *= 2;
+	p = kvmalloc(size, GFP_KERNEL);
+	if (!p) return -ENOMEM;
+	kvfree(md->pulse);
+	md->pulse = p;
+	md->pulse_size = size;
+	return SUCCESS;
+}
 
-		// done
-		if (pulse_pos == 0) {
-			tmrbusy = 0;
-			del_timer(&timer);
+// Take the next message off the queue and start sending it, if the pin is idle. Runs as work
+// because encoding a long message and growing the bitmap do not belong in the timer callback.
+// The work and the timer hand the bitmap to each other: the work touches it only while
+// tmrbusy is clear, and the timer schedules the work again when it clears it.
+static void transmit(struct work_struct *work)
+{
+	struct morsedev *md = container_of(work, struct morsedev, transmit_work);
+	unsigned int len;
+	size_t units;
+
+	while (!READ_ONCE(md->stopping) && !READ_ONCE(md->tmrbusy)) {
+		mutex_lock(&md->dbuff_lock);
+		len = kfifo_out(&md->fifo, md->dbuff, capacity);
+		if (!len && md->ring) len = ring_out(md, md->dbuff, capacity);
+		if (len) {
+			md->dbuff_len = len;
+			md->dbuff[len] = '\0';
 		}
+		mutex_unlock(&md->dbuff_lock);
+		if (!len) return;
+		wake_up_interruptible(&md->fifo_wait);	// there is room in the queue or the ring now
+
+		// encode the message in a bitmap sized for it
+		units = morse_encode(md->dbuff, len, NULL, 0, SIZE_MAX, NULL, NULL);
+		if (pulse_grow(md, units) < 0) {
+			printk(KERN_INFO "Message of %u bytes dropped: no memory for its pulses\n", len);
+			atomic_dec(&md->unsent);
+			wake_up_interruptible(&md->sent_wait);
+			continue;
+		}
+		md->pulse_len = morse_encode(md->dbuff, len, md->pulse, 0, units, NULL, NULL);
+		morse_start(md);
 	}
 }
+
 // INIT_MODULE ================================================================================
-static int __init morsedev_init(void)
+// stop sending on the first n devices
+static void morsedev_stop(int n)
 {
-	// Try to register the device
-	Major = register_chrdev(0, DEVICE_NAME, &fops);
-	if (Major < 0) {
-		printk(KERN_INFO "Registering banner device failed with %d\n", Major);
-		return Major;
+	int i;
+
+	for (i = 0; i < n; i++) WRITE_ONCE(devs[i].stopping, 1);
+	for (i = 0; i < n; i++) cancel_work_sync(&devs[i].transmit_work);	// may start the timer
+	hrtimer_cancel(&timer);		// waits for a running callback, which may queue the work
+	for (i = 0; i < n; i++) cancel_work_sync(&devs[i].transmit_work);
+}
+
+// free what morsedev_setup() got for a device that was stopped
+static void morsedev_teardown(struct morsedev *md)
+{
+	if (md->dev) device_destroy(morse_class, md->cdev.dev);
+	cdev_del(&md->cdev);		// no new opens; open files keep the module loaded
+	rx_teardown(md);
+	out->teardown(md);
+	kfifo_free(&md->fifo);
+	vfree(md->ring);
+	kvfree(md->dbuff);
+	kvfree(md->pulse);
+}
+
+// set up the device of gpios[i] and make /dev/morsedevN for it
+static int morsedev_setup(struct morsedev *md, int i)
+{
+	int ret;
+
+	md->index = i;
+	md->gpio = gpios[i];
+	snprintf(md->label, sizeof md->label, DEVICE_NAME "%d", i);
+	mutex_init(&md->dbuff_lock);
+	mutex_init(&md->fifo_lock);
+	init_waitqueue_head(&md->fifo_wait);
+	init_waitqueue_head(&md->sent_wait);
+	atomic_set(&md->unsent, 0);
+	INIT_WORK(&md->transmit_work, transmit);
+
+	// the queue holds at least one message of the whole capacity and its length
+	ret = kfifo_alloc(&md->fifo, max(queue, capacity + 2), GFP_KERNEL);
+	if (ret) {
+		printk(KERN_INFO "Insufficient kernel memory for a queue of %u bytes\n", queue);
+		return ret;
 	}
 
-	// Allocate morsedev for the buffer
-	dbuff = kmalloc(CAP1X, GFP_KERNEL);
-	if (!dbuff) {
-		printk(KERN_INFO "Insufficient kernel memory (%d bytes required)\n", capacity);
-		return -ENOMEM;
+	// Allocate morsedev for the buffer, which may be too large for kmalloc
+	md->dbuff = kvmalloc(capacity + 1, GFP_KERNEL | __GFP_ZERO);
+	if (!md->dbuff) {
+		printk(KERN_INFO "Insufficient kernel memory (%u bytes required)\n", capacity + 1);
+		ret = -ENOMEM;
+		goto free_fifo;
 	}
-	memset(dbuff, 0, capacity);
 
-	// Initialize GPIO
-	if (gpio_request(GPIO, "Morse LED") < 0) {
-		printk(KERN_INFO "GPIO %d request failed\n", GPIO);
-		return -1;
-	} else { printk(KERN_INFO "GPIO %d requested\n", GPIO); }
-	gpio_direction_output(GPIO, 1);	// make sure it turns on
+	// Allocate the ring, zeroed: it is given to user space
+	if (ring) {
+		md->ring_size = roundup_pow_of_two(ring);
+		md->ring = vmalloc_user(PAGE_SIZE + md->ring_size);
+		if (!md->ring) {
+			printk(KERN_INFO "Insufficient kernel memory for a ring of %u bytes\n", ring);
+			ret = -ENOMEM;
+			goto free_dbuff;
+		}
+		md->ring->size = md->ring_size;
+		md->ring->data = PAGE_SIZE;
+		md->ring_data = (unsigned char *)md->ring + PAGE_SIZE;
+	}
+
+	// Initialize the output
+	ret = out->setup(md);
+	if (ret < 0) goto free_ring;
+	ret = rx_setup(md);
+	if (ret < 0) goto free_output;
+
+	// Try to register the device, last: it can be opened right away
+	cdev_init(&md->cdev, &fops);
+	md->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&md->cdev, first + i, 1);
+	if (ret < 0) {
+		printk(KERN_INFO "Adding %s%d failed with %d\n", DEVICE_NAME, i, ret);
+		goto free_rx;
+	}
+	md->dev = device_create(morse_class, NULL, first + i, NULL, DEVICE_NAME "%d", i);
+	if (IS_ERR(md->dev)) {
+		ret = PTR_ERR(md->dev);
+		md->dev = NULL;
+		cdev_del(&md->cdev);
+		goto free_rx;
+	}
+	return SUCCESS;
 
-	// Initialize timer
-	init_timer(&timer);
+free_rx:
+	rx_teardown(md);
+free_output:
+	out->teardown(md);
+free_ring:
+	vfree(md->ring);
+free_dbuff:
+	kvfree(md->dbuff);
+free_fifo:
+	kfifo_free(&md->fifo);
+	return ret;
+}
+
+static int __init morsedev_init(void)
+{
+	int ret, n = ngpios ? ngpios : 1;
+
+	if (capacity == 0 || capacity > CAP_MAX) {
+		printk(KERN_INFO "capacity must be between 1 and %d bytes\n", CAP_MAX);
+		return -EINVAL;
+	}
+	if (ring > RING_MAX) {
+		printk(KERN_INFO "ring must be at most %d bytes\n", RING_MAX);
+		return -EINVAL;
+	}
+	for (out = outputs; out < outputs + ARRAY_SIZE(outputs); out++) {
+		if (strcmp(out->name, output) == 0) break;
+	}
+	if (out == outputs + ARRAY_SIZE(outputs)) {
+		printk(KERN_INFO "output must be gpio, trace or loop, not %s\n", output);
+		return -EINVAL;
+	}
+	if (ninputs > n || (ninputs && out->setup == loop_setup)) {
+		printk(KERN_INFO "inputs must have at most a pin for each of gpios, none with loop\n");
+		return -EINVAL;
+	}
+	morse_symbols(symbols);
+	debug_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+
+	// Try to register the devices
+	ret = alloc_chrdev_region(&first, 0, n, DEVICE_NAME);
+	if (ret < 0) {
+		printk(KERN_INFO "Registering banner device failed with %d\n", ret);
+		goto remove_debug;
+	}
+	morse_class = class_create(THIS_MODULE, DEVICE_NAME);
+	if (IS_ERR(morse_class)) {
+		ret = PTR_ERR(morse_class);
+		goto unregister;
+	}
+	devs = kcalloc(n, sizeof *devs, GFP_KERNEL);
+	descs = kcalloc(n, sizeof *descs, GFP_KERNEL);
+	levels = kcalloc(BITS_TO_LONGS(n), sizeof *levels, GFP_KERNEL);
+	changed = kcalloc(BITS_TO_LONGS(n), sizeof *changed, GFP_KERNEL);
+	if (!devs || !descs || !levels || !changed) {
+		ret = -ENOMEM;
+		goto free_devs;
+	}
+	hrtimer_init(&timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	timer.function = expire;
+	for (ndevs = 0; ndevs < n; ndevs++) {
+		ret = morsedev_setup(&devs[ndevs], ndevs);
+		if (ret < 0) goto teardown;
+	}
 
 	// Print to log file for debugging
 	printk(KERN_INFO "Inserted %s module.\n", DEVICE_NAME);
-	printk(KERN_INFO "Assigned major #: %d\n", Major);
-	printk(KERN_INFO "To talk to the driver create a device file with:\n");
-	printk(KERN_INFO "    'mknod /dev/%s c %d 0'.\n", DEVICE_NAME, Major);
-	printk(KERN_INFO "Try various minor numbers other than '0'.\n");
-	printk(KERN_INFO "You can undo mknod with 'unlink'.\n");
+	printk(KERN_INFO "Assigned major #: %d, /dev/%s0 to /dev/%s%d, output %s\n",
+		MAJOR(first), DEVICE_NAME, DEVICE_NAME, n - 1, out->name);
 
 	return SUCCESS;
+
+teardown:
+	morsedev_stop(ndevs);
+	while (ndevs > 0) morsedev_teardown(&devs[--ndevs]);
+free_devs:
+	kfree(changed);
+	kfree(levels);
+	kfree(descs);
+	kfree(devs);
+	class_destroy(morse_class);
+unregister:
+	unregister_chrdev_region(first, n);
+remove_debug:
+	debugfs_remove_recursive(debug_dir);
+	return ret;
 }
 
 // CLEANUP_MODULE =============================================================================
 static void __exit morsedev_exit(void)
 {
-	// unregister the device and free memory if necessary
-	unregister_chrdev(Major, DEVICE_NAME);
-	if (dbuff) { kfree(dbuff); }
-	gpio_set_value(GPIO, 0);
-	gpio_free(GPIO);
-	if (tmrbusy) del_timer(&timer); // if the timer isn't busy, it has already been deleted
+	int n = ndevs;
+
+	// unregister the devices and free memory if necessary
+	morsedev_stop(ndevs);
+	while (ndevs > 0) morsedev_teardown(&devs[--ndevs]);
+	kfree(changed);
+	kfree(levels);
+	kfree(descs);
+	kfree(devs);
+	class_destroy(morse_class);
+	unregister_chrdev_region(first, n);
+	debugfs_remove_recursive(debug_dir);
 	printk(KERN_INFO "Removed %s\n", DEVICE_NAME);
 }
 
@@ -148,693 +937,154 @@ static void __exit morsedev_exit(void)
 // called when a process tries to open the device file: cat /dev/mycharfile
 static int device_open(struct inode *inode, struct file *file)
 {
-	if (Device_Open) {
-		printk(KERN_INFO "Open cancelled: %s is busy\n", DEVICE_NAME);
-		return -EBUSY;
-	}
-	Device_Open++;
-	gpio_set_value(GPIO, 0);	// reset (turn off)
-	if (!tmrbusy) pulse_ptr = pulse;	// reset pulse pointer to beginning of pulse array
-	dbuff_ptr = dbuff;			// reset device buffer pointer to beginning of device buffer
-	printk(KERN_INFO "Open called: pid: %d, com: %s\n", current->pid, current->comm);
+	struct morsefile *mf = kmalloc(sizeof *mf, GFP_KERNEL);
+
+	if (!mf) return -ENOMEM;
+	mf->md = container_of(inode->i_cdev, struct morsedev, cdev);
+	mf->seen = READ_ONCE(mf->md->sent);
+	file->private_data = mf;
+	printk(KERN_INFO "Open called: pid: %d, com: %s, dev: %s\n", current->pid, current->comm,
+		mf->md->label);
 	return SUCCESS;
 }
 
 // called when a process closes the device file.
 static int device_release(struct inode *inode, struct file *file)
 {
-	Device_Open--;
-	gpio_set_value(GPIO, 0);	// makes sure the GPIO is off when complete
+	kfree(file->private_data);
 	printk(KERN_INFO "Release called: pid: %d, com: %s\n", current->pid, current->comm);
 	return SUCCESS;
 }
 
-// called when a process, which already opened the dev file, attemps to read from it
+// called when a process, which already opened the dev file, attemps to read from it; a device
+// that receives returns the decoded text
 static ssize_t device_read(struct file *filp,	// see include/linux/fs.h
                            char *buff,			// user space buffer
                            size_t len,			// length of the buffer
-                           loff_t *off)			// offset (not used)
+                           loff_t *off)			// position in the message
 {
-	int bytes_read = 0;
+	struct morsefile *mf = filp->private_data;
+	struct morsedev *md = mf->md;
 
-	// check if the device buffer is empty
-	if (*dbuff_ptr == 0) {
+	if (md->rx) {
+		mf->seen = READ_ONCE(md->sent);
+		return rx_read(md, filp, buff, len);
+	}
+	if (mutex_lock_interruptible(&md->dbuff_lock)) return -ERESTARTSYS;
+	if (*off == 0) mf->seen = READ_ONCE(md->sent);	// see device_poll()
+	// check if the rest of the message is empty
+	if (*off >= md->dbuff_len) {
+		mutex_unlock(&md->dbuff_lock);
 		printk(KERN_INFO "Read called: buffer empty\n");
 		return 0;
 	}
-	// copy device buffer to user space buffer
-	while (*dbuff_ptr) {
-		// this module is run in kernel space, but it must copy to user space so "*" assignment
-		// won't work. we have to use put_user to copy data from kernel space to user space.
-		put_user(*(dbuff_ptr++), buff++);
-		bytes_read++;
+	// copy as much of the message as the user space buffer holds
+	if (len > md->dbuff_len - *off) len = md->dbuff_len - *off;
+	if (copy_to_user(buff, md->dbuff + *off, len)) {
+		mutex_unlock(&md->dbuff_lock);
+		return -EFAULT;
 	}
-	printk(KERN_INFO "Read called: pid: %d, com: %s, len: %d, str: %s\n",
-		current->pid, current->comm, len, dbuff);
-
-	// activate morse code sequence if timer is not busy
-	if (!tmrbusy) {
-		// start first pulse
-		tmrbusy = 1;	// the timer is now active
-		pulse_pos = pulse_len;
-		timer.expires = jiffies + TDELAY;
-		timer.function = expire;
-		add_timer(&timer);
-	}
-	else printk(KERN_INFO "LED is currently active. Wait for it to finish.\n");
+	*off += len;
+	mutex_unlock(&md->dbuff_lock);
+	printk(KERN_INFO "Read called: pid: %d, com: %s, len: %zu\n",
+		current->pid, current->comm, len);
 
 	// most read functions return the number of bytes put into the buffer
-	return bytes_read;
+	return len;
 }
 
 // called when a process writes to dev file: echo "hi" > /dev/hello
+// The write is queued as one message. What does not fit in the capacity is cut off and the
+// write returns less.
 static ssize_t device_write(struct file *filp, const char *buff, size_t len, loff_t *off)
 {
-	int i;
-	// don't write a new file if the timer is busy
-	if (tmrbusy) {
-		printk(KERN_INFO "LED is active, cannot write to device.\n");
-		return 0;
+	struct morsedev *md = ((struct morsefile *)filp->private_data)->md;
+	unsigned int copied;
+	int ret;
+
+	if (len == 0) return 0;
+	if (len > capacity) len = capacity;
+
+	// wait for room for the whole message
+	if (mutex_lock_interruptible(&md->fifo_lock)) return -ERESTARTSYS;
+	while (kfifo_avail(&md->fifo) < len) {
+		mutex_unlock(&md->fifo_lock);
+		if (filp->f_flags & O_NONBLOCK) return -EAGAIN;
+		if (wait_event_interruptible(md->fifo_wait, kfifo_avail(&md->fifo) >= len))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&md->fifo_lock)) return -ERESTARTSYS;
 	}
 
-	// copy user space buffer to device buffer
-	// also: assign morse code values to the pulse buffer
-	pulse_len = 0;	// reset pulse length
-	for (i = 0; i < len && i < (CAP1X - 1); i++) {
-		get_user(*(dbuff_ptr), buff++);
-		switch (*(dbuff_ptr++)) {
-			case 'a': goto caseA;
-			case 'b': goto caseB;
-			case 'c': goto caseC;
-			case 'd': goto caseD;
-			case 'e': goto caseE;
-			case 'f': goto caseF;
-			case 'g': goto caseG;
-			case 'h': goto caseH;
-			case 'i': goto caseI;
-			case 'j': goto caseJ;
-			case 'k': goto caseK;
-			case 'l': goto caseL;
-			case 'm': goto caseM;
-			case 'n': goto caseN;
-			case 'o': goto caseO;
-			case 'p': goto caseP;
-			case 'q': goto caseQ;
-			case 'r': goto caseR;
-			case 's': goto caseS;
-			case 't': goto caseT;
-			case 'u': goto caseU;
-			case 'v': goto caseV;
-			case 'w': goto caseW;
-			case 'x': goto caseX;
-			case 'y': goto caseY;
-			case 'z': goto caseZ;
-			case 'A': caseA:			// .-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 8;
-				break;
-			case 'B': caseB:			// -...
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'C': caseC:			// -.-.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case 'D': caseD:			// -..
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 10;
-				break;
-			case 'E': caseE:			// .
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 4;
-				break;
-			case 'F': caseF:			// ..-.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'G': caseG:			// --.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'H': caseH:			// ....
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 10;
-				break;
-			case 'I': caseI:			// ..
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 6;
-				break;
-			case 'J': caseJ:			// .---
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 16;
-				break;
-			case 'K': caseK:			// -.-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'L': caseL:			// .-..
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'M': caseM:			// --
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 10;
-				break;
-			case 'N': caseN:			// -.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 8;
-				break;
-			case 'O': caseO:			// ---
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case 'P': caseP:			// .--.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case 'Q': caseQ:			// --.-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 16;
-				break;
-			case 'R': caseR:			// .-.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 10;
-				break;
-			case 'S': caseS:			// ...
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 8;
-				break;
-			case 'T': caseT:			// -
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 6;
-				break;
-			case 'U': caseU:			// ..-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 10;
-				break;
-			case 'V': caseV:			// ...-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'W': caseW:			// .--
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case 'X': caseX:			// -..-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case 'Y': caseY:			// -.--
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 16;
-				break;
-			case 'Z': caseZ:			// --..
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case '0':					// -----
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 22;
-				break;
-			case '1':					// .----
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 20;
-				break;
-			case '2':					// ..---
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 18;
-				break;
-			case '3':					// ...--
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 16;
-				break;
-			case '4':					// ....-
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case '5':					// .....
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 12;
-				break;
-			case '6':					// -....
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 14;
-				break;
-			case '7':					// --...
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 16;
-				break;
-			case '8':					// ---..
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 18;
-				break;
-			case '9':					// ----.
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '1';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 20;
-				break;
-			default:					// (space)
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				*(pulse_ptr++) = '0';
-				pulse_len += 5;
-				break;
-		} // switch (*(dbuff_ptr++))
-	} // for (i = 0; i < len && i < (CAP1X - 1); i++)
-
-	// append string terminator '\0'
-	*(dbuff_ptr) = '\0';
-	printk(KERN_INFO "Write called: pid: %d, com: %s, len: %d, str: %s, plen: %d\n",
-		current->pid, current->comm, len, dbuff, pulse_len);
+	// copy user space buffer to the queue
+	atomic_inc(&md->unsent);		// before the work can take it
+	ret = kfifo_from_user(&md->fifo, buff, len, &copied);
+	if (ret) atomic_dec(&md->unsent);
+	mutex_unlock(&md->fifo_lock);
+	if (ret) return ret;
+	schedule_work(&md->transmit_work);	// starts sending if the pin is idle
+	printk(KERN_INFO "Write called: pid: %d, com: %s, len: %u\n",
+		current->pid, current->comm, copied);
 
 	// return the number of bytes written to the device buffer
-	return i;
-}
\ No newline at end of file
+	return copied;
+}
+
+// called by poll() and select(): writable while any write fits, POLLPRI when a message
+// ended since the file last read from the start, readable while there is decoded text,
+// POLLWRBAND while the ring is empty
+static unsigned int device_poll(struct file *filp, poll_table *wait)
+{
+	struct morsefile *mf = filp->private_data;
+	struct morsedev *md = mf->md;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &md->fifo_wait, wait);
+	poll_wait(filp, &md->sent_wait, wait);
+	// the test device_write() waits on, for the longest message it takes
+	if (kfifo_avail(&md->fifo) >= capacity) mask |= POLLOUT | POLLWRNORM;
+	if (md->ring && ring_empty(md)) mask |= POLLWRBAND;
+	if (READ_ONCE(md->sent) != mf->seen) mask |= POLLPRI;
+	if (md->rx) {
+		poll_wait(filp, &md->rx_wait, wait);
+		if (!kfifo_is_empty(&md->text)) mask |= POLLIN | POLLRDNORM;
+	}
+	return mask;
+}
+
+// called by fsync(): wait until every message queued or put in the ring so far was sent
+static int device_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct morsedev *md = ((struct morsefile *)filp->private_data)->md;
+
+	if (md->ring) schedule_work(&md->transmit_work);	// for a ring that was not kicked
+	if (wait_event_interruptible(md->sent_wait,
+	                             atomic_read(&md->unsent) == 0 && ring_empty(md)))
+		return -ERESTARTSYS;
+	return SUCCESS;
+}
+
+// called by mmap(): the control page of the ring and the data after it, shared only
+static int device_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct morsedev *md = ((struct morsefile *)filp->private_data)->md;
+
+	if (!md->ring) return -ENODEV;
+	// a private mapping would put the records in copies the driver never sees
+	if (!(vma->vm_flags & VM_SHARED)) return -EINVAL;
+	return remap_vmalloc_range(vma, md->ring, vma->vm_pgoff);
+}
+
+// called by ioctl(): MORSE_KICK after a message was put in an empty ring
+static long device_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct morsedev *md = ((struct morsefile *)filp->private_data)->md;
+
+	switch (cmd) {
+	case MORSE_KICK:
+		if (!md->ring) return -ENODEV;
+		schedule_work(&md->transmit_work);	// takes the records if the pin is idle
+		return SUCCESS;
+	default:
+		return -ENOTTY;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+**  bench_morse.c: The speed of the encoder of morse.h: a large random text encoded into a
+**	bitmap the way device_write() does it, then walked run by run with morse_run() the way
+**	the timer sends it.
+**	usage: bench_morse [characters]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../morse.h"
+
+#define ROUNDS 10
+
+static double seconds(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char alpha[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.,?/= ";
+	long n = argc > 1 ? atol(argv[1]) : 10000000, runs = 0;
+	struct timespec t0, t1;
+	unsigned char *bits;
+	size_t len = 0, pos, size;
+	char *msg;
+	double enc, run;
+	int round;
+	long i;
+
+	if (n <= 0) {
+		fprintf(stderr, "usage: %s [characters]\n", argv[0]);
+		return 1;
+	}
+	msg = malloc(n);
+	srand(1);
+	for (i = 0; i < n; i++) msg[i] = alpha[rand() % (sizeof alpha - 1)];
+	// a character is at most MORSE_MAX_UNITS units with its gap, a space fewer
+	size = (n * MORSE_MAX_UNITS + 7) / 8;
+	bits = malloc(size);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	// from unit 0 every byte is written, none read: no need to clear the bitmap
+	for (round = 0; round < ROUNDS; round++) {
+		len = morse_encode(msg, n, bits, 0, size * 8, NULL, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	enc = seconds(&t0, &t1) / ROUNDS;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (round = 0; round < ROUNDS; round++) {
+		for (pos = 0, runs = 0; pos < len; runs++) pos += morse_run(bits, pos, len);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	run = seconds(&t0, &t1) / ROUNDS;
+
+	printf("morse_encode: %ld characters, %zu units in %.3f ms: %.1f M characters/s, "
+	       "%.1f ns a character\n", n, len, enc * 1e3, n / enc / 1e6, enc * 1e9 / n);
+	printf("morse_run: %ld runs in %.3f ms: %.1f M runs/s, %.1f ns a run\n", runs, run * 1e3,
+	       runs / run / 1e6, run * 1e9 / runs);
+	free(bits);
+	free(msg);
+	return 0;
+}
@@ -0,0 +1,331 @@
+/*
+**  kstub.c: The kernel of kstub.h, simulated in one thread with a clock that only moves in
+**	ksim_step().
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "kstub.h"
+
+#define JIFFY_NS 4000000ULL		// HZ=250
+#define WORKS_MAX 256
+
+u64 ksim_now = 1000000000ULL;
+u64 ksim_jitter_ns;
+long ksim_timer_calls;
+long ksim_bulk_writes;
+unsigned long ksim_levels;
+int ksim_input;
+int ksim_cansleep;
+
+struct module __this_module;
+static struct task_struct task = { 1, "test" };
+struct task_struct *current = &task;
+struct workqueue_struct *system_wq;
+
+static struct hrtimer *armed;				// the timer, while it is queued
+static struct work_struct *queued[WORKS_MAX];	// work to run now, in order
+static int nqueued;
+static struct delayed_work *delayed[WORKS_MAX];	// every delayed work ever queued
+static int ndelayed;
+
+// KERNEL =====================================================================================
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n = 0;
+
+	if (getenv("KSTUB_VERBOSE")) {
+		va_start(ap, fmt);
+		n = vfprintf(stderr, fmt, ap);
+		va_end(ap);
+	}
+	return n;
+}
+
+void *kmalloc(size_t n, int flags) { return flags & __GFP_ZERO ? calloc(1, n) : malloc(n); }
+void *kcalloc(size_t n, size_t size, int flags) { return calloc(n, size); }
+void kfree(const void *p) { free((void *)p); }
+void *kvmalloc(size_t n, int flags) { return kmalloc(n, flags); }
+void kvfree(const void *p) { free((void *)p); }
+void *vmalloc_user(unsigned long n) { return calloc(1, n); }
+void vfree(const void *p) { free((void *)p); }
+
+unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+// TIME, TIMER & WORK =========================================================================
+u64 ktime_get_ns(void) { return ksim_now; }
+
+void hrtimer_init(struct hrtimer *t, int clock, int mode) { t->queued = 0; }
+
+void hrtimer_start(struct hrtimer *t, ktime_t when, int mode)
+{
+	t->expires = mode == HRTIMER_MODE_REL ? ksim_now + when : when;
+	t->queued = 1;
+	armed = t;
+}
+
+int hrtimer_cancel(struct hrtimer *t)
+{
+	int was = t->queued;
+
+	t->queued = 0;
+	if (armed == t) armed = NULL;
+	return was;
+}
+
+int schedule_work(struct work_struct *w)
+{
+	if (w->pending) return 0;
+	if (nqueued == WORKS_MAX) abort();
+	w->pending = 1;
+	queued[nqueued++] = w;
+	return 1;
+}
+
+static void unqueue(struct work_struct *w)
+{
+	int i;
+
+	for (i = 0; i < nqueued; i++) {
+		if (queued[i] != w) continue;
+		memmove(queued + i, queued + i + 1, (nqueued - i - 1) * sizeof *queued);
+		nqueued--;
+		break;
+	}
+}
+
+int cancel_work_sync(struct work_struct *w)
+{
+	int was = w->pending;
+
+	unqueue(w);
+	w->pending = 0;
+	return was;
+}
+
+int mod_delayed_work(struct workqueue_struct *q, struct delayed_work *d, unsigned long delay)
+{
+	int i;
+
+	for (i = 0; i < ndelayed && delayed[i] != d; i++);
+	if (i == ndelayed) {
+		if (ndelayed == WORKS_MAX) abort();
+		delayed[ndelayed++] = d;
+	}
+	d->work.pending = 1;
+	d->at = ksim_now + delay * JIFFY_NS;
+	return 1;
+}
+
+// forgets d, which may be freed next
+int cancel_delayed_work_sync(struct delayed_work *d)
+{
+	int i, was = d->work.pending;
+
+	for (i = 0; i < ndelayed; i++) {
+		if (delayed[i] != d) continue;
+		delayed[i] = delayed[--ndelayed];
+		break;
+	}
+	d->work.pending = 0;
+	return was;
+}
+
+unsigned long nsecs_to_jiffies(u64 ns) { return (ns + JIFFY_NS - 1) / JIFFY_NS; }
+
+void ksim_run_works(void)
+{
+	struct work_struct *w;
+
+	while (nqueued) {
+		w = queued[0];
+		unqueue(w);
+		w->pending = 0;			// cleared before it runs, so that it can queue itself again
+		w->func(w);
+	}
+}
+
+int ksim_step(void)
+{
+	struct delayed_work *d = NULL;
+	struct hrtimer *t;
+	u64 at = U64_MAX;
+	int i;
+
+	ksim_run_works();
+	for (i = 0; i < ndelayed; i++) {
+		if (delayed[i]->work.pending && delayed[i]->at < at) {
+			d = delayed[i];
+			at = d->at;
+		}
+	}
+	if (armed && (u64)armed->expires <= at) {
+		t = armed;
+		armed = NULL;
+		t->queued = 0;
+		at = t->expires + (ksim_jitter_ns ? (u64)rand() % ksim_jitter_ns : 0);
+		if (at > ksim_now) ksim_now = at;
+		ksim_timer_calls++;
+		if (t->function(t) == HRTIMER_RESTART) hrtimer_start(t, t->expires, HRTIMER_MODE_ABS);
+	} else if (d) {
+		if (at > ksim_now) ksim_now = at;
+		d->work.pending = 0;
+		d->work.func(&d->work);
+	} else {
+		return 0;
+	}
+	ksim_run_works();
+	return 1;
+}
+
+// KFIFO ======================================================================================
+// records of the queue: 2 bytes of length, low first, then the bytes
+unsigned int kfifo_avail(struct kfifo_rec_ptr_2 *f)
+{
+	unsigned int room = f->mask + 1 - (f->in - f->out);
+	return room <= 2 ? 0 : room - 2;
+}
+
+unsigned int kfifo_out(struct kfifo_rec_ptr_2 *f, void *buf, unsigned int n)
+{
+	unsigned int len, i;
+
+	if (f->in == f->out) return 0;
+	len = f->buf[f->out & f->mask] | f->buf[(f->out + 1) & f->mask] << 8;
+	for (i = 0; i < len && i < n; i++) ((char *)buf)[i] = f->buf[(f->out + 2 + i) & f->mask];
+	f->out += 2 + len;
+	return i;
+}
+
+int kfifo_from_user(struct kfifo_rec_ptr_2 *f, const void *buf, unsigned int n,
+                    unsigned int *copied)
+{
+	unsigned int i;
+
+	if (kfifo_avail(f) < n) n = kfifo_avail(f);
+	f->buf[f->in & f->mask] = n;
+	f->buf[(f->in + 1) & f->mask] = n >> 8;
+	for (i = 0; i < n; i++) f->buf[(f->in + 2 + i) & f->mask] = ((const char *)buf)[i];
+	f->in += 2 + n;
+	*copied = n;
+	return 0;
+}
+
+int kfifo_to_user(struct kfifo *f, void *buf, unsigned int n, unsigned int *copied)
+{
+	unsigned int i;
+
+	for (i = 0; i < n && f->in != f->out; i++) ((char *)buf)[i] = f->buf[f->out++ & f->mask];
+	*copied = i;
+	return 0;
+}
+
+// FILES & DEVICES ============================================================================
+void poll_wait(struct file *f, wait_queue_head_t *w, poll_table *p) {}
+loff_t default_llseek(struct file *f, loff_t off, int whence) { return off; }
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+	return 0;
+}
+
+int alloc_chrdev_region(dev_t *first, unsigned int base, unsigned int n, const char *name)
+{
+	*first = (dev_t)240 << 20;
+	return 0;
+}
+
+void unregister_chrdev_region(dev_t first, unsigned int n) {}
+void cdev_init(struct cdev *c, const struct file_operations *fops) {}
+
+int cdev_add(struct cdev *c, dev_t d, unsigned int n)
+{
+	c->dev = d;
+	return 0;
+}
+
+void cdev_del(struct cdev *c) {}
+
+static struct class the_class;
+static struct device the_device;
+struct class *class_create(struct module *m, const char *name) { return &the_class; }
+void class_destroy(struct class *c) {}
+
+struct device *device_create(struct class *c, struct device *parent, dev_t d, void *data,
+                             const char *fmt, ...)
+{
+	return &the_device;
+}
+
+void device_destroy(struct class *c, dev_t d) {}
+
+// DEBUGFS ====================================================================================
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent) { return NULL; }
+
+struct dentry *debugfs_create_file(const char *name, int mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops)
+{
+	return NULL;
+}
+
+void debugfs_remove(struct dentry *d) {}
+void debugfs_remove_recursive(struct dentry *d) {}
+int seq_printf(struct seq_file *m, const char *fmt, ...) { return 0; }
+
+int single_open(struct file *f, int (*show)(struct seq_file *, void *), void *data)
+{
+	return 0;
+}
+
+ssize_t seq_read(struct file *f, char *buf, size_t n, loff_t *off) { return 0; }
+loff_t seq_lseek(struct file *f, loff_t off, int whence) { return off; }
+int single_release(struct inode *i, struct file *f) { return 0; }
+
+// GPIO & INTERRUPTS ==========================================================================
+static struct gpio_desc descs[256];
+
+int gpio_request_one(unsigned int gpio, unsigned long flags, const char *label)
+{
+	return gpio < 256 ? 0 : -EINVAL;
+}
+
+void gpio_free(unsigned int gpio) {}
+
+struct gpio_desc *gpio_to_desc(unsigned int gpio)
+{
+	descs[gpio].gpio = gpio;
+	return &descs[gpio];
+}
+
+int gpiod_get_value(const struct gpio_desc *d) { return ksim_input; }
+void gpiod_set_value(struct gpio_desc *d, int value) {}
+
+int gpiod_set_array_value(unsigned int n, struct gpio_desc **descs, struct gpio_array *info,
+                          unsigned long *values)
+{
+	ksim_bulk_writes++;
+	ksim_levels = values[0];
+	return 0;
+}
+
+int gpiod_cansleep(const struct gpio_desc *d) { return ksim_cansleep; }
+int gpiod_to_irq(const struct gpio_desc *d) { return 100 + d->gpio; }
+
+int request_irq(unsigned int irq, irqreturn_t (*handler)(int, void *), unsigned long flags,
+                const char *name, void *data)
+{
+	return 0;
+}
+
+const void *free_irq(unsigned int irq, void *data) { return NULL; }
@@ -0,0 +1,309 @@
+/*
+**  kstub.h: The parts of the kernel API morsedev.c uses, enough to build the driver as a user
+**	program. The Makefile makes empty headers for the <linux/...> includes of the driver and
+**	puts this one in front of it.
+**
+**	Nothing runs by itself: time stands still until a test moves it with ksim_step(), which
+**	fires the timer or a delayed work item, whichever is due first, and then runs the work
+**	items queued so far. Locks do nothing, there is a single thread.
+*/
+
+#ifndef KSTUB_H
+#define KSTUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// TYPES & MACROS =============================================================================
+typedef unsigned long long u64;
+typedef long long s64;
+typedef unsigned int u32;
+typedef unsigned int __u32;
+typedef long long ktime_t;
+
+#define __init
+#define __exit
+#define KERN_INFO ""
+#define EFAULT 14
+#define EAGAIN 11
+#define ENOMEM 12
+#define ENODEV 19
+#define EINVAL 22
+#define ENOTTY 25
+#define ERESTARTSYS 512
+#define O_NONBLOCK 04000
+#define S_IRUSR 0400
+#define S_IWUSR 0200
+#define S_IRUGO 0444
+#define GFP_KERNEL 0
+#define __GFP_ZERO 1
+#define PAGE_SIZE 4096UL
+#define U64_MAX (~0ULL)
+
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_PARM_DESC(a, b)
+#define module_param(a, b, c)
+#define module_param_array(a, b, c, d)
+#define module_init(x)
+#define module_exit(x)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define clamp_t(t, v, lo, hi) \
+	((t)(v) < (t)(lo) ? (t)(lo) : (t)(v) > (t)(hi) ? (t)(hi) : (t)(v))
+#define container_of(p, t, m) ((t *)((char *)(p) - offsetof(t, m)))
+#define READ_ONCE(x) (x)
+#define WRITE_ONCE(x, v) ((x) = (v))
+#define IS_ERR(p) ((unsigned long)(p) > (unsigned long)-4096)
+#define PTR_ERR(p) ((long)(p))
+#define MAJOR(d) ((int)((d) >> 20))
+#define _IO(t, n) (((t) << 8) | (n))
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	unsigned long s = 1;
+	while (s < n) s <<= 1;
+	return s;
+}
+
+typedef struct { int counter; } atomic_t;
+#define atomic_set(a, v) ((a)->counter = (v))
+#define atomic_read(a) ((a)->counter)
+#define atomic_inc(a) ((a)->counter++)
+#define atomic_dec(a) ((a)->counter--)
+#define atomic_xchg(a, v) ({ int o_ = (a)->counter; (a)->counter = (v); o_; })
+
+// BITMAPS ====================================================================================
+#define BITS_PER_LONG (8 * (int)sizeof(long))
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+static inline int test_bit(int i, const unsigned long *b)
+{
+	return b[i / BITS_PER_LONG] >> (i % BITS_PER_LONG) & 1;
+}
+static inline void __set_bit(int i, unsigned long *b)
+{
+	b[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+}
+static inline void __assign_bit(int i, unsigned long *b, int v)
+{
+	if (v) b[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+	else b[i / BITS_PER_LONG] &= ~(1UL << (i % BITS_PER_LONG));
+}
+static inline void bitmap_zero(unsigned long *b, int n)
+{
+	memset(b, 0, BITS_TO_LONGS(n) * sizeof(long));
+}
+static inline int bitmap_empty(const unsigned long *b, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) if (test_bit(i, b)) return 0;
+	return 1;
+}
+#define for_each_set_bit(i, b, n) for ((i) = 0; (i) < (n); (i)++) if (test_bit(i, b))
+
+// MEMORY =====================================================================================
+void *kmalloc(size_t n, int flags);
+void *kcalloc(size_t n, size_t size, int flags);
+void kfree(const void *p);
+void *kvmalloc(size_t n, int flags);
+void kvfree(const void *p);
+void *vmalloc_user(unsigned long n);
+void vfree(const void *p);
+unsigned long copy_to_user(void *to, const void *from, unsigned long n);
+unsigned long copy_from_user(void *to, const void *from, unsigned long n);
+
+// LOCKS & WAITING ============================================================================
+typedef struct { int x; } spinlock_t;
+struct mutex { int x; };
+typedef struct { int x; } wait_queue_head_t;
+#define DEFINE_SPINLOCK(l) spinlock_t l
+#define spin_lock_init(l) ((void)(l))
+#define spin_lock(l) ((void)(l))
+#define spin_unlock(l) ((void)(l))
+#define spin_lock_irqsave(l, f) ((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f) ((void)(l), (void)(f))
+#define mutex_init(m) ((void)(m))
+#define mutex_lock(m) ((void)(m))
+#define mutex_unlock(m) ((void)(m))
+#define mutex_lock_interruptible(m) ((void)(m), 0)
+#define init_waitqueue_head(w) ((void)(w))
+#define wake_up_interruptible(w) ((void)(w))
+// nothing else runs while a test waits: a condition that is false stays false
+#define wait_event_interruptible(w, cond) ((cond) ? 0 : -ERESTARTSYS)
+
+// TIME, TIMER & WORK =========================================================================
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum { CLOCK_MONOTONIC = 1 };
+enum { HRTIMER_MODE_ABS = 0, HRTIMER_MODE_REL = 1 };
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *);
+	ktime_t expires;
+	int queued;
+};
+#define ns_to_ktime(n) ((ktime_t)(n))
+u64 ktime_get_ns(void);
+void hrtimer_init(struct hrtimer *t, int clock, int mode);
+void hrtimer_start(struct hrtimer *t, ktime_t when, int mode);
+int hrtimer_cancel(struct hrtimer *t);
+
+struct work_struct {
+	void (*func)(struct work_struct *);
+	int pending;
+};
+struct delayed_work {
+	struct work_struct work;
+	u64 at;						// when it runs, if work.pending
+};
+struct workqueue_struct;
+extern struct workqueue_struct *system_wq;
+#define INIT_WORK(w, f) ((w)->func = (f), (w)->pending = 0)
+#define INIT_DELAYED_WORK(d, f) INIT_WORK(&(d)->work, f)
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+int schedule_work(struct work_struct *w);
+int cancel_work_sync(struct work_struct *w);
+int mod_delayed_work(struct workqueue_struct *q, struct delayed_work *d, unsigned long delay);
+int cancel_delayed_work_sync(struct delayed_work *d);
+unsigned long nsecs_to_jiffies(u64 ns);
+
+// KFIFO ======================================================================================
+// the record fifo of the queue, the byte fifo of the decoded text and the typed one of the
+// edges share the fields the macros below use
+struct kfifo_rec_ptr_2 { unsigned char *buf; unsigned int in, out, mask; };
+struct kfifo { unsigned char *buf; unsigned int in, out, mask; };
+#define DECLARE_KFIFO(n, t, size) struct { t buf[size]; unsigned int in, out, mask; } n
+#define INIT_KFIFO(f) ((f).in = (f).out = 0, (f).mask = ARRAY_SIZE((f).buf) - 1)
+#define kfifo_alloc(f, size, gfp) ({ \
+	unsigned int s_ = roundup_pow_of_two(size); \
+	(f)->buf = calloc(s_, 1); (f)->mask = s_ - 1; (f)->in = (f)->out = 0; \
+	(f)->buf ? 0 : -ENOMEM; })
+#define kfifo_free(f) free((f)->buf)
+#define kfifo_is_empty(f) ((f)->in == (f)->out)
+#define kfifo_put(f, v) ({ \
+	int ok_ = (f)->in - (f)->out <= (f)->mask; \
+	if (ok_) (f)->buf[(f)->in++ & (f)->mask] = (v); \
+	ok_; })
+#define kfifo_get(f, p) ({ \
+	int ok_ = (f)->in != (f)->out; \
+	if (ok_) *(p) = (f)->buf[(f)->out++ & (f)->mask]; \
+	ok_; })
+unsigned int kfifo_avail(struct kfifo_rec_ptr_2 *f);
+unsigned int kfifo_out(struct kfifo_rec_ptr_2 *f, void *buf, unsigned int n);
+int kfifo_from_user(struct kfifo_rec_ptr_2 *f, const void *buf, unsigned int n,
+                    unsigned int *copied);
+int kfifo_to_user(struct kfifo *f, void *buf, unsigned int n, unsigned int *copied);
+
+// FILES & DEVICES ============================================================================
+struct module { int x; };
+extern struct module __this_module;
+#define THIS_MODULE (&__this_module)
+struct task_struct { int pid; char comm[16]; };
+extern struct task_struct *current;
+
+struct cdev { struct module *owner; dev_t dev; };
+struct inode { struct cdev *i_cdev; void *i_private; };
+struct file { unsigned int f_flags; void *private_data; };
+struct vm_area_struct { unsigned long vm_start, vm_end, vm_pgoff, vm_flags; };
+#define VM_SHARED 0x08
+struct poll_table_struct { int x; };
+typedef struct poll_table_struct poll_table;
+struct file_operations {
+	struct module *owner;
+	loff_t (*llseek)(struct file *, loff_t, int);
+	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+	unsigned int (*poll)(struct file *, poll_table *);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+	int (*fsync)(struct file *, loff_t, loff_t, int);
+};
+#define POLLIN 0x001
+#define POLLPRI 0x002
+#define POLLOUT 0x004
+#define POLLRDNORM 0x040
+#define POLLWRNORM 0x100
+#define POLLWRBAND 0x200
+void poll_wait(struct file *f, wait_queue_head_t *w, poll_table *p);
+loff_t default_llseek(struct file *f, loff_t off, int whence);
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff);
+
+struct class { int x; };
+struct device { int x; };
+int alloc_chrdev_region(dev_t *first, unsigned int base, unsigned int n, const char *name);
+void unregister_chrdev_region(dev_t first, unsigned int n);
+void cdev_init(struct cdev *c, const struct file_operations *fops);
+int cdev_add(struct cdev *c, dev_t d, unsigned int n);
+void cdev_del(struct cdev *c);
+struct class *class_create(struct module *m, const char *name);
+void class_destroy(struct class *c);
+struct device *device_create(struct class *c, struct device *parent, dev_t d, void *data,
+                             const char *fmt, ...);
+void device_destroy(struct class *c, dev_t d);
+
+// DEBUGFS ====================================================================================
+struct dentry { int x; };
+struct seq_file { void *private; };
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, int mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops);
+void debugfs_remove(struct dentry *d);
+void debugfs_remove_recursive(struct dentry *d);
+int seq_printf(struct seq_file *m, const char *fmt, ...);
+int single_open(struct file *f, int (*show)(struct seq_file *, void *), void *data);
+ssize_t seq_read(struct file *f, char *buf, size_t n, loff_t *off);
+loff_t seq_lseek(struct file *f, loff_t off, int whence);
+int single_release(struct inode *i, struct file *f);
+
+// GPIO & INTERRUPTS ==========================================================================
+struct gpio_desc { unsigned int gpio; };
+struct gpio_array { int x; };
+#define GPIOF_IN 1
+#define GPIOF_OUT_INIT_LOW 0
+int gpio_request_one(unsigned int gpio, unsigned long flags, const char *label);
+void gpio_free(unsigned int gpio);
+struct gpio_desc *gpio_to_desc(unsigned int gpio);
+int gpiod_get_value(const struct gpio_desc *d);
+void gpiod_set_value(struct gpio_desc *d, int value);
+int gpiod_set_array_value(unsigned int n, struct gpio_desc **descs, struct gpio_array *info,
+                          unsigned long *values);
+int gpiod_cansleep(const struct gpio_desc *d);
+int gpiod_to_irq(const struct gpio_desc *d);
+
+typedef int irqreturn_t;
+#define IRQ_HANDLED 1
+#define IRQF_TRIGGER_RISING 1
+#define IRQF_TRIGGER_FALLING 2
+int request_irq(unsigned int irq, irqreturn_t (*handler)(int, void *), unsigned long flags,
+                const char *name, void *data);
+const void *free_irq(unsigned int irq, void *data);
+
+// SIMULATION =================================================================================
+extern u64 ksim_now;				// the clock of ktime_get_ns()
+extern u64 ksim_jitter_ns;			// the timer fires up to this much late, at random
+extern long ksim_timer_calls;		// callbacks of the timer
+extern long ksim_bulk_writes;		// gpiod_set_array_value() calls
+extern unsigned long ksim_levels;	// the levels of the first lines at the last one
+extern int ksim_input;				// what gpiod_get_value() reads
+extern int ksim_cansleep;			// what gpiod_cansleep() returns
+
+// run the work items queued so far, and those they queue
+void ksim_run_works(void);
+// fire the timer or the delayed work due first and run the work it queues; 0 if none is due
+int ksim_step(void);
+
+#endif // KSTUB_H
@@ -0,0 +1,213 @@
+/*
+**  test_loop.c: The receiver of morsedev. With the loop output a device reads back what it
+**	sends: random text goes through the encoder, the timer and the decoder, with the timer
+**	late at random, and the error rate is the edit distance to what was sent. An input pin
+**	that is high when the module loads does not spoil the first character.
+*/
+
+#include <time.h>
+
+#include "../morsedev.c"
+
+static int failed = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failed++; \
+	} \
+} while (0)
+
+#define MSG_LEN 1000
+
+// Levenshtein distance of a and b
+static int distance(const char *a, const char *b)
+{
+	size_t n = strlen(a), m = strlen(b), i, j;
+	int *p = malloc((m + 1) * sizeof *p), *q = malloc((m + 1) * sizeof *q), *t, d;
+
+	for (j = 0; j <= m; j++) p[j] = j;
+	for (i = 1; i <= n; i++) {
+		q[0] = i;
+		for (j = 1; j <= m; j++) {
+			d = p[j - 1] + (a[i - 1] != b[j - 1]);
+			if (p[j] + 1 < d) d = p[j] + 1;
+			if (q[j - 1] + 1 < d) d = q[j - 1] + 1;
+			q[j] = d;
+		}
+		t = p;
+		p = q;
+		q = t;
+	}
+	d = p[m];
+	free(p);
+	free(q);
+	return d;
+}
+
+// runs of equal units in the pulses of a device, each starts with an edge
+static long runs(struct morsedev *md)
+{
+	size_t pos = 0;
+	long n = 0;
+
+	for (; pos < md->pulse_len; n++) pos += morse_run(md->pulse, pos, md->pulse_len);
+	return n;
+}
+
+// an edge on the input of a device at ns, decoded right away
+static void edge(struct morsedev *md, int level, u64 ns)
+{
+	ksim_now = ns;
+	rx_edge(md, level, ns);
+	ksim_step();
+}
+
+// step until nothing is due and append what the device decoded to text
+static size_t drain(struct file *f, char *text, size_t len)
+{
+	loff_t off = 0;
+	ssize_t ret;
+
+	while (ksim_step());
+	while ((ret = device_read(f, text + len, MSG_LEN, &off)) > 0) len += ret;
+	text[len] = '\0';
+	return len;
+}
+
+// LOOPBACK ===================================================================================
+// n messages of random words at send_wpm, the receiver starting from the speed of load_wpm;
+// returns the errors
+static int test_loopback(unsigned load_wpm, unsigned send_wpm, u64 jitter, int n)
+{
+	static const char alpha[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.,?/=";
+	char *sent = malloc(n * (MSG_LEN + 8) + 1), *got = malloc(4 * n * (MSG_LEN + 8) + 1);
+	char msg[MSG_LEN + 8];
+	struct inode inode;
+	struct file f = { 0 };
+	size_t nsent = 0, ngot = 0;
+	loff_t off = 0;
+	u64 start;
+	struct timespec t0, t1;
+	double cpu_ns;
+	long edges = 0;
+	int i, k, len, words, errors;
+
+	output = "loop";
+	ngpios = 1;
+	wpm = load_wpm;
+	capacity = MSG_LEN + 8;
+	queue = 4 * n * (MSG_LEN + 8);
+	if (morsedev_init() < 0) {
+		printf("FAIL: morsedev_init()\n");
+		exit(1);
+	}
+	wpm = send_wpm;
+	inode.i_cdev = &devs[0].cdev;
+	device_open(&inode, &f);
+	f.f_flags = O_NONBLOCK;
+	ksim_jitter_ns = jitter;
+	start = ksim_now;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (k = 0; k < n; k++) {
+		// words of 1 to 7 characters, a message ends with its last word: after it the
+		// receiver has a line to itself
+		for (len = 0; len < MSG_LEN;) {
+			words = 1 + rand() % 7;
+			for (i = 0; i < words; i++) msg[len++] = alpha[rand() % (sizeof alpha - 1)];
+			msg[len++] = ' ';
+		}
+		msg[len - 1] = '\n';
+		memcpy(sent + nsent, msg, len);
+		nsent += len;
+		CHECK(device_write(&f, msg, len - 1, &off) == len - 1, "message %d not queued", k);
+		ksim_run_works();
+		edges += runs(&devs[0]);
+		ngot = drain(&f, got, ngot);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sent[nsent] = '\0';
+	cpu_ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+	errors = distance(sent, got);
+	printf("loopback: %3u wpm from %3u, jitter %5llu us: %zu characters, %.1f a second, "
+	       "%d errors (%.3f%%), %.0f ns an edge\n", send_wpm, load_wpm, jitter / 1000, nsent,
+	       nsent / ((ksim_now - start) / 1e9), errors, 100.0 * errors / nsent, cpu_ns / edges);
+	ksim_jitter_ns = 0;
+	device_release(&inode, &f);
+	morsedev_exit();
+	capacity = CAP1X;
+	queue = QUEUE;
+	free(sent);
+	free(got);
+	return errors;
+}
+
+// HIGH AT LOAD ===============================================================================
+// An input pin high when the module loads, which goes low a while later and then receives
+// "E E" at the speed of the wpm parameter: how long it was high is not known, so that first
+// mark is neither a character nor a measure of the unit.
+static void test_high_at_load(void)
+{
+	struct morsedev *md;
+	struct inode inode;
+	struct file f = { 0 };
+	char text[64];
+	u64 unit, t;
+	size_t len;
+
+	output = "gpio";
+	ngpios = 1;
+	ninputs = 1;
+	inputs[0] = 1;
+	wpm = 20;
+	ksim_input = 1;
+	if (morsedev_init() < 0) {
+		printf("FAIL: morsedev_init()\n");
+		exit(1);
+	}
+	ksim_input = 0;
+	md = &devs[0];
+	unit = md->rx_unit_ns;
+	inode.i_cdev = &md->cdev;
+	device_open(&inode, &f);
+	f.f_flags = O_NONBLOCK;
+
+	t = ksim_now + 5000000000ULL;
+	edge(md, 0, t);
+	CHECK(md->rx_unit_ns == unit, "the unit went from %llu to %llu ns", unit, md->rx_unit_ns);
+	t += 20 * unit;
+	edge(md, 1, t);				// E
+	edge(md, 0, t + unit);
+	t += 8 * unit;
+	edge(md, 1, t);				// E, after a word space
+	edge(md, 0, t + unit);
+	len = drain(&f, text, 0);
+	CHECK(strcmp(text, "E E\n") == 0, "read \"%.*s\"", (int)len, text);
+	printf("high at load: read \"E E\", unit %llu ns\n", md->rx_unit_ns);
+
+	device_release(&inode, &f);
+	morsedev_exit();
+	ninputs = 0;
+}
+
+int main(void)
+{
+	int errors;
+
+	srand(1);
+	// the speed sent at from the start, then one the receiver has to measure
+	CHECK(test_loopback(100, 100, 0, 4) == 0, "errors without jitter");
+	// the first characters, while the unit comes down from 60 to 12 ms
+	errors = test_loopback(20, 100, 0, 4);
+	CHECK(errors < 20, "%d errors while measuring the speed", errors);
+	CHECK(test_loopback(100, 100, 3000000, 4) == 0, "errors with a quarter unit of jitter");
+	// half a unit may turn a dot into a dash now and then: under 1%
+	errors = test_loopback(100, 100, 6000000, 4);
+	CHECK(errors < 40, "%d errors with half a unit of jitter", errors);
+	test_high_at_load();
+	if (failed) printf("%d checks failed\n", failed);
+	return failed != 0;
+}
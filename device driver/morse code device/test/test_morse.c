@@ -0,0 +1,158 @@
+/*
+**  test_morse.c: The encoder and the symbol table of morse.h, as user programs use them: every
+**	character decodes back from its pattern, whole messages from their bitmaps, and a message
+**	encoded in pieces comes out the same as at once.
+*/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../morse.h"
+
+static int failed = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failed++; \
+	} \
+} while (0)
+
+static char symbols[MORSE_SYMBOLS];
+
+// Decode a bitmap of len units into text the way the driver reads its input, with exact
+// timing: a mark of 3 units is a dash, a space of 3 ends a character and one of 7 a word.
+static void decode(const unsigned char *bits, size_t len, char *text)
+{
+	unsigned int sym = 1;
+	size_t pos, run;
+
+	for (pos = 0; pos < len; pos += run) {
+		run = morse_run(bits, pos, len);
+		if (morse_unit(bits, pos)) {
+			sym = sym && sym < MORSE_SYMBOLS / 2 ? sym << 1 | (run == 3) : 0;
+			continue;
+		}
+		if (run >= 3 && sym != 1) {
+			*text++ = symbols[sym] ? symbols[sym] : '*';
+			sym = 1;
+		}
+		if (run >= 7) *text++ = ' ';
+	}
+	*text = '\0';
+}
+
+// CHARACTERS =================================================================================
+static void test_characters(void)
+{
+	unsigned char bits[8];
+	char text[8], c;
+	int ch, n = 0;
+	size_t len;
+
+	for (ch = 1; ch < 128; ch++) {
+		if (!morse_table[ch].units) continue;
+		memset(bits, 0, sizeof bits);
+		c = ch;
+		len = morse_encode(&c, 1, bits, 0, SIZE_MAX, NULL, NULL);
+		CHECK(len == morse_table[ch].len, "'%c' is %zu units, not %u", ch, len,
+		      morse_table[ch].len);
+		CHECK(len <= MORSE_MAX_UNITS, "'%c' is %zu units", ch, len);
+		decode(bits, len, text);
+		CHECK(text[0] == toupper(ch) && text[1] == '\0', "'%c' decodes as \"%s\"", ch, text);
+		n++;
+	}
+	printf("characters: %d decode back\n", n);
+}
+
+// MESSAGES ===================================================================================
+static const struct {
+	const char *msg, *text;		// sent and read back
+	size_t units;				// 0 if not checked
+} messages[] = {
+	{ "PARIS ", "PARIS ", 50 },	// the word that sets the speed
+	{ "paris paris", "PARIS PARIS", 0 },
+	{ "HELLO WORLD", "HELLO WORLD", 0 },
+	{ "SOS <SOS> 73", "SOS * 73", 0 },	// 9 elements: no character has that many
+	{ "<AR>", "+", 0 },			// a prosign is the character of its elements
+	{ "CQ ~ DE", "CQ DE", 0 },	// without a code: a word space, and the spaces run together
+	{ "1.5 = 3/2?", "1.5 = 3/2?", 0 },
+};
+
+static void test_messages(void)
+{
+	unsigned char bits[256];
+	char text[256];
+	size_t i, len;
+
+	for (i = 0; i < sizeof messages / sizeof messages[0]; i++) {
+		memset(bits, 0, sizeof bits);
+		len = morse_encode(messages[i].msg, strlen(messages[i].msg), bits, 0, sizeof bits * 8,
+		                   NULL, NULL);
+		CHECK(len == morse_encode(messages[i].msg, strlen(messages[i].msg), NULL, 0, SIZE_MAX,
+		                          NULL, NULL), "\"%s\": counting differs", messages[i].msg);
+		if (messages[i].units) {
+			CHECK(len == messages[i].units, "\"%s\" is %zu units, not %zu", messages[i].msg,
+			      len, messages[i].units);
+		}
+		decode(bits, len, text);
+		CHECK(strcmp(text, messages[i].text) == 0, "\"%s\" decodes as \"%s\"",
+		      messages[i].msg, text);
+	}
+	printf("messages: %zu decode back\n", i);
+}
+
+// PIECES =====================================================================================
+// one random message encoded at once and again a few characters at a time, each piece going
+// on from the position, and the prosign state, the one before left
+static void test_pieces(void)
+{
+	static const char alpha[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.,?/= <>";
+	unsigned char whole[2048], pieces[2048];
+	char msg[256];
+	size_t len, pos, done, at, n;
+	int round, prosign, i;
+
+	srand(1);
+	for (round = 0; round < 1000; round++) {
+		for (i = 0; i < (int)sizeof msg; i++) msg[i] = alpha[rand() % (sizeof alpha - 1)];
+		memset(whole, 0, sizeof whole);
+		memset(pieces, 0, sizeof pieces);
+		len = morse_encode(msg, sizeof msg, whole, 0, SIZE_MAX, NULL, NULL);
+
+		pos = 0;
+		prosign = 0;
+		for (at = 0; at < sizeof msg; at += n) {
+			n = 1 + rand() % 9;
+			if (n > sizeof msg - at) n = sizeof msg - at;
+			pos = morse_encode(msg + at, n, pieces, pos, SIZE_MAX, &done, &prosign);
+			CHECK(done == n, "round %d: %zu of %zu characters", round, done, n);
+		}
+		CHECK(pos == len, "round %d: %zu units in pieces, %zu at once", round, pos, len);
+		CHECK(memcmp(whole, pieces, (len + 7) / 8) == 0, "round %d: the bitmaps differ",
+		      round);
+
+		// a limit stops before the character that would cross it
+		pos = morse_encode(msg, sizeof msg, NULL, 0, len / 2, &done, NULL);
+		CHECK(pos <= len / 2 && done < sizeof msg, "round %d: limit %zu gave %zu units", round,
+		      len / 2, pos);
+		CHECK(pos == morse_encode(msg, done, NULL, 0, SIZE_MAX, NULL, NULL),
+		      "round %d: %zu characters are not %zu units", round, done, pos);
+	}
+	printf("pieces: %d messages encode the same\n", round);
+}
+
+int main(void)
+{
+	morse_symbols(symbols);
+	test_characters();
+	test_messages();
+	test_pieces();
+	if (failed) printf("%d checks failed\n", failed);
+	return failed != 0;
+}
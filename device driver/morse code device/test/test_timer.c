@@ -0,0 +1,223 @@
+/*
+**  test_timer.c: The shared timer of morsedev, stepped by kstub.c: every device sends its
+**	whole message and ends low, one callback serves all the devices due together, changes
+**	come on time, and a device started at another speed does not hold back those already
+**	sending.
+*/
+
+#include "../morsedev.c"
+
+static int failed = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failed++; \
+	} \
+} while (0)
+
+static const char *msgs[] = {
+	"SOS", "PARIS", "HELLO WORLD", "E", "TEST 123", "<AR>", "Q", "73"
+};
+
+static struct inode inodes[DEVS_MAX];
+static struct file files[DEVS_MAX];
+
+// load the module with n devices on output o and open each of them
+static void load(int n, char *o)
+{
+	int i;
+
+	output = o;
+	ngpios = n;
+	for (i = 0; i < n; i++) gpios[i] = i;
+	if (morsedev_init() < 0) {
+		printf("FAIL: morsedev_init()\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		inodes[i].i_cdev = &devs[i].cdev;
+		device_open(&inodes[i], &files[i]);
+	}
+}
+
+static void unload(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) device_release(&inodes[i], &files[i]);
+	morsedev_exit();
+}
+
+static void send(int i, const char *msg)
+{
+	loff_t off = 0;
+	ssize_t ret = device_write(&files[i], msg, strlen(msg), &off);
+
+	CHECK(ret == (ssize_t)strlen(msg), "morsedev%d took %zd of %zu bytes", i, ret,
+	      strlen(msg));
+	ksim_run_works();
+}
+
+// changes of state of the pulses of a device: one for each run and the last, to low
+static long changes(struct morsedev *md)
+{
+	size_t pos = 0;
+	long n = 1;
+
+	for (; pos < md->pulse_len; n++) pos += morse_run(md->pulse, pos, md->pulse_len);
+	return n;
+}
+
+// SHARED =====================================================================================
+// n devices at one speed, each with a message of its own
+static void test_shared(int n)
+{
+	long separate = 0;
+	int i;
+
+	wpm = 20;
+	load(n, "gpio");
+	ksim_timer_calls = ksim_bulk_writes = 0;
+	for (i = 0; i < n; i++) send(i, msgs[i % ARRAY_SIZE(msgs)]);
+	while (ksim_step());
+
+	for (i = 0; i < n; i++) {
+		CHECK(devs[i].sent == 1, "morsedev%d sent %lu messages", i, devs[i].sent);
+		CHECK(devs[i].pulse_pos == devs[i].pulse_len, "morsedev%d stopped at unit %zu of %zu",
+		      i, devs[i].pulse_pos, devs[i].pulse_len);
+		CHECK(device_fsync(&files[i], 0, 0, 0) == 0, "morsedev%d: fsync would wait", i);
+		separate += changes(&devs[i]);
+	}
+	CHECK(ksim_levels == 0, "levels %#lx at the end", ksim_levels);
+	CHECK(timer_ns == U64_MAX, "the timer is due at %llu with nothing to send", timer_ns);
+	// every callback changes a level, and sets them all in one write
+	CHECK(ksim_bulk_writes == ksim_timer_calls, "%ld writes in %ld callbacks",
+	      ksim_bulk_writes, ksim_timer_calls);
+	CHECK(ksim_timer_calls <= separate, "%ld callbacks for %ld changes", ksim_timer_calls,
+	      separate);
+	printf("shared: %d devices, %ld callbacks for %ld changes\n", n, ksim_timer_calls,
+	       separate);
+	unload(n);
+}
+
+// TIMING =====================================================================================
+// Device 0 sends at 100 wpm; halfway through, at an odd time, device 1 starts at 6 wpm, its
+// first change due later than the next one of device 0. With the timer jitter late at random,
+// every change is at most that late and the lateness does not add up over the message.
+static void test_timing(u64 jitter)
+{
+	struct morse_trace *tr;
+	struct trace_event *e, *first, *last;
+	u64 start;
+	s64 worst[2] = { 0, 0 };
+	int d, started = 0;
+	unsigned int i;
+
+	wpm = 100;
+	load(2, "trace");
+	ksim_jitter_ns = jitter;
+	ksim_now += 3333;
+	start = ksim_now;
+	send(0, "PARIS PARIS PARIS PARIS PARIS");
+	while (ksim_step()) {
+		if (started || ksim_now < start + 500000000ULL) continue;
+		started = 1;
+		ksim_now += 1234567;
+		wpm = 6;
+		send(1, "E");
+	}
+
+	for (d = 0; d < 2; d++) {
+		tr = devs[d].trace;
+		CHECK(devs[d].sent == 1, "morsedev%d sent %lu messages", d, devs[d].sent);
+		CHECK(tr->count == changes(&devs[d]), "morsedev%d made %u changes, not %ld", d,
+		      tr->count, changes(&devs[d]));
+		for (i = 0; i < tr->count; i++) {
+			e = &tr->ev[i];
+			if (e->late_ns > worst[d]) worst[d] = e->late_ns;
+			CHECK(e->late_ns >= 0 && e->late_ns <= (s64)jitter,
+			      "morsedev%d: change %u %lld ns late", d, i, e->late_ns);
+		}
+		first = &tr->ev[0];
+		last = &tr->ev[tr->count - 1];
+		CHECK(last->level == 0, "morsedev%d ends high", d);
+		// from the first change to the last the message takes its length in units
+		CHECK(last->ns - last->late_ns - (first->ns - first->late_ns) ==
+		      devs[d].pulse_len * devs[d].unit_ns, "morsedev%d took %llu ns for %zu units", d,
+		      last->ns - first->ns, devs[d].pulse_len);
+	}
+	printf("timing: jitter %llu us, worst lateness %.3f and %.3f ms\n", jitter / 1000,
+	       worst[0] / 1e6, worst[1] / 1e6);
+	ksim_jitter_ns = 0;
+	unload(2);
+}
+
+// SLEEPING LINES =============================================================================
+// the timer can not set lines that sleep: the module does not load
+static void test_cansleep(void)
+{
+	output = "gpio";
+	ngpios = 2;
+	ksim_cansleep = 1;
+	CHECK(morsedev_init() == -EINVAL, "loaded with output lines that can sleep");
+	ksim_cansleep = 0;
+	printf("cansleep: refused\n");
+}
+
+// MMAP =======================================================================================
+// the ring is only mapped shared: the records a producer puts in a private copy are lost
+static void test_mmap(void)
+{
+	struct vm_area_struct vma = { 0 };
+
+	load(1, "gpio");
+	CHECK(device_mmap(&files[0], &vma) == -EINVAL, "a private mapping of the ring");
+	vma.vm_flags = VM_SHARED;
+	CHECK(device_mmap(&files[0], &vma) == 0, "no shared mapping of the ring");
+	printf("mmap: shared only\n");
+	unload(1);
+}
+
+// POLL =======================================================================================
+// poll() reports POLLOUT exactly while a write of the whole capacity goes in without waiting
+static void test_poll(void)
+{
+	struct file *f = &files[0];
+	char msg[CAP1X];
+	loff_t off = 0;
+	int n;
+
+	wpm = 100;
+	load(1, "gpio");
+	f->f_flags = O_NONBLOCK;
+	memset(msg, 'E', sizeof msg);
+	for (n = 0; n < 1000 && (device_poll(f, NULL) & POLLOUT); n++) {
+		CHECK(device_write(f, msg, sizeof msg, &off) == sizeof msg,
+		      "write %d failed after POLLOUT", n);
+	}
+	CHECK(device_write(f, msg, sizeof msg, &off) == -EAGAIN, "the queue took %d messages", n);
+	// a message taken off the queue makes room for the next
+	while (!(device_poll(f, NULL) & POLLOUT) && ksim_step());
+	CHECK(device_write(f, msg, sizeof msg, &off) == sizeof msg, "no room after POLLOUT");
+	printf("poll: writable for %d messages of %zu bytes\n", n, sizeof msg);
+	f->f_flags = 0;
+	unload(1);
+}
+
+int main(void)
+{
+	srand(1);
+	test_shared(1);
+	test_shared(8);
+	test_shared(DEVS_MAX);
+	test_timing(0);
+	test_timing(2000000);
+	test_poll();
+	test_cansleep();
+	test_mmap();
+	if (failed) printf("%d checks failed\n", failed);
+	return failed != 0;
+}
@@ -1,15 +1,21 @@
 /*
-**  mled.c: User program used to communicate with device file /dev/morsedev.
+**  mled.c: User program used to communicate with device file /dev/morsedev0, or the one given
+**	with -d before the other options.
 **
 **	::NOTE::
-**		Only numbers, letters, and spaces will be properly encoded. Other characters will
-**		automatically be set as spaces.
+**		Letters, numbers, punctuation, and prosigns written as <SOS> will be encoded (see
+**		morse.h). Other characters will automatically be set as spaces.
 **
 **	::USES::
-**	  -g		Gets the string stored within the device file and flashes
-**				an LED connected to a specified GPIO pin, if possible.
-**	  -s [msg]	Sets the string stored within the device file and prepares
-**				the pulse buffer that controls the flashing LED.
+**	  -g		Gets the message the device is flashing on an LED connected
+**				to a specified GPIO pin, or the last one it flashed, and waits
+**				until the device has flashed every queued message.
+**	  -s [msg]	Queues a message to be flashed after those of other writers,
+**				waiting while the queue of the device is full, and waits until
+**				it was flashed.
+**	  -r [msg]	Like -s, through the ring mapped from the device, which takes
+**				no system call unless the device has to be kicked.
+**	  -w		Watches the device and reports every message it finishes.
 */
 
 #include <errno.h>
@@ -17,50 +23,159 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include "../morse.h"
+
 #define CAP1X 32
-#define DEVICE "/dev/morsedev"
+#define DEVICE "/dev/morsedev0"
 
 char buff[CAP1X];
 
+// wait until the device reports one of events (POLLOUT: room in its queue, POLLPRI: a
+// message was sent, POLLWRBAND: its ring is empty); returns the events, 0 on error
+short wait_for(int fd, short events)
+{
+	struct pollfd p = { fd, events, 0 };
+	while (poll(&p, 1, -1) < 0) {
+		if (errno != EINTR) { printf("Poll failed: %s\n", strerror(errno)); return 0; }
+	}
+	return p.revents;
+}
+
+// print the message the device holds; returns its length. Reading from the start also tells
+// the device that the messages sent so far were seen.
+size_t get_message(int fd)
+{
+	ssize_t n;
+	size_t total;
+
+	lseek(fd, 0, SEEK_SET);
+	for (total = 0; (n = read(fd, buff, sizeof buff)) > 0; total += n) {
+		if (total == 0) { printf("\""); }
+		fwrite(buff, 1, n, stdout);
+	}
+	if (total) { printf("\""); }
+	return total;
+}
+
+// map the ring of the device; returns its control page and sets *data, NULL on error
+struct morse_ring *map_ring(int fd, unsigned char **data)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct morse_ring *r = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	size_t total;
+
+	if (r == MAP_FAILED) { printf("Mmap failed: %s\n", strerror(errno)); return NULL; }
+	// the control page tells how much to map
+	total = r->data + r->size;
+	munmap(r, page);
+	r = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED) { printf("Mmap failed: %s\n", strerror(errno)); return NULL; }
+	*data = (unsigned char *)r + r->data;
+	return r;
+}
+
 int main(int argc, char* argv[])
 {
+	const char *device = DEVICE;
 	int fd = -1;
+	ssize_t n;
+	unsigned long count;
+	struct morse_ring *ring;
+	unsigned char *data;
+	size_t len;
 
 	// check for proper use of program
+	if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+		device = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
 	if (argc < 2 || argc > 3) { goto fail; }
-	fd = open(DEVICE, O_RDWR | O_APPEND);
-	if (fd < 0) { printf("Open %s failed!\n\n", DEVICE); exit(1); }
-	else { printf("Opened %s\n", DEVICE); }
+	fd = open(device, O_RDWR | O_APPEND | O_NONBLOCK);
+	if (fd < 0) { printf("Open %s failed!\n\n", device); exit(1); }
+	else { printf("Opened %s\n", device); }
 
 	// get message from device file buffer
 	if (argc == 2 && strcmp(argv[1], "-g") == 0) {
-		printf("flashing... \n");
-		read(fd, buff, strlen(buff));
-		if (buff[0] != '\0') { printf("\"%s\" flashed\n", buff); }
-		else { printf("buffer empty - nothing flashed\n"); }
+		if (get_message(fd)) { printf(" flashing or flashed last\n"); }
+		else { printf("buffer empty - nothing flashed\n"); goto exit; }
+		if (fsync(fd) < 0) { printf("Fsync failed: %s\n", strerror(errno)); goto exit; }
+		printf("queue empty - everything flashed\n");
 		goto exit;
 	}
 	// set message to device file buffer
 	else if (argc == 3 && strcmp(argv[1], "-s") == 0) {
-		write(fd, argv[2], strlen(argv[2]));
+		// the device takes as much as fits in its capacity, when its queue has room for it
+		while ((n = write(fd, argv[2], strlen(argv[2]))) < 0 && errno == EAGAIN) {
+			printf("queue full - waiting\n");
+			if (!wait_for(fd, POLLOUT)) { goto exit; }
+		}
+		if (n < 0) { printf("Write failed: %s\n", strerror(errno)); goto exit; }
+		printf("\"%.*s\" queued: %zu time units\n", (int)n, argv[2],
+			morse_encode(argv[2], n, NULL, 0, (size_t)-1, NULL, NULL));
+		if (fsync(fd) < 0) { printf("Fsync failed: %s\n", strerror(errno)); goto exit; }
+		printf("\"%.*s\" flashed\n", (int)n, argv[2]);
+		goto exit;
+	}
+	// put message in the ring mapped from the device
+	else if (argc == 3 && strcmp(argv[1], "-r") == 0) {
+		if (!(ring = map_ring(fd, &data))) { goto exit; }
+		len = strlen(argv[2]);
+		if (len > 0xffff || len + 2 > ring->size) {
+			printf("Message too long for the ring\n");
+			goto exit;
+		}
+		// the device empties the ring as it starts each message
+		while ((n = morse_ring_put(ring, data, argv[2], len)) < 0) {
+			printf("ring full - waiting\n");
+			if (!wait_for(fd, POLLWRBAND)) { goto exit; }
+		}
+		if (n == 1 && ioctl(fd, MORSE_KICK) < 0) {
+			printf("Kick failed: %s\n", strerror(errno));
+			goto exit;
+		}
+		printf("\"%s\" put in the ring%s: %zu time units\n", argv[2],
+			n ? ", device kicked" : "",
+			morse_encode(argv[2], len, NULL, 0, (size_t)-1, NULL, NULL));
+		if (fsync(fd) < 0) { printf("Fsync failed: %s\n", strerror(errno)); goto exit; }
+		printf("\"%s\" flashed\n", argv[2]);
+		goto exit;
+	}
+	// report each message sent until interrupted
+	else if (argc == 2 && strcmp(argv[1], "-w") == 0) {
+		printf("watching - device holds ");
+		if (!get_message(fd)) { printf("nothing"); }	// only what ends from now on counts
+		printf("\n");
+		for (count = 1; wait_for(fd, POLLPRI) & POLLPRI; count++) {
+			printf("%lu: message flashed, device holds ", count);
+			if (!get_message(fd)) { printf("nothing"); }
+			printf("\n");
+			fflush(stdout);
+		}
 		goto exit;
 	}
 	else { goto fail; }
 
 fail:
-	printf("\nFunction uses: only numbers, letters, and spaces will be properly encoded.\n"
-		"\t./mled -g       : Get the current message in the device file buffer and pulse\n"
-		"\t                  morse code equivalent through an LED connected to the GPIO.\n"
-		"\t./mled -s [msg] : Set the message in the device file and blink the morse code\n"
-		"\t                  equivalent to an LED via a GPIO. (Max %d char including\n"
-		"\t                  string terminator.\n\n", CAP1X);
+	printf("\nFunction uses: letters, numbers, punctuation, and <prosigns> will be encoded.\n"
+		"\t./mled -g       : Get the message whose morse code equivalent is pulsed through\n"
+		"\t                  an LED connected to the GPIO, or the last one pulsed.\n"
+		"\t./mled -s [msg] : Queue a message to blink the morse code equivalent to an LED\n"
+		"\t                  via a GPIO after the messages before it. (At most the capacity\n"
+		"\t                  the module was loaded with, %d char by default.)\n"
+		"\t./mled -r [msg] : Like -s, through the ring the device maps to the program.\n"
+		"\t./mled -w       : Watch the device and report every message it finishes.\n"
+		"\t./mled -d [dev] : Use another device, e.g. /dev/morsedev1, with the above.\n\n",
+		CAP1X);
 exit:
 	if (fd > 0) { close(fd); }
 	return 0;
@@ -1,15 +1,25 @@
 // A simple client run on a Linux machine using TCP. The port number is predefined but
 // can also be passed as an argument with a little code modification.
+//
+// Usage: client [-i] hostname
+// Option -i opens an interactive session: the server runs bsh on a pseudo terminal and the
+// local terminal is put into raw mode and relayed to it until the remote shell exits.
 
 /* ============ Includes =================================================================== */
 #include <errno.h>
 #include <netdb.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <termios.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -17,6 +27,12 @@
 #define MAX_TX 1024         // maximum transfer buffer in bytes
 #define MAX_RX 16384        // maximum receive buffer in bytes
 #define STR_PORT_NUM "5795" // (string) port number for client (last 5 digits of my BUID)
+#define SESSION_HELLO "%session"   // first line of an interactive session request
+#define MAX_FRAME 4096      // maximum keystrokes sent in one session frame
+
+/* ============ Global Variables =========================================================== */
+struct termios saved_tty;   // terminal settings to restore after a session
+int tty_raw = 0;            // is the terminal in raw mode?
 
 /* ============ Helper Functions =========================================================== */
 // print errors and exit
@@ -34,6 +50,121 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6 *)sa)->sin6_addr);
 }
 
+/* ============ Interactive Session ======================================================== */
+// give the terminal back in the state we found it
+void tty_restore(void)
+{
+    if (tty_raw) tcsetattr(STDIN_FILENO, TCSADRAIN, &saved_tty);
+    tty_raw = 0;
+}
+// send a buffer to the server in full
+void send_all(int sockfd, const char *buf, size_t len)
+{
+    ssize_t n;
+    while (len > 0) {
+        if ((n = send(sockfd, buf, len, MSG_NOSIGNAL)) < 0) error("client: send error");
+        buf += n;
+        len -= n;
+    }
+}
+// send one frame: type byte, 16 bit big endian length and the payload
+void send_frame(int sockfd, char type, const char *data, size_t len)
+{
+    char frame[3 + MAX_FRAME];
+    frame[0] = type;
+    frame[1] = len >> 8;
+    frame[2] = len & 0xff;
+    memcpy(frame + 3, data, len);
+    send_all(sockfd, frame, 3 + len);   // header and payload in the same segment
+}
+// tell the server the size of the local terminal
+void send_winsize(int sockfd)
+{
+    struct winsize ws;
+    char size[4];
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) < 0) return;
+    size[0] = ws.ws_row >> 8;
+    size[1] = ws.ws_row & 0xff;
+    size[2] = ws.ws_col >> 8;
+    size[3] = ws.ws_col & 0xff;
+    send_frame(sockfd, 'w', size, sizeof size);
+}
+// relay the terminal to a remote bsh until the server closes the connection
+void session(int sockfd)
+{
+    struct winsize ws = {.ws_row = 24, .ws_col = 80};
+    struct epoll_event ev[3];
+    struct signalfd_siginfo si;
+    struct termios raw;
+    char buf[MAX_RX], hello[64];
+    const char *term = getenv("TERM");
+    int ep, sigfd, i, n, optval = 1, input = 1, done = 0;
+    sigset_t mask;
+    ssize_t r;
+
+    // typing is a stream of tiny writes: without TCP_NODELAY each keystroke would wait for
+    // the ack of the one before it
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval) < 0)
+        perror("client: TCP_NODELAY");
+    ioctl(STDIN_FILENO, TIOCGWINSZ, &ws);
+    snprintf(hello, sizeof hello, "%s %u %u %s\n", SESSION_HELLO, ws.ws_row, ws.ws_col,
+             term ? term : "vt100");
+    send_all(sockfd, hello, strlen(hello));
+
+    // window changes arrive through a signalfd next to the terminal and the socket
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((sigfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0) error("client: signalfd error");
+
+    // keys go to the remote shell as they are typed, and it does the echoing
+    if (tcgetattr(STDIN_FILENO, &saved_tty) == 0) {
+        raw = saved_tty;
+        cfmakeraw(&raw);
+        if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0) tty_raw = 1;
+        atexit(tty_restore);
+    }
+
+    if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) error("client: epoll_create error");
+    ev[0] = (struct epoll_event){.events = EPOLLIN, .data.fd = STDIN_FILENO};
+    ev[1] = (struct epoll_event){.events = EPOLLIN, .data.fd = sockfd};
+    ev[2] = (struct epoll_event){.events = EPOLLIN, .data.fd = sigfd};
+    for (i = 0; i < 3; i++) {
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, ev[i].data.fd, &ev[i]) < 0)
+            error("client: epoll_ctl error");
+    }
+
+    while (!done) {
+        if ((n = epoll_wait(ep, ev, 3, -1)) < 0) {
+            if (errno == EINTR) continue;
+            error("client: epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            if (ev[i].data.fd == sockfd) {          // terminal output of the remote shell
+                if ((r = recv(sockfd, buf, sizeof buf, 0)) < 0) error("client: recv error");
+                if (r == 0) done = 1;
+                else if (write(STDOUT_FILENO, buf, r) < 0) error("client: write error");
+            } else if (ev[i].data.fd == sigfd) {    // the local window changed size
+                if (read(sigfd, &si, sizeof si) == sizeof si) send_winsize(sockfd);
+            } else if (input) {                     // keystrokes
+                if ((r = read(STDIN_FILENO, buf, MAX_FRAME)) < 0) error("client: read error");
+                if (r > 0) {
+                    send_frame(sockfd, 'd', buf, r);
+                    continue;
+                }
+                // end of input (not a terminal): type ^D as a user would, then wait for
+                // the remote shell to finish
+                send_frame(sockfd, 'd', "\004", 1);
+                epoll_ctl(ep, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                input = 0;
+            }
+        }
+    }
+    tty_restore();
+    close(ep);
+    close(sigfd);
+}
+
 // ============ Main Client Program ======================================================== */
 int main(int argc, char *argv[])
 {
@@ -44,10 +175,15 @@ int main(int argc, char *argv[])
     int gai_status, s_status, r_status; // getaddrinfo/send/receive return values
     char s[INET6_ADDRSTRLEN];           // address string
     char TxBuffer[MAX_TX], RxBuffer[MAX_RX];// transmit and receive buffers
+    int opt, interactive = 0;           // command line option, session requested
 
     // make sure the user specified a hostname
-    if (argc < 2) {
-        fprintf(stderr, "usage %s hostname\n", argv[0]);
+    while ((opt = getopt(argc, argv, "i")) != -1) {
+        if (opt != 'i') break;
+        interactive = 1;
+    }
+    if (opt != -1 || optind >= argc) {
+        fprintf(stderr, "usage %s [-i] hostname\n", argv[0]);
         exit(1);
     }
 
@@ -55,7 +191,7 @@ int main(int argc, char *argv[])
     memset(&hints, 0, sizeof hints);     // make sure the struct is empty
     hints.ai_family = AF_UNSPEC;        // don't care if IPv4 or IPv6
     hints.ai_socktype = SOCK_STREAM;    // TCP stream sockets
-    if ((gai_status = getaddrinfo(argv[1], STR_PORT_NUM, &hints, &servinfo)) != 0) {
+    if ((gai_status = getaddrinfo(argv[optind], STR_PORT_NUM, &hints, &servinfo)) != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai_status));
         return 1;
     }
@@ -81,8 +217,14 @@ int main(int argc, char *argv[])
     // print server IP address
     inet_ntop(p->ai_family, get_in_addr((struct sockaddr *)p->ai_addr), s, sizeof s);
     printf("client: Good day, commander [server %s]\n", s);
-    printf("client: Set a course $ ");
     freeaddrinfo(servinfo); // release this structure since we are done with it
+    if (interactive) {
+        fflush(stdout);
+        session(client_s);
+        close(client_s);
+        return 0;
+    }
+    printf("client: Set a course $ ");
 
     // send commands to server
     bzero(TxBuffer, MAX_TX);
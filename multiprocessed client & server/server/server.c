@@ -1,10 +1,23 @@
 // A simple server run on a Raspberry Pi in the internet domain using TCP. The port number is
 // predefined but can also be passed as an argument with a little code modification.
+//
+// Usage: server [-g cgroup] [-c cpu.max] [-m memory.max] [-i io.max]
+// Any of the options places the commands of each request into a transient cgroup v2 below
+// the given parent (default /sys/fs/cgroup/bsh-server) with the given limits. The CPU time,
+// peak RSS and block I/O of the commands are returned in the trailer of every response.
+// Option -t enables a result cache shared by all workers: the output of read-only commands
+// (the -w whitelist, default uptime,df,free,uname,date,cat) is reused for ttl_ms, and identical
+// requests that arrive while the command is running wait for its result.
+// A client that opens with a session line ("%session rows cols term", see client -i) gets an
+// interactive bsh (option -s, default ../../custom shell/bsh) on a pseudo terminal instead of
+// a single command.
 
 /* ============ Includes =================================================================== */
+#define _GNU_SOURCE         // memfd_create(), ptsname_r()
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,19 +26,67 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include "exec.h"           // parser and executor shared with bsh (custom shell)
+#include "parse.h"
+#include "pathhash.h"
+
 /* ============ Defines ==================================================================== */
 #define MAX_BUFF 1024		// maximum buffer size in bytes
 #define STR_PORT_NUM "5795" // (string) port number for server (last 5 digits of my BUID)
 #define BACKLOG 10          // how many pending connections to hold
 #define MAX_LINE 128        // maximum length of command in bytes
-#define MAX_ARGS 32         // maximum number of args
-#define MAX_CMDS 16         // maximum number of commands for redirection/piping
-#define DELIMS " \t\r\n"    // delimiters
+#define MAX_PATH 256        // maximum length of a cgroup path
+#define CG_ROOT "/sys/fs/cgroup/bsh-server" // default parent cgroup for requests
+#define CACHE_SIZE 64       // number of cached command results
+#define CACHE_OUT 16384     // maximum cached output of a command in bytes
+#define CACHE_CMDS "uptime,df,free,uname,date,cat" // default cacheable commands
+#define CACHE_WHITELIST 32  // maximum number of cacheable commands
+#define SESSION_HELLO "%session"   // first line of an interactive session request
+#define SESSION_SHELL "../../custom shell/bsh"  // default shell of a session
+#define SESSION_BUF 16384   // relay buffer of each direction in bytes
+
+/* ============ Global Variables =========================================================== */
+char *cg_root = NULL;       // parent cgroup of all requests (NULL: no cgroups)
+char *cg_cpu = NULL;        // cpu.max for each request, e.g. "50000 100000"
+char *cg_mem = NULL;        // memory.max for each request, e.g. "256M"
+char *cg_io = NULL;         // io.max for each request, e.g. "8:0 rbps=1048576"
+int cg_procs = -1;          // cgroup.procs of the current request (-1: none)
+struct rusage usage;        // accumulated resource usage of reaped commands
+
+// Command result cache, shared by all worker processes. An entry is RUNNING while one worker
+// executes the command; concurrent identical requests wait on 'done' instead of running it.
+enum { C_EMPTY, C_RUNNING, C_READY };
+struct cache_entry {
+    char key[MAX_LINE * 2];     // normalized command line
+    int state;                  // C_EMPTY, C_RUNNING or C_READY
+    pid_t owner;                // worker running the command (C_RUNNING)
+    long stamp;                 // time the output was stored in ms
+    size_t len;                 // length of the output
+    char out[CACHE_OUT];        // standard output of the command
+};
+struct cache {
+    pthread_mutex_t lock;       // process-shared, robust lock of the whole cache
+    pid_t holder;               // worker that took the lock last
+    pthread_cond_t done;        // signaled whenever a RUNNING entry completes
+    unsigned long hits, misses, coalesced;  // metrics
+    struct cache_entry entry[CACHE_SIZE];
+};
+struct cache *cache = NULL;     // shared mapping (NULL: cache disabled)
+long cache_ttl = 0;             // time to live of a cached result in ms
+char *cache_cmds[CACHE_WHITELIST];  // whitelist of cacheable commands
+const char *cache_result = NULL;// outcome of the current request (hit, miss, coalesced)
+char *session_shell = SESSION_SHELL;// shell run by interactive sessions
 
 /* ============ Helper Functions =========================================================== */
 // print errors and exit
@@ -47,180 +108,488 @@ void *get_in_addr(struct sockaddr *sa)
     }
     return &(((struct sockaddr_in6 *)sa)->sin6_addr);
 }
+// wait for a command and add its resource usage to the request totals
+pid_t reap(pid_t pid, int *status)
+{
+    struct rusage ru;
+    if ((pid = wait4(pid, status, 0, &ru)) > 0) {
+        timeradd(&usage.ru_utime, &ru.ru_utime, &usage.ru_utime);
+        timeradd(&usage.ru_stime, &ru.ru_stime, &usage.ru_stime);
+        if (ru.ru_maxrss > usage.ru_maxrss) usage.ru_maxrss = ru.ru_maxrss;
+        usage.ru_inblock += ru.ru_inblock;
+        usage.ru_oublock += ru.ru_oublock;
+    }
+    return pid;
+}
 
-/* ============	Redirects cmd (>)(1>)(2>)(>>)(2>>)(&>)(<) file ============================= */
-void redirect (char *cmd[], char *file, int std_ioe, int append, int bg)
+/* ============ Resource Control (cgroup v2) =============================================== */
+// write a value to a control file of the cgroup at dir
+int cg_write(const char *dir, const char *file, const char *val)
 {
-    pid_t pid;                      // processor id
-    int fd, status;                 // file decriptor and status
-    if (std_ioe == 0) {             // stdin selected (cmd < file)
-        fd = open(file, O_RDONLY);
-    } else if (append) {            // append cmd to file
-        fd = open(file, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    } else {                        // truncate
-        fd = open(file, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    char path[MAX_PATH];
+    int fd, n;
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if ((fd = open(path, O_WRONLY)) < 0) return -1;
+    n = write(fd, val, strlen(val));
+    close(fd);
+    return (n < 0) ? -1 : 0;
+}
+// read a control file of the cgroup at dir into buf (string terminated)
+int cg_read(const char *dir, const char *file, char *buf, size_t len)
+{
+    char path[MAX_PATH];
+    int fd, n;
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if ((fd = open(path, O_RDONLY)) < 0) return -1;
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return n;
+}
+// create the parent cgroup and delegate the controllers to the request cgroups below it
+void cg_setup(void)
+{
+    if (mkdir(cg_root, 0755) < 0 && errno != EEXIST) error("server: cgroup mkdir error");
+    if (cg_write(cg_root, "cgroup.subtree_control", "+cpu +memory +io") < 0)
+        error("server: cgroup subtree_control error");
+}
+// create a transient cgroup for this request; commands join it with cg_enter()
+int cg_create(char *dir, size_t len)
+{
+    char path[MAX_PATH];
+    snprintf(dir, len, "%s/req-%d", cg_root, getpid());
+    if (mkdir(dir, 0755) < 0) return -1;
+    if ((cg_cpu && cg_write(dir, "cpu.max", cg_cpu) < 0) ||
+        (cg_mem && cg_write(dir, "memory.max", cg_mem) < 0) ||
+        (cg_io && cg_write(dir, "io.max", cg_io) < 0)) {
+        rmdir(dir);
+        return -1;
+    }
+    snprintf(path, sizeof path, "%s/cgroup.procs", dir);
+    if ((cg_procs = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        rmdir(dir);
+        return -1;
     }
-    if ((pid = fork()) < 0) {       // fork failed
-        error ("fork");
-    } else if (pid == 0) {          // child process
-        if (std_ioe == 3) {         // used for cmd &> file
-            dup2 (fd, 1);           // set stdout to output to file
-            dup2 (fd, 2);           // set stderr to output to file
-        } else {
-            dup2 (fd, std_ioe);     // set std(in/out/err) to output to file
+    return 0;
+}
+// move the calling (child) process into the request cgroup before exec
+void cg_enter(void)
+{
+    char pid[16];
+    if (cg_procs < 0) return;
+    snprintf(pid, sizeof pid, "%d", getpid());
+    if (write(cg_procs, pid, strlen(pid)) < 0) perror("server: cgroup.procs");
+}
+// summarize the cgroup statistics into buf, then remove the request cgroup
+void cg_destroy(const char *dir, char *buf, size_t len)
+{
+    char stat[MAX_BUFF], *line;
+    unsigned long long cpu = 0, peak = 0, rbytes = 0, wbytes = 0, val;
+
+    close(cg_procs);
+    cg_procs = -1;
+    if (cg_read(dir, "cpu.stat", stat, sizeof stat) > 0)
+        sscanf(stat, "usage_usec %llu", &cpu);
+    if (cg_read(dir, "memory.peak", stat, sizeof stat) > 0)
+        sscanf(stat, "%llu", &peak);
+    if (cg_read(dir, "io.stat", stat, sizeof stat) > 0) {
+        for (line = strtok(stat, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            char *f;                // one line per device: "MAJ:MIN rbytes=N wbytes=N ..."
+            if ((f = strstr(line, "rbytes=")) && sscanf(f, "rbytes=%llu", &val) == 1)
+                rbytes += val;
+            if ((f = strstr(line, "wbytes=")) && sscanf(f, "wbytes=%llu", &val) == 1)
+                wbytes += val;
         }
-        close(fd);                  // close file decriptor
-        execvp (cmd[0], cmd);       // exec command
-        error("execvp");
-    } else {                        // parent process
-        pid_t childPid;
-        childPid = wait(&status);
     }
+    snprintf(buf, len, "server: cgroup cpu %llu.%06llus, peak memory %llu bytes, "
+             "read %llu bytes, written %llu bytes\n", cpu / 1000000, cpu % 1000000, peak,
+             rbytes, wbytes);
+    if (rmdir(dir) < 0) perror("server: cgroup rmdir");
 }
 
-/* ============ Multi pipe cmd0 | cmd1 ... | cmdn ========================================== */
-void multi_pipe (char *cmds[][MAX_CMDS][MAX_ARGS], int n, int *bg)
+/* ============ Command Result Cache ======================================================= */
+// monotonic time in milliseconds
+long now_ms(void)
 {
-    pid_t pid;
-    int status, i, j;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+// map the cache shared between all workers; the whitelist is a comma separated list
+void cache_setup(char *whitelist)
+{
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    int i = 0;
+    char *name;
 
-    // set up all the pipes
-    int pipes[n*2];
-    for (i = 0; i < n; i++) {
-        if (pipe(pipes + (i*2)) < 0) error("pipe"); // pipe failed
-    }
+    cache = mmap(NULL, sizeof *cache, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) error("server: cache mmap error");
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);   // a worker may die holding it
+    pthread_mutex_init(&cache->lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&cache->done, &ca);
 
-    // fork the child processes
-    for (i = 0; i <= n; i++) {
-        if ((pid = fork()) < 0) {           // fork failed
-            error("fork");
-        } else if (pid == 0) {              // child process
-            if (i != n) {                   // does not apply to last cmd
-                dup2 (pipes[(i*2)+1], 1);   // set stdout to pipe output
-            }
-            if (i != 0) {                   // does not apply to first cmd
-                dup2 (pipes[(i*2)-2], 0);   // set stdin to previous pipe input
-            }
+    for (name = strtok(whitelist, ","); name && i < CACHE_WHITELIST - 1; name = strtok(NULL, ","))
+        cache_cmds[i++] = name;
+}
+// only plain commands and pipelines of whitelisted commands are cached
+int cacheable(struct pipeline *pl)
+{
+    struct command *cmd;
+    int j;
+    if (pl->bg) return 0;
+    for (cmd = pl->cmds; cmd; cmd = cmd->next) {
+        if (cmd->redirs || cmd->argc == 0) return 0;
+        for (j = 0; cache_cmds[j]; j++) {
+            if (strcmp(cmd->argv[0], cache_cmds[j]) == 0) break;
+        }
+        if (!cache_cmds[j]) return 0;
+    }
+    return 1;
+}
+// build the cache key: tokens separated by single spaces
+void cache_key(struct pipeline *pl, char *key, size_t len)
+{
+    struct command *cmd;
+    int j;
+    size_t n = 0;
+    key[0] = '\0';
+    for (cmd = pl->cmds; cmd; cmd = cmd->next) {
+        for (j = 0; j < cmd->argc; j++)
+            n += snprintf(key + n, n < len ? len - n : 0, "%s%s", n ? " " : "", cmd->argv[j]);
+        if (cmd->next) n += snprintf(key + n, n < len ? len - n : 0, " |");
+    }
+}
+// is the worker that runs an entry still alive?
+int cache_owner_alive(struct cache_entry *e)
+{
+    return kill(e->owner, 0) == 0 || errno != ESRCH;
+}
+// the cache lock was taken and returned ret: if its holder died, the entries it was running
+// may be half written, so they are dropped
+void cache_locked(int ret)
+{
+    int i;
+    if (ret == EOWNERDEAD) {
+        for (i = 0; i < CACHE_SIZE; i++) {
+            if (cache->entry[i].state == C_RUNNING && cache->entry[i].owner == cache->holder)
+                cache->entry[i].state = C_EMPTY;
+        }
+        pthread_cond_broadcast(&cache->done);   // waiters for them run the command themselves
+        pthread_mutex_consistent(&cache->lock);
+    }
+    cache->holder = getpid();
+}
+// lock the cache, recovering it if a worker died while holding the lock
+void cache_lock(void)
+{
+    cache_locked(pthread_mutex_lock(&cache->lock));
+}
+// send a buffer to the client in full
+void send_all(int sockfd, const char *buf, size_t len)
+{
+    ssize_t n;
+    while (len > 0) {
+        if ((n = send(sockfd, buf, len, 0)) < 0) error("server: send output error");
+        buf += n;
+        len -= n;
+    }
+}
+// run a cacheable command, or answer it from the cache; sockfd is the client socket
+void cache_run(struct pipeline *pl, int sockfd)
+{
+    char key[MAX_LINE * 2], chunk[CACHE_OUT];
+    struct cache_entry *e, *slot;
+    struct timespec ts;
+    struct stat st;
+    int i, memfd, waited = 0;
+    ssize_t n;
 
-            // IMPORTANT! close all pipe ends
-            for (j = 0; j < n*2; j++) {
-                close(pipes[j]);
+    cache_key(pl, key, sizeof key);
+    cache_lock();
+    while (1) {
+        e = slot = NULL;
+        for (i = 0; i < CACHE_SIZE; i++) {       // find the key, or the oldest idle slot
+            if (cache->entry[i].state != C_EMPTY && strcmp(cache->entry[i].key, key) == 0) {
+                e = &cache->entry[i];
+                break;
             }
-            execvp (cmds[0][i][0], cmds[0][i]);
-            error("execvp");
+            if (cache->entry[i].state != C_RUNNING &&
+                (!slot || cache->entry[i].stamp < slot->stamp)) slot = &cache->entry[i];
+        }
+        if (e && e->state == C_READY && now_ms() - e->stamp < cache_ttl) {
+            if (waited) cache->coalesced++;     // fresh result: send a copy
+            else cache->hits++;
+            cache_result = waited ? "coalesced" : "hit";
+            n = e->len;
+            memcpy(chunk, e->out, n);
+            pthread_mutex_unlock(&cache->lock);
+            send_all(sockfd, chunk, n);
+            return;
         }
+        if (e && e->state == C_RUNNING && cache_owner_alive(e)) {
+            waited = 1;                         // identical request in flight: wait for it
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += 1;                     // recheck the owner periodically
+            cache_locked(pthread_cond_timedwait(&cache->done, &cache->lock, &ts));
+            continue;
+        }
+        break;
     }
+    cache->misses++;
+    cache_result = "miss";
+    if (!e) e = slot;                           // claim an entry and run the command
+    if (e) {                                    // in an order that cache_locked() recovers
+        e->state = C_EMPTY;
+        strcpy(e->key, key);
+        e->owner = getpid();
+        e->state = C_RUNNING;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // capture the output in memory, since the client and the cache both need it
+    if ((memfd = memfd_create("cache", 0)) < 0) error("server: memfd_create error");
+    dup2(memfd, STDOUT_FILENO);
+    exec_pipeline(pl);
+    dup2(sockfd, STDOUT_FILENO);
 
-    // only the parent will reach this part
-    // IMPORTANT! close up the pipes
-    for (i = 0; i < n*2; i++) {
-        close(pipes[i]);
+    if (fstat(memfd, &st) < 0) error("server: fstat error");
+    cache_lock();
+    if (e && st.st_size <= CACHE_OUT && pread(memfd, e->out, st.st_size, 0) == st.st_size) {
+        e->len = st.st_size;
+        e->stamp = now_ms();
+        e->state = C_READY;
+    } else if (e) {
+        e->state = C_EMPTY;                     // too large to cache
     }
-    // wait for all child processes to finish
-    for (i = 0; i <= n;  i++) {
-        wait(&status);
+    pthread_cond_broadcast(&cache->done);
+    pthread_mutex_unlock(&cache->lock);
+
+    lseek(memfd, 0, SEEK_SET);
+    while ((n = read(memfd, chunk, sizeof chunk)) > 0) send_all(sockfd, chunk, n);
+    close(memfd);
+}
+
+/* ============ Interactive Session ======================================================== */
+// After the session line the client sends frames: a type byte, a 16 bit big endian length
+// and the payload. 'd' frames carry keystrokes for the shell, 'w' frames the new window size
+// (rows and columns, 16 bits each). The server sends back the raw terminal output.
+struct relay {
+    char buf[SESSION_BUF];      // bytes received but not yet passed on
+    size_t len;                 // number of bytes in buf
+    size_t data;                // keystrokes left in the current 'd' frame (client side)
+};
+
+// start the session shell on a new pseudo terminal; returns its master side, -1 on error
+int session_pty(struct winsize *ws, const char *term, pid_t *pid)
+{
+    char name[64];
+    int master, slave;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) return -1;
+    if (grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, name, sizeof name) ||
+        (slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        close(master);
+        return -1;
     }
+    ioctl(master, TIOCSWINSZ, ws);
+
+    // the slave stays open from here on, so the master never sees a hangup before the
+    // shell has started
+    if ((*pid = fork()) < 0) {
+        close(master);
+        close(slave);
+        return -1;
+    }
+    if (*pid == 0) {
+        setsid();                           // new session with the pty as controlling tty
+        if (ioctl(slave, TIOCSCTTY, 0) < 0) perror("server: TIOCSCTTY");
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        setenv("TERM", term, 1);
+        cg_enter();                         // the whole session counts for the request
+        execl(session_shell, "bsh", (char *)NULL);
+        perror("server: session shell");
+        _exit(127);
+    }
+    close(slave);
+    return master;
 }
+// pass the frames received from the client on to the shell; returns 1 when the pty is full
+// and the rest has to wait, -1 on a protocol or pty error
+int session_input(struct relay *in, int master)
+{
+    unsigned char *b = (unsigned char *)in->buf;
+    size_t off = 0, flen;
+    struct winsize ws;
+    ssize_t n;
+    int full = 0;
 
-/* ============	Run Individual Commands ==================================================== */
-void runcmd (char *cmd[])
+    while (off < in->len && !full) {
+        if (in->data == 0) {                    // at a frame header
+            if (in->len - off < 3) break;
+            flen = b[off + 1] << 8 | b[off + 2];
+            if (b[off] == 'd') {
+                in->data = flen;
+                off += 3;
+                continue;
+            }
+            if (in->len - off < 3 + flen) {
+                if (3 + flen > sizeof in->buf) return -1;
+                break;
+            }
+            if (b[off] == 'w' && flen == 4) {   // resize: the shell gets SIGWINCH
+                memset(&ws, 0, sizeof ws);
+                ws.ws_row = b[off + 3] << 8 | b[off + 4];
+                ws.ws_col = b[off + 5] << 8 | b[off + 6];
+                ioctl(master, TIOCSWINSZ, &ws);
+            }
+            off += 3 + flen;                    // unknown frames are skipped
+            continue;
+        }
+        flen = in->len - off < in->data ? in->len - off : in->data;
+        if ((n = write(master, b + off, flen)) < 0) {
+            if (errno != EAGAIN) return -1;
+            n = 0;
+        }
+        full = (size_t)n < flen;
+        off += n;
+        in->data -= n;
+    }
+    memmove(b, b + off, in->len - off);
+    in->len -= off;
+    return full;
+}
+// update what epoll watches on fd
+void session_watch(int ep, int fd, uint32_t events)
+{
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    if (epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev) < 0) perror("server: epoll_ctl");
+}
+// run an interactive shell for the client until either side goes away; hello holds the
+// len bytes received so far, starting with the session line
+void session(int sockfd, char *hello, size_t len)
 {
+    struct winsize ws = {.ws_row = 24, .ws_col = 80};
+    struct relay *in, *out;                 // client to shell, shell to client
+    struct epoll_event ev[2];
+    char term[32] = "vt100", *eol;
+    unsigned rows, cols;
+    int master, ep, i, n, status, optval = 1, full, done = 0;
+    ssize_t r;
     pid_t pid;
-    int status;
-    if ((pid = fork()) < 0) {
-        error("fork");
-    } else if (pid == 0) {          // child
-        execvp(cmd[0], cmd);
-        error("execvp");
-    } else {                        // parent
-        pid_t childPid;
-        childPid = wait(&status);
+
+    eol = memchr(hello, '\n', len);
+    if (sscanf(hello + strlen(SESSION_HELLO), "%u %u %31s", &rows, &cols, term) >= 2) {
+        ws.ws_row = rows;
+        ws.ws_col = cols;
+    }
+    // keystrokes and echoes are tiny: send each at once instead of waiting for the ack of
+    // the previous one (Nagle), output is coalesced below instead
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval) < 0)
+        perror("server: TCP_NODELAY");
+    fcntl(sockfd, F_SETFD, FD_CLOEXEC);
+    if (!(in = calloc(1, sizeof *in)) || !(out = calloc(1, sizeof *out)))
+        error("server: session malloc error");
+    if (eol) {                              // keystrokes sent along with the session line
+        in->len = hello + len - (eol + 1);
+        memcpy(in->buf, eol + 1, in->len);
+    }
+    if ((master = session_pty(&ws, term, &pid)) < 0) {
+        perror("server: session pty error");
+        return;
+    }
+    printf("server: Session started [shell %d, %ux%u %s]\n", pid, ws.ws_col, ws.ws_row, term);
+    fflush(stdout);
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) error("server: epoll_create error");
+    ev[0] = (struct epoll_event){.events = EPOLLIN, .data.fd = sockfd};
+    ev[1] = (struct epoll_event){.events = EPOLLIN, .data.fd = master};
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, sockfd, &ev[0]) < 0 ||
+        epoll_ctl(ep, EPOLL_CTL_ADD, master, &ev[1]) < 0) error("server: epoll_ctl error");
+
+    while (!done) {
+        if ((full = session_input(in, master)) < 0) break;
+
+        // read from a side only while what it sent before is passed on, which bounds the
+        // buffers and leaves a stalled side's data in its socket or pty
+        session_watch(ep, sockfd, (in->len < sizeof in->buf ? EPOLLIN : 0) |
+                                  (out->len ? EPOLLOUT : 0));
+        session_watch(ep, master, (out->len ? 0 : EPOLLIN) | (full ? EPOLLOUT : 0));
+        if ((n = epoll_wait(ep, ev, 2, -1)) < 0) {
+            if (errno == EINTR) continue;
+            error("server: epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            if (ev[i].data.fd == sockfd && (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                in->len < sizeof in->buf) {
+                r = recv(sockfd, in->buf + in->len, sizeof in->buf - in->len, 0);
+                if (r > 0) in->len += r;
+                else if (r == 0 || errno != EAGAIN) done = 1;    // client hung up
+            }
+            if (ev[i].data.fd == master && !out->len &&
+                (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                // take all the pty has, so the pieces the shell writes (echo, output, prompt)
+                // leave in one segment
+                while (out->len < sizeof out->buf &&
+                       (r = read(master, out->buf + out->len, sizeof out->buf - out->len)) > 0)
+                    out->len += r;
+                if (out->len == 0 && (r == 0 || errno != EAGAIN)) done = 1; // shell exited
+            }
+        }
+        if (out->len) {
+            r = send(sockfd, out->buf, out->len, MSG_NOSIGNAL);
+            if (r < 0 && errno != EAGAIN) break;
+            if (r > 0) {
+                memmove(out->buf, out->buf + r, out->len - r);
+                out->len -= r;
+            }
+        }
     }
+
+    // hang up the pty: the shell and its foreground job get SIGHUP
+    close(ep);
+    close(master);
+    kill(pid, SIGHUP);
+    reap(pid, &status);
+    printf("server: Session ended [shell %d, status %d]\n", pid,
+           WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    free(in);
+    free(out);
 }
 
 /* ============ Parse Buffer =============================================================== */
 void parseBuffer (char *input, int sockfd)
 {
-    // (Re)initialize variables
-    char *special[9] = {"&", ">", "1>", "2>", ">>", "2>>", "&>", "<", "|"};
-    char *stok[(MAX_CMDS)-1] = {0};         // array for redirect tokens
-    char *cmd = {0};                        // holds the input string
-    char *cmds[MAX_CMDS][MAX_ARGS] = {0};   // array of commands
-    int cmdc = 0;				            // reset commands counter
-    int tokc = 0;				            // reset token counter
-    int bg[MAX_CMDS] = {0};			        // array for & tokens
-    int bgflag;					            // bg flag
-    int tokflag;				            // redirect token flag
-    int run = 0;                            // run flag
+    struct arena arena = {0};               // holds the syntax tree of the request
+    struct pipeline *pl;                    // parsed command line
+    const char *err;                        // syntax error message
+    fflush(stdout);                         // don't send buffered log messages to the client
     dup2(sockfd, STDOUT_FILENO);
     dup2(sockfd, STDERR_FILENO);
 
-    // parse the string into seperate tokens and store them into an array
-    if (input != NULL && (input[0] != '\n')) {
-        run = 1;                            // set the valid run flag
-        bg[cmdc] = 0;                       // is it background process?
-        cmd = strtok (input, DELIMS);       // retrieve first token
-        while (cmd != NULL) {               // parse the input string
-            bgflag = 0;                     // bg flag lowered
-            tokflag = 0;                    // redirect token flag lowered
-            int ii;                         // special token detection starts here
-            for (ii = 0; ii < 9; ii++) {    // IMPORTANT: range should equal length of array
-                if (strcmp(cmd, special[ii]) == 0) {    // is it a special token?
-                    if (ii == 0) {          // is it an ampersand?
-                        bg[cmdc] = 1;       // this command will execute in the bg
-                        bgflag++;           // raise bg flag
-                        break;
-                    } else {                // if not, then it must be a redirect token
-                        stok[cmdc] = malloc (strlen(special[ii])+1);    // allocate space for token
-                        strcpy (stok[cmdc], special[ii]);   // store token in stok
-                        tokflag++;          // raise the redirect token flag
-                        break;
-                    }
-                }
-            }
-            if (tokflag) {                  // special token detected
-                cmds[cmdc][tokc] = malloc (1);  // allocate memory for string terminator
-                cmds[cmdc][tokc] = '\0';    // store string terminator
-                cmdc++;                     // increase command count
-                bg[cmdc] = 0;               // set next process as foreground process
-                tokc = 0;                   // reset the token counter
-            } else if (bgflag == 0) {       // if bg flag raised, skip this
-                cmds[cmdc][tokc] = malloc (strlen(cmd)+1);  // allocate mem for token
-                strcpy (cmds[cmdc][tokc], cmd); // store command
-                tokc++;                     // increase token count
-            }
-            cmd = strtok (NULL, DELIMS);    // retrieve the next token
-        } // parser block
-
-        // run commands based on the parsed command line
-        if (run) {
-            if (strcmp(cmds[0][0], "exit") == 0) {      // exit command takes priority
-                return;
-            } else if (cmdc) {  // Redirections         // prevents segfault, if # cmds > 1
-                if (strcmp(stok[0], ">") == 0) {        // redirect stdout of cmd to file
-                    redirect(cmds[0], cmds[1][0], 1, 0, bg[0]);
-                } else if (strcmp(stok[0], "1>") == 0) {// same as above, 1 is default fd
-                    redirect(cmds[0], cmds[1][0], 1, 0, bg[0]);
-                } else if (strcmp(stok[0], "2>") == 0) {// redirect stderr of cmd to a file
-                    redirect(cmds[0], cmds[1][0], 2, 0, bg[0]);
-                } else if (strcmp(stok[0], ">>") == 0) {// append stdout of cmd to a file
-                    redirect(cmds[0], cmds[1][0], 1, 1, bg[0]);
-                } else if (strcmp(stok[0], "2>>") == 0){// append stderr of cmd to a file
-                    redirect(cmds[0], cmds[1][0], 2, 1, bg[0]);
-                } else if (strcmp(stok[0], "&>") == 0) {// redirect stdout and stderr of cmd to a file
-                    redirect(cmds[0], cmds[1][0], 3, 0, bg[0]);
-                } else if (strcmp(stok[0], "<") == 0) { // redirect contents of file to stdin of cmd
-                    redirect(cmds[0], cmds[1][0], 0, 0, bg[0]);
-                } else if (strcmp(stok[0], "|") == 0) { // set up (multiple) pipes
-                    multi_pipe(&cmds, cmdc, bg);
-                } else {                                // if unable to detect special token
-                    runcmd(cmds[0]);                    // try to run single command
-                }
-            } else {
-                runcmd(cmds[0]);                        // run single command
-            }
-        } // run commands block */
-    } // if (input != NULL)
+    // parse the string into a pipeline of commands with their redirections
+    if ((pl = parse_line(&arena, input, &err)) == NULL) {
+        if (err) fprintf(stderr, "server: %s\n", err);
+    } else if (pl->cmds->argc && strcmp(pl->cmds->argv[0], "exit") == 0) {
+        // exit command takes priority: nothing to run
+    } else if (cache && cacheable(pl)) {
+        cache_run(pl, sockfd);              // answer from the result cache
+    } else {
+        exec_pipeline(pl);                  // run commands
+    }
+    fflush(stderr);
+    arena_free(&arena);
 }
 
 /* ======== Main Server Program ============================================================ */
@@ -235,11 +604,39 @@ int main(int argc, char *argv[])
     char s[INET6_ADDRSTRLEN];               // address string
     char RxBuffer[MAX_LINE];                // receive buffer
     char DtBuffer[MAX_BUFF];                // buffer containing the date
+    char UsBuffer[MAX_BUFF];                // buffer containing the resource usage
+    char cg_dir[MAX_PATH];                  // cgroup of the current request
+    int cg_status = -1;                     // cgroup creation return value
+    int opt;                                // command line option
+    char *whitelist = NULL;                 // cacheable commands
     struct sigaction sa;                    // examine and change a signal action
     int gai_status, s_status, r_status;     // getaddrinfo/send/receive return values
     int optval = 1;                         // option value for setsockopt()
     time_t ticks;                           // used for time calculation
 
+    // parse command line options (resource limits for each request)
+    while ((opt = getopt(argc, argv, "g:c:m:i:t:w:s:")) != -1) {
+        switch (opt) {
+            case 'g': cg_root = optarg; break;  // parent cgroup directory
+            case 'c': cg_cpu = optarg; break;   // cpu.max, e.g. "50000 100000"
+            case 'm': cg_mem = optarg; break;   // memory.max, e.g. "256M"
+            case 'i': cg_io = optarg; break;    // io.max, e.g. "8:0 wbps=1048576"
+            case 't': cache_ttl = atol(optarg); break;  // cache time to live in ms
+            case 'w': whitelist = optarg; break;        // cacheable commands, e.g. "df,uptime"
+            case 's': session_shell = optarg; break;    // shell of interactive sessions
+            default:
+                fprintf(stderr, "usage: %s [-g cgroup] [-c cpu.max] [-m memory.max] "
+                        "[-i io.max] [-t ttl_ms] [-w cmd,...] [-s shell]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!cg_root && (cg_cpu || cg_mem || cg_io)) cg_root = CG_ROOT;
+    if (cg_root) cg_setup();                // limits require a cgroup v2 hierarchy
+    if (cache_ttl > 0) cache_setup(whitelist ? whitelist : strdup(CACHE_CMDS));
+    path_cache = pathhash_create();         // command lookups shared by all workers
+    exec_child_hook = cg_enter;             // commands join the request cgroup
+    exec_wait_hook = reap;                  // and are reaped with their resource usage
+
     // set up structures
     memset(&hints, 0, sizeof hints);        // make sure the struct is empty
     hints.ai_family = AF_UNSPEC;            // don't care if IPv4 or IPv6
@@ -302,12 +699,28 @@ int main(int argc, char *argv[])
             // close the listening socket for the child
             close(server_s);
 
+            // commands are reaped with wait4() to collect their resource usage
+            signal(SIGCHLD, SIG_DFL);
+            if (cg_root && (cg_status = cg_create(cg_dir, sizeof cg_dir)) < 0)
+                perror("server: cgroup create error");
+
             // receive command from client
             bzero(RxBuffer, MAX_LINE);                      // clear receive buffer
             r_status = recv(client_s,RxBuffer,MAX_LINE,0);  // read
             if (r_status < 0) error("server: recv error");
             printf("server: Receiving transmission [client %s]\n", s);
-            printf("        client: %s", RxBuffer);
+            printf("        client: %.*s", (int)strcspn(RxBuffer, "\n") + 1, RxBuffer);
+
+            // interactive session: the shell's terminal is the whole response
+            if (strncmp(RxBuffer, SESSION_HELLO, strlen(SESSION_HELLO)) == 0) {
+                session(client_s, RxBuffer, r_status);
+                if (cg_status == 0) {
+                    cg_destroy(cg_dir, UsBuffer, sizeof UsBuffer);
+                    printf("%s", UsBuffer);
+                }
+                close(client_s);
+                exit(0);
+            }
 
             // parse and execute client command
             parseBuffer(RxBuffer, client_s);
@@ -323,6 +736,27 @@ int main(int argc, char *argv[])
             s_status = send(client_s, DtBuffer, strlen(DtBuffer), 0);
             if (s_status < 0) error ("server: send time error");
 
+            // send resource usage trailer to client
+            snprintf(UsBuffer, sizeof UsBuffer, "server: usage user %ld.%06lds, sys %ld.%06lds, "
+                     "max rss %ld KB, blocks in %ld, blocks out %ld\n",
+                     (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec,
+                     (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec,
+                     usage.ru_maxrss, usage.ru_inblock, usage.ru_oublock);
+            s_status = send(client_s, UsBuffer, strlen(UsBuffer), 0);
+            if (s_status < 0) error ("server: send usage error");
+            if (cg_status == 0) {
+                cg_destroy(cg_dir, UsBuffer, sizeof UsBuffer);
+                s_status = send(client_s, UsBuffer, strlen(UsBuffer), 0);
+                if (s_status < 0) error ("server: send cgroup error");
+            }
+            if (cache_result) {
+                snprintf(UsBuffer, sizeof UsBuffer, "server: cache %s (hits %lu, misses %lu, "
+                         "coalesced %lu)\n", cache_result, cache->hits, cache->misses,
+                         cache->coalesced);
+                s_status = send(client_s, UsBuffer, strlen(UsBuffer), 0);
+                if (s_status < 0) error ("server: send cache error");
+            }
+
             // send final message
             s_status = send(client_s, "server: request completed.\n", 27, 0);
             if (s_status < 0) error ("server: send completed error");